@@ -104,6 +104,8 @@ if ("protocols" IN_LIST Wayland_FIND_COMPONENTS)
 	list (APPEND WAYLAND_PROTOCOLS
 		"stable/xdg-shell/xdg-shell.xml"
 		"stable/linux-dmabuf/linux-dmabuf-v1.xml"
+		"stable/viewporter/viewporter.xml"
+		"staging/single-pixel-buffer/single-pixel-buffer-v1.xml"
 	)
 	if (NOT EXISTS "${WAYLAND_PROTOCOLS_BASEDIR}/stable/linux-dmabuf/linux-dmabuf-v1.xml")
 		list (APPEND WAYLAND_PROTOCOLS "unstable/linux-dmabuf/linux-dmabuf-unstable-v1.xml")
@@ -39,6 +39,7 @@ endif ()
 
 list (APPEND CMAKE_MODULE_PATH "${CMAKE_CURRENT_LIST_DIR}")
 find_package (Wayland REQUIRED COMPONENTS client server protocols)
+find_package (Threads REQUIRED)
 
 find_path (serverdelegate_dir NAMES "iwaylandserver.h" HINTS "${CMAKE_CURRENT_LIST_DIR}/.." DOC "Wayland Server Delegate base directory")
 
@@ -50,8 +51,18 @@ list (APPEND serverdelegate_source_files
 	${serverdelegate_dir}/source/bufferdelegate.h
 	${serverdelegate_dir}/source/callbackdelegate.cpp
 	${serverdelegate_dir}/source/callbackdelegate.h
+	${serverdelegate_dir}/source/contentanalyzer.cpp
+	${serverdelegate_dir}/source/contentanalyzer.h
 	${serverdelegate_dir}/source/dmabufferdelegate.cpp
 	${serverdelegate_dir}/source/dmabufferdelegate.h
+	${serverdelegate_dir}/source/flushscheduler.cpp
+	${serverdelegate_dir}/source/flushscheduler.h
+	${serverdelegate_dir}/source/framescheduler.cpp
+	${serverdelegate_dir}/source/framescheduler.h
+	${serverdelegate_dir}/source/pixelkernels.cpp
+	${serverdelegate_dir}/source/pixelkernels.h
+	${serverdelegate_dir}/source/region.cpp
+	${serverdelegate_dir}/source/region.h
 	${serverdelegate_dir}/source/regiondelegate.cpp
 	${serverdelegate_dir}/source/regiondelegate.h
 	${serverdelegate_dir}/source/registrydelegate.cpp
@@ -60,8 +71,11 @@ list (APPEND serverdelegate_source_files
 	${serverdelegate_dir}/source/seatdelegates.h
 	${serverdelegate_dir}/source/sharedmemorypooldelegate.cpp
 	${serverdelegate_dir}/source/sharedmemorypooldelegate.h
+	${serverdelegate_dir}/source/surfacecompositor.cpp
+	${serverdelegate_dir}/source/surfacecompositor.h
 	${serverdelegate_dir}/source/surfacedelegate.cpp
 	${serverdelegate_dir}/source/surfacedelegate.h
+	${serverdelegate_dir}/source/timerwheel.h
 	${serverdelegate_dir}/source/waylandresource.cpp
 	${serverdelegate_dir}/source/waylandserver.cpp
 	${serverdelegate_dir}/source/xdgsurfacedelegate.cpp
@@ -77,6 +91,6 @@ list (APPEND serverdelegate_public_header_files
 source_group ("source" FILES ${serverdelegate_source_files} ${serverdelegate_public_header_files})
 
 target_sources (wayland-server-delegate PRIVATE ${serverdelegate_source_files} ${serverdelegate_public_header_files})
-target_link_libraries (wayland-server-delegate PUBLIC ${WAYLAND_LIBRARIES})
+target_link_libraries (wayland-server-delegate PUBLIC ${WAYLAND_LIBRARIES} Threads::Threads)
 target_include_directories (wayland-server-delegate PRIVATE "${serverdelegate_dir}/source" PUBLIC "${serverdelegate_dir}/..")
 set_target_properties (wayland-server-delegate PROPERTIES PUBLIC_HEADER "${serverdelegate_public_header_files}")
@@ -40,6 +40,8 @@
 
 struct xdg_wm_base;
 struct zwp_linux_dmabuf_v1;
+struct wp_single_pixel_buffer_manager_v1;
+struct wp_viewporter;
 
 namespace WaylandServerDelegate {
 
@@ -117,6 +119,17 @@ struct IWaylandClientContext
 	virtual int countDmaBufferModifiers () const = 0;
 	virtual bool getDmaBufferModifier (uint32_t& format, uint32_t& modifierHigh, uint32_t& modifierLow, int index) const = 0;
 
+	/** The session compositor display. Used to flush forwarded requests, see IWaylandServer::setFlushPolicy. */
+	virtual wl_display* getDisplay () const { return nullptr; }
+
+	/** Optional session compositor globals, used to replace solid color buffers, see IWaylandServer::kReplaceSolidBuffers. */
+	virtual wp_single_pixel_buffer_manager_v1* getSinglePixelBufferManager () const { return nullptr; }
+	virtual wp_viewporter* getViewporter () const { return nullptr; }
+
+	/** Optional formats announced by the session compositor's wl_shm. ARGB8888 and XRGB8888 are always supported.
+	 * Client buffers in other formats are converted to ARGB8888 if possible. Without a list, all formats are forwarded unchanged. */
+	virtual int countSharedMemoryFormats () const { return 0; }
+	virtual uint32_t getSharedMemoryFormat (int index) const { return 0; }
 };
 
 } // namespace WaylandServerDelegate
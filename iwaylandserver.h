@@ -36,6 +36,8 @@
 #ifndef _iwaylandserver_h
 #define _iwaylandserver_h
 
+#include <stdint.h>
+
 struct wl_display;
 struct wl_surface;
 struct xdg_surface;
@@ -49,6 +51,79 @@ namespace WaylandServerDelegate {
 class WaylandResource;
 class IWaylandClientContext;
 
+//************************************************************************************************
+// FlushStatistics
+//************************************************************************************************
+
+struct FlushStatistics
+{
+	uint64_t flushCount = 0;		///< number of flushes which actually sent data to the session compositor
+	uint64_t bytesFlushed = 0;		///< total number of bytes sent by these flushes
+	uint64_t failedFlushCount = 0;	///< number of flushes which failed with an error other than EAGAIN
+};
+
+//************************************************************************************************
+// BufferStatistics
+//************************************************************************************************
+
+struct BufferStatistics
+{
+	uint64_t releaseCount = 0;		///< number of buffer releases forwarded from the session compositor
+	uint64_t releaseDelay = 0;		///< total time in milliseconds between attaching these buffers and their release
+	uint64_t starvationCount = 0;	///< number of times all buffers of the client were held by the session compositor
+	uint64_t starvationTime = 0;	///< total time in milliseconds during which the client had no free buffer
+};
+
+//************************************************************************************************
+// IFrameRatePolicy
+//************************************************************************************************
+
+struct IFrameRatePolicy
+{
+	virtual ~IFrameRatePolicy () {}
+
+	/** Get the frame rate limit in frames per second for the client connected through \a display, 0 for no limit.
+	 * Called with the server lock held when a frame callback of a client without an explicit limit is completed,
+	 * the result is reused for a second. Call IWaylandServer::setFrameRatePolicy again to apply changes immediately.
+	 */
+	virtual int getFrameRateLimit (wl_display* display) = 0;
+};
+
+//************************************************************************************************
+// ContentView
+//************************************************************************************************
+
+/** Read-only view of the last shm buffer committed to a client surface, see IWaylandServer::acquireContentView. */
+struct ContentView
+{
+	const uint8_t* data = nullptr;	///< first pixel, points into the client's pool if it is sealed against shrinking, otherwise into a copy
+	int32_t width = 0;
+	int32_t height = 0;
+	int32_t stride = 0;
+	uint32_t format = 0;			///< wl_shm format of the client buffer
+	void* handle = nullptr;			///< keeps the pixels alive until the view is released
+};
+
+//************************************************************************************************
+// IContentObserver
+//************************************************************************************************
+
+struct IContentObserver
+{
+	virtual ~IContentObserver () {}
+
+	/** The client connected through \a display committed a new shm buffer to a surface, identified by its session compositor surface \a surface.
+	 * \a x, \a y, \a width and \a height bound the damage in buffer coordinates, commits without damage are not reported.
+	 * Called with the server lock held during dispatch, acquireContentView may be called from here.
+	 */
+	virtual void contentChanged (wl_display* display, wl_surface* surface, int32_t x, int32_t y, int32_t width, int32_t height) = 0;
+
+	/** The client connected through \a display committed a null buffer to \a surface, it has no content anymore.
+	 * Called with the server lock held during dispatch.
+	 */
+	virtual void contentUnmapped (wl_display* display, wl_surface* surface) = 0;
+};
+
 //************************************************************************************************
 // IWaylandServer
 //************************************************************************************************
@@ -58,6 +133,29 @@ struct IWaylandServer
 public:
 	static IWaylandServer& instance ();
 
+	enum FlushPolicy
+	{
+		kFlushManual,		///< never flush the session compositor connection, the application takes care of it
+		kFlushPerDispatch,	///< flush once at the end of each dispatch batch (default)
+		kFlushLowLatency	///< like kFlushPerDispatch, but also flush immediately after each surface commit
+	};
+
+	enum ContentOptimizations
+	{
+		kElideIdenticalFrames = 1 << 0,	///< drop commits of shm buffers whose damaged pixels equal the last forwarded frame
+		kTightenDamage = 1 << 1,		///< shrink the damage of shm buffers to the tiles that differ from the previous buffer
+		kInferOpaqueRegion = 1 << 2,	///< derive the opaque region from the alpha channel of shm buffers if the client doesn't set one
+		kReplaceSolidBuffers = 1 << 3,	///< send single color shm buffers as scaled single-pixel buffers, see IWaylandClientContext::getSinglePixelBufferManager
+		kFlattenSubsurfaces = 1 << 4	///< composite subsurface trees created afterwards into a single host buffer while they only contain shm buffers
+	};
+
+	enum FrameClock
+	{
+		kFrameClockPerSurface,	///< forward each client frame callback to the session compositor (default)
+		kFrameClockShared,		///< complete all client frame callbacks from a single session compositor frame callback per frame of an application surface, see setFrameClock
+		kFrameClockHost			///< complete all client frame callbacks when the application calls frameTick
+	};
+
 	/** Startup the Wayland server.
 	 * @param context a context instance representing the application's session compositor connection and related resources.
 	 * @param queue an optional event queue for server-side Wayland objects.
@@ -65,7 +163,13 @@ public:
 	 * The caller should poll for events using the returned file descriptor
 	 * and call IWaylandServer::dispatch when events are available.
 	 * This can be done in the main event loop or in a separate thread.
-	 * When using a separate thread, calls to other member functions need to be synchronized externally.
+	 * libwayland-server is not thread-safe, so every call into it is serialized by the server lock,
+	 * which is held by dispatch, flush, the handlers of events from the session compositor
+	 * and the parts of the thread-safe calls that touch server-side objects.
+	 * The connection and resource lists have a separate, short-lived lock, so lookups never wait for a dispatch.
+	 * Events from the session compositor are delivered using \a queue (or the default queue),
+	 * which must be dispatched on the same thread that calls dispatch.
+	 * startup and shutdown must not overlap with any other call.
 	 * \a context must stay valid until the server is shut down.
 	 */
 	virtual int startup (IWaylandClientContext* context, wl_event_queue* queue = 0) = 0;
@@ -82,13 +186,16 @@ public:
 	/** Send all pending outgoing events to clients. */
 	virtual void flush () = 0;
 
-	/** Open a new client connection. */
+	/** Open a new client connection.
+	 * Thread-safe. The client end is set up without holding the server lock,
+	 * which is only taken while the server-side client object is created.
+	 */
 	virtual wl_display* openClientConnection () = 0;
 	
-	/** Close a previously opened client connection. */
+	/** Close a previously opened client connection. Thread-safe. */
 	virtual bool closeClientConnection (wl_display* display) = 0;
 
-	/** Get the number of active client connections. */
+	/** Get the number of active client connections. Thread-safe and lock-free. */
 	virtual int countActiveClients () const = 0;
 
 	/** Create a proxy for a client connection, wrapping an existing server-side Wayland object.
@@ -96,11 +203,111 @@ public:
 	 * @param object an existing Wayland object which has been created using the session compositor connection.
 	 * @param implementation a Wayland resource implementation to be used with the new proxy.
 	 * Takes ownership of \a implementation.
+	 * Thread-safe. The resource is created directly with the id reserved by the new proxy.
+	 * Only if the server has not read earlier requests of the client yet, the call dispatches once before retrying.
+	 * The caller must not close \a display concurrently.
 	 */
 	virtual wl_proxy* createProxy (wl_display* display, wl_proxy* object, WaylandResource* implementation) = 0;
 
-	/** Destroy a previously created proxy. */
+	/** Destroy a previously created proxy. Thread-safe, only touches the client connection. */
 	virtual void destroyProxy (wl_proxy* proxy) = 0;
+
+	/** Select when requests forwarded to the session compositor are flushed.
+	 * Flushing requires IWaylandClientContext::getDisplay to return the session compositor display.
+	 */
+	virtual void setFlushPolicy (FlushPolicy policy) = 0;
+
+	/** Get statistics about flushes of the session compositor connection. Thread-safe. */
+	virtual void getFlushStatistics (FlushStatistics& statistics) const = 0;
+
+	/** Get statistics about the buffers of the client connected through \a display.
+	 * Buffer releases are flushed to the client immediately, a growing starvation time indicates that it needs more buffers.
+	 * Returns false if there is no such client. Thread-safe.
+	 */
+	virtual bool getBufferStatistics (wl_display* display, BufferStatistics& statistics) = 0;
+
+	/** Enable optimizations based on the contents of shm buffers, see ContentOptimizations.
+	 * These map client shm pools read-only, so they only apply to pools created after the call. Disabled by default.
+	 */
+	virtual void setContentOptimizations (int optimizations) = 0;
+
+	/** Start a transaction for the client surfaces embedded into \a parentSurface, an application surface on the session compositor connection.
+	 * Until commitTransaction is called, the session compositor caches the commits of these surfaces (including nested subsurfaces)
+	 * instead of applying them, by switching their subsurfaces to synchronized mode. Thread-safe.
+	 */
+	virtual void beginTransaction (wl_surface* parentSurface) = 0;
+
+	/** End a transaction started with beginTransaction.
+	 * Call this after committing \a parentSurface, which applies the cached client commits together with the application's changes.
+	 * Thread-safe.
+	 */
+	virtual void commitTransaction (wl_surface* parentSurface) = 0;
+
+	/** Select how client frame callbacks are completed. Thread-safe.
+	 * kFrameClockShared follows the frames of \a hostSurface, an application surface on the session compositor connection,
+	 * through a transparent subsurface. Without \a hostSurface, or if the session compositor lacks wp_single_pixel_buffer_manager_v1,
+	 * client frame callbacks are forwarded per surface. Call it after startup, and again before destroying \a hostSurface.
+	 */
+	virtual void setFrameClock (FrameClock clock, wl_surface* hostSurface = nullptr) = 0;
+
+	/** Complete all client frame callbacks committed since the last tick, using \a time (in milliseconds) as callback data.
+	 * Used with kFrameClockHost, typically from the application's own frame callback. Thread-safe.
+	 */
+	virtual void frameTick (uint32_t time) = 0;
+
+	/** Limit the rate at which frame callbacks of a client are completed, 0 removes the limit.
+	 * Callbacks exceeding the limit are held back until the next frame is due. Thread-safe.
+	 */
+	virtual void setFrameRateLimit (wl_display* display, int framesPerSecond) = 0;
+
+	/** Set a policy deciding the frame rate limit of clients without an explicit limit, nullptr to remove it.
+	 * The policy must stay valid until it is removed or the server is shut down. Thread-safe.
+	 */
+	virtual void setFrameRatePolicy (IFrameRatePolicy* policy) = 0;
+
+	/** Mark the client surfaces embedded into \a parentSurface as hidden, e.g. while the application shows another page.
+	 * Frame callbacks of hidden surfaces are held until the surfaces are shown again, which stops clients from rendering
+	 * invisible content. Optionally, pointer motion over hidden surfaces isn't forwarded either. Thread-safe.
+	 */
+	virtual void setSurfacesHidden (wl_surface* parentSurface, bool hidden, bool dropPointerMotion = false) = 0;
+
+	/** Embed the toplevels of the client connected through \a display into \a parentSurface, an application surface.
+	 * Toplevels created afterwards are backed by subsurfaces of \a parentSurface instead of session compositor windows,
+	 * they are configured by configureRedirectedToplevels. Popups of these toplevels are attached to \a popupParent,
+	 * the xdg surface of \a parentSurface, or don't have a parent if it is nullptr.
+	 * Pass nullptr as \a parentSurface to create regular toplevels again. Thread-safe.
+	 */
+	virtual void setToplevelRedirection (wl_display* display, wl_surface* parentSurface, xdg_surface* popupParent = nullptr) = 0;
+
+	/** Place the redirected toplevels of the client connected through \a display at \a x, \a y relative to their parent surface
+	 * and configure them with the given size, 0 lets the client decide. The position is applied by the next commit of the parent surface.
+	 * Thread-safe.
+	 */
+	virtual void configureRedirectedToplevels (wl_display* display, int32_t x, int32_t y, int32_t width, int32_t height) = 0;
+
+	/** Set an observer which is notified about new frames of client surfaces, nullptr to remove it.
+	 * While an observer is set, client shm pools created afterwards are mapped read-only, so their contents can be viewed.
+	 * The observer must stay valid until it is removed or the server is shut down. Thread-safe.
+	 */
+	virtual void setContentObserver (IContentObserver* observer) = 0;
+
+	/** Get a view of the last shm buffer committed to \a surface by the client connected through \a display.
+	 * The client may shrink or rewrite its pool at any time, so the pixels are copied unless the pool is sealed against shrinking (F_SEAL_SHRINK).
+	 * A zero-copy view stays valid until it is released, but the client renders into the buffer again once it has been released,
+	 * so the pixels should be read (e.g. by scaleContentView) right after a contentChanged notification.
+	 * Returns false if the surface has no mapped shm buffer, e.g. if it was created before the observer was set,
+	 * or its content has been replaced by a single-pixel buffer or composited into a flattened tree. Thread-safe.
+	 */
+	virtual bool acquireContentView (wl_display* display, wl_surface* surface, ContentView& view) = 0;
+
+	/** Release a view obtained from acquireContentView. Thread-safe. */
+	virtual void releaseContentView (ContentView& view) = 0;
+
+	/** Downscale an ARGB8888 or XRGB8888 \a view to \a width x \a height ARGB8888 pixels at \a destination, e.g. for thumbnails.
+	 * Each destination pixel is the average of the view pixels it covers.
+	 * Returns false for other formats or if the destination is larger than the view. Thread-safe.
+	 */
+	virtual bool scaleContentView (const ContentView& view, uint8_t* destination, int32_t stride, int32_t width, int32_t height) = 0;
 };
 
 } // namespace WaylandServerDelegate
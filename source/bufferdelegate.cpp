@@ -34,21 +34,124 @@
 //************************************************************************************************
 
 #include "bufferdelegate.h"
+#include "pixelkernels.h"
+#include "sharedmemorypooldelegate.h"
+#include "surfacedelegate.h"
+#include "waylandserver.h"
+
+#include <algorithm>
+
+#include <sys/mman.h>
 
 using namespace WaylandServerDelegate;
 
+//************************************************************************************************
+// SharedMemoryContent
+//************************************************************************************************
+
+bool SharedMemoryContent::hasPixels () const
+{
+	if(mapping == nullptr || (format != WL_SHM_FORMAT_ARGB8888 && format != WL_SHM_FORMAT_XRGB8888))
+		return false;
+	if(width <= 0 || height <= 0 || int64_t(width) * 4 > stride)
+		return false;
+
+	return int64_t(stride) * height <= mapping->getSize ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+const uint8_t* SharedMemoryContent::readRows (std::vector<uint8_t>& copy, int32_t top, int32_t bottom) const
+{
+	if(mapping == nullptr || top < 0 || bottom > height || top >= bottom)
+		return nullptr;
+
+	return mapping->read (copy, offset + top * stride, (bottom - top) * stride);
+}
+
+//************************************************************************************************
+// BufferCache::Key
+//************************************************************************************************
+
+bool BufferCache::Key::operator == (const Key& other) const
+{
+	if(offset != other.offset || width != other.width || height != other.height || stride != other.stride || format != other.format)
+		return false;
+	if(flags != other.flags || planeCount != other.planeCount)
+		return false;
+
+	for(int i = 0; i < planeCount; i++)
+		if(!(planes[i] == other.planes[i]))
+			return false;
+	return true;
+}
+
+//************************************************************************************************
+// BufferCache
+//************************************************************************************************
+
+BufferCache::BufferCache (int maxBuffers)
+: maxBuffers (maxBuffers)
+{}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+BufferCache::~BufferCache ()
+{
+	for(Entry& entry : entries)
+		wl_buffer_destroy (entry.buffer);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void BufferCache::add (const Key& key, wl_buffer* buffer)
+{
+	if(int(entries.size ()) >= maxBuffers)
+	{
+		wl_buffer_destroy (entries.front ().buffer);
+		entries.erase (entries.begin ());
+	}
+
+	// the listener stays installed, events are ignored until the buffer is reused
+	wl_buffer_set_user_data (buffer, nullptr);
+	entries.push_back ({ key, buffer });
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+wl_buffer* BufferCache::take (const Key& key)
+{
+	for(auto it = entries.begin (); it != entries.end (); ++it)
+	{
+		if(it->key == key)
+		{
+			wl_buffer* buffer = it->buffer;
+			entries.erase (it);
+			return buffer;
+		}
+	}
+	return nullptr;
+}
+
 //************************************************************************************************
 // BufferDelegate
 //************************************************************************************************
 
-BufferDelegate::BufferDelegate (wl_buffer* buffer)
+BufferDelegate::BufferDelegate (wl_buffer* buffer, bool listening)
 : WaylandResource (&::wl_buffer_interface, static_cast<wl_buffer_interface*> (this)),
-  buffer (buffer)
+  buffer (buffer),
+  busy (false),
+  attachTime (0),
+  hostData (nullptr),
+  hostSize (0),
+  converted (false)
 {
 	destroy = onDestroy;
 	wl_buffer_listener::release = onRelease;
 
-	if(buffer)
+	if(buffer && listening)
+		wl_buffer_set_user_data (buffer, this);
+	else if(buffer)
 		wl_buffer_add_listener (buffer, this, this);
 
 	setProxy (reinterpret_cast<wl_proxy*> (buffer));
@@ -58,12 +161,143 @@ BufferDelegate::BufferDelegate (wl_buffer* buffer)
 
 BufferDelegate::~BufferDelegate ()
 {
-	if(buffer)
+	std::vector<SurfaceDelegate*> referencingSurfaces;
+	referencingSurfaces.swap (surfaces);
+	for(SurfaceDelegate* surface : referencingSurfaces)
+		surface->bufferDestroyed (this);
+
+	WaylandServer::ClientConnection* connection = WaylandServer::instance ().findClientConnection (clientHandle);
+	if(connection && resourceHandle)
+		connection->bufferDestroyed (busy);
+
+	// the session compositor has its own mapping of the host pool
+	if(hostData)
+		::munmap (hostData, hostSize);
+
+	if(buffer == nullptr)
+		return;
+
+	// a busy buffer may still be read by the session compositor, which would release it to nobody
+	std::shared_ptr<BufferCache> bufferCache = cache.lock ();
+	if(bufferCache && !busy)
+		bufferCache->add (cacheKey, buffer);
+	else
 		wl_buffer_destroy (buffer);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
+void BufferDelegate::setCache (const std::shared_ptr<BufferCache>& cache, const BufferCache::Key& key)
+{
+	this->cache = cache;
+	cacheKey = key;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void BufferDelegate::initialize ()
+{
+	WaylandServer::ClientConnection* connection = WaylandServer::instance ().findClientConnection (clientHandle);
+	if(connection)
+		connection->bufferCreated ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void BufferDelegate::release ()
+{
+	if(resourceHandle == nullptr)
+		return;
+
+	wl_buffer_send_release (resourceHandle);
+	wl_client_flush (clientHandle);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void BufferDelegate::setConversion (uint8_t* data, size_t size)
+{
+	hostData = data;
+	hostSize = size;
+	converted = false;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void BufferDelegate::convert (const Region& damage)
+{
+	if(hostData == nullptr || content.mapping == nullptr)
+		return;
+
+	Region area (Rect (0, 0, content.width, content.height));
+	if(converted)
+	{
+		staleArea.unite (damage);
+		area.intersect (staleArea);
+	}
+	if(area.isEmpty ())
+	{
+		staleArea.clear ();
+		return;
+	}
+
+	// only the rows of the stale area are read, if the client shrank the file, the previous copy is kept
+	const Rect& extents = area.getExtents ();
+	const uint8_t* source = content.readRows (sourceCopy, extents.top, extents.bottom);
+	if(source == nullptr)
+		return;
+
+	int bytesPerPixel = PixelKernels::getBytesPerPixel (content.format);
+	int32_t hostStride = content.width * 4;
+	for(const Rect& rect : area.getRects ())
+		PixelKernels::convertPixels (hostData + size_t(rect.top) * hostStride + size_t(rect.left) * 4, hostStride,
+									 source + size_t(rect.top - extents.top) * content.stride + size_t(rect.left) * bytesPerPixel, content.stride,
+									 rect.getWidth (), rect.getHeight (), content.format);
+
+	staleArea.clear ();
+	converted = true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void BufferDelegate::setBusy (bool state)
+{
+	if(state == busy)
+		return;
+
+	busy = state;
+	if(busy)
+		attachTime = FrameScheduler::getTimestamp ();
+
+	WaylandServer::ClientConnection* connection = WaylandServer::instance ().findClientConnection (clientHandle);
+	if(connection == nullptr)
+		return;
+
+	if(busy)
+		connection->bufferAttached ();
+	else
+		connection->bufferReleased (attachTime);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void BufferDelegate::addSurface (SurfaceDelegate* surface)
+{
+	if(std::find (surfaces.begin (), surfaces.end (), surface) == surfaces.end ())
+		surfaces.push_back (surface);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void BufferDelegate::removeSurface (SurfaceDelegate* surface)
+{
+	auto it = std::find (surfaces.begin (), surfaces.end (), surface);
+	if(it != surfaces.end ())
+		surfaces.erase (it);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
 void BufferDelegate::onDestroy (wl_client* client, wl_resource* resource)
 {
 	wl_resource_destroy (resource);
@@ -74,5 +308,14 @@ void BufferDelegate::onDestroy (wl_client* client, wl_resource* resource)
 void BufferDelegate::onRelease (void* data, wl_buffer* buffer)
 {
 	BufferDelegate* This = static_cast<BufferDelegate*> (data);
+	if(This == nullptr) // kept by a BufferCache
+		return;
+
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
+
+	This->setBusy (false);
 	wl_buffer_send_release (This->resourceHandle);
+
+	// double-buffered clients wait for the release, don't leave it queued until the next flush
+	wl_client_flush (This->clientHandle);
 }
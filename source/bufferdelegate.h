@@ -38,10 +38,97 @@
 
 #include "wayland-server-delegate/waylandresource.h"
 
+#include "region.h"
+
 #include <wayland-client.h>
 
+#include <memory>
+#include <vector>
+
 namespace WaylandServerDelegate {
 
+class SharedMemoryMapping;
+class SurfaceDelegate;
+
+//************************************************************************************************
+// SharedMemoryContent
+//************************************************************************************************
+
+struct SharedMemoryContent
+{
+	std::shared_ptr<SharedMemoryMapping> mapping;
+	int32_t offset = 0;
+	int32_t width = 0;
+	int32_t height = 0;
+	int32_t stride = 0;
+	uint32_t format = 0;
+
+	/** The buffer is a mapped 32 bit (A|X)RGB8888 buffer, its pixels can be analyzed. */
+	bool hasPixels () const;
+
+	/** Get rows \a top to \a bottom (exclusive) of a mapped buffer, which are read in place from sealed pools and copied to \a copy otherwise.
+	 * Returns a pointer to row \a top, rows are \a stride bytes apart, or nullptr if the rows can't be read.
+	 */
+	const uint8_t* readRows (std::vector<uint8_t>& copy, int32_t top, int32_t bottom) const;
+};
+
+//************************************************************************************************
+// BufferCache
+//************************************************************************************************
+
+/** Released upstream buffers, kept for clients creating buffers with the same parameters again. */
+class BufferCache
+{
+public:
+	/** Parameters identifying the buffer memory and layout, shm buffers use offset and stride, dmabufs their planes. */
+	struct Key
+	{
+		static const int kMaxPlanes = 4;
+
+		struct Plane
+		{
+			uint32_t index = 0;
+			uint32_t offset = 0;
+			uint32_t stride = 0;
+			uint64_t device = 0;
+			uint64_t inode = 0;
+			uint64_t modifier = 0;
+
+			bool operator == (const Plane& other) const { return index == other.index && offset == other.offset && stride == other.stride && device == other.device && inode == other.inode && modifier == other.modifier; }
+		};
+
+		int32_t offset = 0;
+		int32_t width = 0;
+		int32_t height = 0;
+		int32_t stride = 0;
+		uint32_t format = 0;
+		uint32_t flags = 0;
+		int planeCount = 0;
+		Plane planes[kMaxPlanes];
+
+		bool operator == (const Key& other) const;
+	};
+
+	BufferCache (int maxBuffers);
+	~BufferCache ();
+
+	/** Keep \a buffer, which must have been released by the session compositor. The oldest buffer is destroyed if the cache is full. */
+	void add (const Key& key, wl_buffer* buffer);
+
+	/** Remove and return a buffer created with \a key, nullptr if there is none. */
+	wl_buffer* take (const Key& key);
+
+private:
+	struct Entry
+	{
+		Key key;
+		wl_buffer* buffer;
+	};
+
+	int maxBuffers;
+	std::vector<Entry> entries; // oldest first
+};
+
 //************************************************************************************************
 // BufferDelegate
 //************************************************************************************************
@@ -51,9 +138,44 @@ class BufferDelegate: public WaylandResource,
 					  public wl_buffer_listener
 {
 public:
-	BufferDelegate (wl_buffer* buffer);
+	/** \a listening is set for buffers taken from a BufferCache, which already have a listener. */
+	BufferDelegate (wl_buffer* buffer, bool listening = false);
 	~BufferDelegate ();
 
+	wl_buffer* getBuffer () const { return buffer; }
+	const SharedMemoryContent& getContent () const { return content; }
+	void setContent (const SharedMemoryContent& content) { this->content = content; }
+
+	/** Pass the upstream buffer to \a cache when the client destroys the buffer after it has been released. */
+	void setCache (const std::shared_ptr<BufferCache>& cache, const BufferCache::Key& key);
+
+	/** Release the buffer to the client without passing it to the session compositor. */
+	void release ();
+
+	/** The upstream buffer is an ARGB8888 copy in a host pool, mapped at \a data, because the session compositor doesn't support the client format. */
+	void setConversion (uint8_t* data, size_t size);
+	bool needsConversion () const { return hostData != nullptr; }
+
+	/** Update the host copy, \a damage is the changed area of the current frame. The first conversion copies the whole buffer. */
+	void convert (const Region& damage);
+
+	/** The client changed \a damage while the buffer wasn't attached, it is converted with the next frame. */
+	void addConversionDamage (const Region& damage) { staleArea.unite (damage); }
+
+	/** Convert the whole buffer next time, e.g. when its changes couldn't be tracked. */
+	void invalidateConversion () { converted = false; }
+
+	/** The buffer has been attached upstream and not been released by the session compositor yet. */
+	bool isBusy () const { return busy; }
+	void setBusy (bool state);
+
+	/** Surfaces referencing this buffer are notified when it is destroyed. */
+	void addSurface (SurfaceDelegate* surface);
+	void removeSurface (SurfaceDelegate* surface);
+
+	// WaylandResource
+	void initialize () override;
+
 	// interface
 	static void onDestroy (wl_client* client, wl_resource* resource);
 
@@ -62,6 +184,17 @@ public:
 
 private:
 	wl_buffer* buffer;
+	bool busy;
+	uint32_t attachTime;
+	SharedMemoryContent content;
+	std::weak_ptr<BufferCache> cache; // expires with the pool or server
+	BufferCache::Key cacheKey;
+	std::vector<SurfaceDelegate*> surfaces;
+	uint8_t* hostData;
+	size_t hostSize;
+	bool converted;
+	Region staleArea;
+	std::vector<uint8_t> sourceCopy; // rows read from pools which aren't sealed
 };
 
 } // namespace WaylandServerDelegate
@@ -34,6 +34,7 @@
 //************************************************************************************************
 
 #include "callbackdelegate.h"
+#include "waylandserver.h"
 
 using namespace WaylandServerDelegate;
 
@@ -58,6 +59,8 @@ CallbackDelegate::CallbackDelegate (wl_callback* callback)
 
 CallbackDelegate::~CallbackDelegate ()
 {
+	WaylandServer::instance ().getFrameScheduler ().callbackDestroyed (this);
+
 	if(callback)
 		wl_callback_destroy (callback);
 }
@@ -67,6 +70,15 @@ CallbackDelegate::~CallbackDelegate ()
 void CallbackDelegate::onDone (void* data, wl_callback* callback, uint32_t callbackData)
 {
 	CallbackDelegate* This = static_cast<CallbackDelegate*> (data);
-	wl_callback_send_done (This->resourceHandle, callbackData);
-	wl_resource_destroy (This->resourceHandle);
+	WaylandServer& server = WaylandServer::instance ();
+	WaylandServer::ScopedLock scopedLock (server.getLock ());
+	server.getFrameScheduler ().complete (This, callbackData);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CallbackDelegate::complete (uint32_t callbackData)
+{
+	wl_callback_send_done (resourceHandle, callbackData);
+	wl_resource_destroy (resourceHandle);
 }
@@ -53,6 +53,9 @@ public:
 	CallbackDelegate (wl_callback* callback);
 	~CallbackDelegate ();
 
+	/** Send the done event to the client and destroy the callback. */
+	void complete (uint32_t callbackData);
+
 	// listener
 	static void onDone (void* data, wl_callback* callback, uint32_t callbackData);
 
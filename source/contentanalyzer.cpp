@@ -0,0 +1,370 @@
+//************************************************************************************************
+//
+// Wayland Server Delegate
+//
+// Copyright (c) 2023 CCL Software Licensing GmbH. All Rights Reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// - Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// - Neither the name of the wayland-server-delegate project nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS",
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Filename    : contentanalyzer.cpp
+// Description : Surface Content Analyzer
+//
+//************************************************************************************************
+
+#include "contentanalyzer.h"
+#include "bufferdelegate.h"
+#include "pixelkernels.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace WaylandServerDelegate;
+
+//************************************************************************************************
+// ContentAnalyzer
+//************************************************************************************************
+
+ContentAnalyzer::ContentAnalyzer ()
+: valid (false),
+  pendingValid (false),
+  opacityValid (false)
+{}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool ContentAnalyzer::compareFrame (const SharedMemoryContent& content, const Region& damage)
+{
+	changedTiles.clear ();
+	pendingPixels.clear ();
+	pendingValid = false;
+
+	if(!content.hasPixels ())
+		return false;
+
+	pendingLayout.width = content.width;
+	pendingLayout.height = content.height;
+	pendingLayout.format = content.format;
+	pendingLayout.columns = (content.width + kTileSize - 1) / kTileSize;
+	pendingLayout.rows = (content.height + kTileSize - 1) / kTileSize;
+
+	// a different buffer layout needs all tiles
+	bool fullFrame = !valid || pendingLayout != layout;
+	Region tiles;
+	if(fullFrame)
+		tiles.unite (Rect (0, 0, content.width, content.height));
+	else
+	{
+		tiles = damage;
+		tiles.intersect (Rect (0, 0, content.width, content.height));
+	}
+
+	// only the rows of the damaged tiles are read
+	int32_t top = 0;
+	const uint8_t* pixels = nullptr;
+	if(!tiles.isEmpty ())
+	{
+		top = tiles.getExtents ().top / kTileSize * kTileSize;
+		int32_t bottom = std::min<int32_t> (content.height, (tiles.getExtents ().bottom + kTileSize - 1) / kTileSize * kTileSize);
+		pixels = content.readRows (pixelCopy, top, bottom);
+		if(pixels == nullptr)
+			return false;
+	}
+	pendingValid = true;
+
+	visitedTiles.assign (size_t(pendingLayout.columns) * pendingLayout.rows, false);
+	for(const Rect& rect : tiles.getRects ())
+	{
+		for(int row = rect.top / kTileSize; row * kTileSize < rect.bottom; row++)
+		{
+			for(int column = rect.left / kTileSize; column * kTileSize < rect.right; column++)
+			{
+				int index = row * pendingLayout.columns + column;
+				if(visitedTiles[index])
+					continue;
+				visitedTiles[index] = true;
+
+				// the hash only filters out changed tiles, a collision must not drop a frame
+				Rect tile = getTile (pendingLayout, index);
+				const uint8_t* tilePixels = pixels + size_t(tile.top - top) * content.stride + size_t(tile.left) * 4;
+				uint64_t hash = PixelKernels::hashPixels (tilePixels, content.stride, tile.getWidth () * 4, tile.getHeight ());
+				if(!fullFrame && tileHashes[index] == hash && matchesFrame (tilePixels, content.stride, tile))
+					continue;
+
+				size_t offset = pendingPixels.size ();
+				size_t rowSize = size_t(tile.getWidth ()) * 4;
+				pendingPixels.resize (offset + rowSize * tile.getHeight ());
+				for(int32_t y = 0; y < tile.getHeight (); y++)
+					::memcpy (pendingPixels.data () + offset + y * rowSize, tilePixels + size_t(y) * content.stride, rowSize);
+				changedTiles.push_back ({ index, hash, offset });
+			}
+		}
+	}
+
+	return !fullFrame && changedTiles.empty ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ContentAnalyzer::frameForwarded ()
+{
+	if(!pendingValid)
+	{
+		reset ();
+		return;
+	}
+
+	if(!valid || pendingLayout != layout)
+	{
+		tileHashes.assign (size_t(pendingLayout.columns) * pendingLayout.rows, 0);
+		framePixels.resize (size_t(pendingLayout.width) * pendingLayout.height * 4);
+	}
+
+	size_t frameStride = size_t(pendingLayout.width) * 4;
+	for(const TileHash& changedTile : changedTiles)
+	{
+		tileHashes[changedTile.index] = changedTile.hash;
+
+		Rect tile = getTile (pendingLayout, changedTile.index);
+		size_t rowSize = size_t(tile.getWidth ()) * 4;
+		for(int32_t y = 0; y < tile.getHeight (); y++)
+			::memcpy (framePixels.data () + (tile.top + y) * frameStride + size_t(tile.left) * 4, pendingPixels.data () + changedTile.offset + y * rowSize, rowSize);
+	}
+
+	layout = pendingLayout;
+	valid = true;
+	pendingValid = false;
+	changedTiles.clear ();
+	pendingPixels.clear ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+Rect ContentAnalyzer::getTile (const Layout& layout, int index)
+{
+	int32_t x = index % layout.columns * kTileSize;
+	int32_t y = index / layout.columns * kTileSize;
+	return Rect (x, y, std::min<int32_t> (int32_t(kTileSize), layout.width - x), std::min<int32_t> (int32_t(kTileSize), layout.height - y));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool ContentAnalyzer::matchesFrame (const uint8_t* pixels, int32_t stride, const Rect& tile) const
+{
+	size_t frameStride = size_t(layout.width) * 4;
+	size_t rowSize = size_t(tile.getWidth ()) * 4;
+	for(int32_t y = 0; y < tile.getHeight (); y++)
+		if(::memcmp (pixels + size_t(y) * stride, framePixels.data () + (tile.top + y) * frameStride + size_t(tile.left) * 4, rowSize) != 0)
+			return false;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ContentAnalyzer::tightenDamage (Region& damage, const SharedMemoryContent& content, const SharedMemoryContent& previous)
+{
+	if(content.width != previous.width || content.height != previous.height || content.format != previous.format)
+		return;
+
+	// buffers sharing their memory can't be compared
+	if(!content.hasPixels () || !previous.hasPixels () || (content.mapping == previous.mapping && content.offset == previous.offset))
+		return;
+
+	Region bounds (Rect (0, 0, content.width, content.height));
+	bounds.intersect (damage);
+	if(bounds.isEmpty ())
+		return;
+
+	// only the rows of the damaged tiles are read
+	int32_t top = bounds.getExtents ().top / kTileSize * kTileSize;
+	int32_t bottom = std::min<int32_t> (content.height, (bounds.getExtents ().bottom + kTileSize - 1) / kTileSize * kTileSize);
+	const uint8_t* pixels = content.readRows (pixelCopy, top, bottom);
+	const uint8_t* previousPixels = previous.readRows (previousCopy, top, bottom);
+	if(pixels == nullptr || previousPixels == nullptr)
+		return;
+
+	int columns = (content.width + kTileSize - 1) / kTileSize;
+	int rows = (content.height + kTileSize - 1) / kTileSize;
+	visitedTiles.assign (size_t(columns) * rows, false);
+
+	Region changed;
+	for(const Rect& rect : bounds.getRects ())
+	{
+		for(int row = rect.top / kTileSize; row * kTileSize < rect.bottom; row++)
+		{
+			for(int column = rect.left / kTileSize; column * kTileSize < rect.right; column++)
+			{
+				int index = row * columns + column;
+				if(visitedTiles[index])
+					continue;
+				visitedTiles[index] = true;
+
+				int32_t x = column * kTileSize;
+				int32_t y = row * kTileSize;
+				int32_t width = std::min<int32_t> (int32_t(kTileSize), content.width - x);
+				int32_t height = std::min<int32_t> (int32_t(kTileSize), content.height - y);
+				int32_t firstRow = 0;
+				int32_t lastRow = 0;
+				if(PixelKernels::findChangedRows (pixels + size_t(y - top) * content.stride + size_t(x) * 4, content.stride,
+												  previousPixels + size_t(y - top) * previous.stride + size_t(x) * 4, previous.stride,
+												  width * 4, height, firstRow, lastRow))
+					changed.unite (Rect (x, y + firstRow, width, lastRow - firstRow + 1));
+			}
+		}
+	}
+
+	changed.intersect (bounds);
+	damage = changed;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool ContentAnalyzer::analyzeOpacity (const SharedMemoryContent& content, const Region& damage)
+{
+	if(!content.hasPixels ())
+	{
+		resetOpacity ();
+		return false;
+	}
+
+	Layout newLayout;
+	newLayout.width = content.width;
+	newLayout.height = content.height;
+	newLayout.format = content.format;
+	newLayout.columns = (content.width + kTileSize - 1) / kTileSize;
+	newLayout.rows = (content.height + kTileSize - 1) / kTileSize;
+
+	// buffers without alpha channel are opaque as a whole
+	if(content.format == WL_SHM_FORMAT_XRGB8888)
+	{
+		opacityLayout = newLayout;
+		opacityValid = true;
+		opaqueTiles.assign (size_t(newLayout.columns) * newLayout.rows, true);
+		return true;
+	}
+	if(content.format != WL_SHM_FORMAT_ARGB8888)
+	{
+		resetOpacity ();
+		return false;
+	}
+
+	Region tiles (Rect (0, 0, content.width, content.height));
+	bool fullFrame = !opacityValid || newLayout != opacityLayout;
+	if(!fullFrame)
+		tiles.intersect (damage);
+	if(tiles.isEmpty ())
+		return true;
+
+	// only the rows of the damaged tiles are read
+	int32_t top = tiles.getExtents ().top / kTileSize * kTileSize;
+	int32_t bottom = std::min<int32_t> (content.height, (tiles.getExtents ().bottom + kTileSize - 1) / kTileSize * kTileSize);
+	const uint8_t* pixels = content.readRows (pixelCopy, top, bottom);
+	if(pixels == nullptr)
+	{
+		resetOpacity ();
+		return false;
+	}
+
+	if(fullFrame)
+		opaqueTiles.assign (size_t(newLayout.columns) * newLayout.rows, false);
+	opacityLayout = newLayout;
+	opacityValid = true;
+
+	visitedTiles.assign (size_t(newLayout.columns) * newLayout.rows, false);
+	for(const Rect& rect : tiles.getRects ())
+	{
+		for(int row = rect.top / kTileSize; row * kTileSize < rect.bottom; row++)
+		{
+			for(int column = rect.left / kTileSize; column * kTileSize < rect.right; column++)
+			{
+				int index = row * newLayout.columns + column;
+				if(visitedTiles[index])
+					continue;
+				visitedTiles[index] = true;
+
+				int32_t x = column * kTileSize;
+				int32_t y = row * kTileSize;
+				int32_t width = std::min<int32_t> (int32_t(kTileSize), content.width - x);
+				int32_t height = std::min<int32_t> (int32_t(kTileSize), content.height - y);
+				opaqueTiles[index] = PixelKernels::isOpaque (pixels + size_t(y - top) * content.stride + size_t(x) * 4, content.stride, width, height);
+			}
+		}
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ContentAnalyzer::getOpaqueRegion (Region& region, int32_t scale) const
+{
+	region.clear ();
+	if(!opacityValid || scale < 1)
+		return;
+
+	Region bufferRegion;
+	for(int row = 0; row < opacityLayout.rows; row++)
+	{
+		for(int column = 0; column < opacityLayout.columns; column++)
+		{
+			if(!opaqueTiles[row * opacityLayout.columns + column])
+				continue;
+
+			int32_t x = column * kTileSize;
+			int32_t y = row * kTileSize;
+			bufferRegion.unite (Rect (x, y, std::min<int32_t> (int32_t(kTileSize), opacityLayout.width - x), std::min<int32_t> (int32_t(kTileSize), opacityLayout.height - y)));
+		}
+	}
+
+	// surface pixels only partially covered by opaque buffer pixels are not opaque
+	for(const Rect& rect : bufferRegion.getRects ())
+	{
+		Rect surfaceRect;
+		surfaceRect.left = (rect.left + scale - 1) / scale;
+		surfaceRect.top = (rect.top + scale - 1) / scale;
+		surfaceRect.right = rect.right / scale;
+		surfaceRect.bottom = rect.bottom / scale;
+		if(!surfaceRect.isEmpty ())
+			region.unite (surfaceRect);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ContentAnalyzer::resetOpacity ()
+{
+	opacityValid = false;
+	opaqueTiles.clear ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ContentAnalyzer::reset ()
+{
+	valid = false;
+	pendingValid = false;
+	changedTiles.clear ();
+	pendingPixels.clear ();
+	tileHashes.clear ();
+	framePixels.clear ();
+}
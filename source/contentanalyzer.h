@@ -0,0 +1,129 @@
+//************************************************************************************************
+//
+// Wayland Server Delegate
+//
+// Copyright (c) 2023 CCL Software Licensing GmbH. All Rights Reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// - Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// - Neither the name of the wayland-server-delegate project nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS",
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Filename    : contentanalyzer.h
+// Description : Surface Content Analyzer
+//
+//************************************************************************************************
+
+#ifndef _contentanalyzer_h
+#define _contentanalyzer_h
+
+#include "region.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace WaylandServerDelegate {
+
+struct SharedMemoryContent;
+
+//************************************************************************************************
+// ContentAnalyzer
+//************************************************************************************************
+
+/** Per-surface analysis of shared memory buffer contents, done in tiles of kTileSize x kTileSize pixels. */
+class ContentAnalyzer
+{
+public:
+	ContentAnalyzer ();
+
+	static const int kTileSize = 64;
+
+	/** Compare the tiles of \a content touched by \a damage (in buffer coordinates) with the last forwarded frame.
+	 * Returns true if all of them match. Tiles with equal hashes are confirmed against a copy of the forwarded frame.
+	 */
+	bool compareFrame (const SharedMemoryContent& content, const Region& damage);
+
+	/** The frame passed to compareFrame has been forwarded to the session compositor. */
+	void frameForwarded ();
+
+	/** Forget the last forwarded frame, e.g. because an unanalyzed buffer has been forwarded. */
+	void reset ();
+
+	/** Restrict \a damage (in buffer coordinates) to the rows of each tile in which \a content differs from \a previous.
+	 * \a damage is left unchanged if the buffers can't be compared.
+	 */
+	void tightenDamage (Region& damage, const SharedMemoryContent& content, const SharedMemoryContent& previous);
+
+	/** Update the opacity of the tiles of \a content touched by \a damage (in buffer coordinates).
+	 * Tiles outside of the damage keep the state of the previous frame.
+	 * Returns false if the opacity is unknown, e.g. for formats other than (A|X)RGB8888.
+	 */
+	bool analyzeOpacity (const SharedMemoryContent& content, const Region& damage);
+
+	/** Get the fully opaque area of the last analyzed frame in surface coordinates. */
+	void getOpaqueRegion (Region& region, int32_t scale) const;
+
+	/** Forget the opacity of the last analyzed frame. */
+	void resetOpacity ();
+
+private:
+	struct Layout
+	{
+		int32_t width = 0;
+		int32_t height = 0;
+		uint32_t format = 0;
+		int columns = 0;
+		int rows = 0;
+
+		bool operator == (const Layout& other) const { return width == other.width && height == other.height && format == other.format; }
+		bool operator != (const Layout& other) const { return !(*this == other); }
+	};
+
+	static Rect getTile (const Layout& layout, int index);
+	bool matchesFrame (const uint8_t* pixels, int32_t stride, const Rect& tile) const;
+
+	struct TileHash
+	{
+		int index;
+		uint64_t hash;
+		size_t offset; // of the tile pixels in pendingPixels
+	};
+
+	Layout layout;
+	Layout pendingLayout;
+	bool valid;
+	bool pendingValid;
+	std::vector<uint64_t> tileHashes;
+	std::vector<uint8_t> framePixels; // last forwarded frame, rows of width * 4 bytes
+	std::vector<TileHash> changedTiles;
+	std::vector<uint8_t> pendingPixels;
+	std::vector<uint8_t> pixelCopy;
+	std::vector<uint8_t> previousCopy;
+	std::vector<bool> visitedTiles;
+	Layout opacityLayout;
+	bool opacityValid;
+	std::vector<bool> opaqueTiles;
+};
+
+} // namespace WaylandServerDelegate
+
+#endif // _contentanalyzer_h
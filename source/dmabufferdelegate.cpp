@@ -40,6 +40,8 @@
 #include "wayland-server-delegate/iwaylandclientcontext.h"
 
 #include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
 
 using namespace WaylandServerDelegate;
 
@@ -48,8 +50,7 @@ using namespace WaylandServerDelegate;
 //************************************************************************************************
 
 DmaBufferDelegate::DmaBufferDelegate ()
-: WaylandResource (&::zwp_linux_dmabuf_v1_interface, static_cast<zwp_linux_dmabuf_v1_interface*> (this)),
-  dmaBuf (nullptr)
+: WaylandResource (&::zwp_linux_dmabuf_v1_interface, static_cast<zwp_linux_dmabuf_v1_interface*> (this))
 {
 	destroy = onDestroy;
 	create_params = createParams;
@@ -59,23 +60,21 @@ DmaBufferDelegate::DmaBufferDelegate ()
 	IWaylandClientContext* context = WaylandServer::instance ().getContext ();
 	setProxy (reinterpret_cast<wl_proxy*> (context ? context->getDmaBuffer () : nullptr));
 	wrapProxy ();
-	dmaBuf = reinterpret_cast<zwp_linux_dmabuf_v1*> (proxyWrapper);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
 void DmaBufferDelegate::initialize () 
 {
-	sendModifiers ();
+	// clients binding version 4 or later query formats via feedback objects instead
+	if(wl_resource_get_version (resourceHandle) < ZWP_LINUX_DMABUF_V1_GET_DEFAULT_FEEDBACK_SINCE_VERSION)
+		sendModifiers ();
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
 void DmaBufferDelegate::sendModifiers ()
 {
-	if(wl_resource_get_version (resourceHandle) >= ZWP_LINUX_DMABUF_V1_GET_DEFAULT_FEEDBACK_SINCE_VERSION)
-		return;
-
 	IWaylandClientContext* context = WaylandServer::instance ().getContext ();
 	for(int i = 0; context && i < context->countDmaBufferModifiers (); i++)
 	{
@@ -108,7 +107,7 @@ void DmaBufferDelegate::createParams (wl_client* client, wl_resource* resource,
 	}
 
 	DmaBufferDelegate* This = cast<DmaBufferDelegate> (resource);
-	zwp_linux_buffer_params_v1* bufferParams = zwp_linux_dmabuf_v1_create_params (This->dmaBuf);
+	zwp_linux_buffer_params_v1* bufferParams = zwp_linux_dmabuf_v1_create_params (This->getDmaBuffer ());
 	WaylandResource* implementation = new DmaBufferParamsDelegate (bufferParams);
 	connection->addResource (implementation, id);
 }
@@ -125,7 +124,7 @@ void DmaBufferDelegate::getDefaultFeedback (wl_client* client, wl_resource* reso
 	}
 
 	DmaBufferDelegate* This = cast<DmaBufferDelegate> (resource);
-	zwp_linux_dmabuf_feedback_v1* feedback = zwp_linux_dmabuf_v1_get_default_feedback (This->dmaBuf);
+	zwp_linux_dmabuf_feedback_v1* feedback = zwp_linux_dmabuf_v1_get_default_feedback (This->getDmaBuffer ());
 	WaylandResource* implementation = new DmaBufferFeedbackDelegate (feedback);
 	connection->addResource (implementation, id);
 }
@@ -143,7 +142,7 @@ void DmaBufferDelegate::getSurfaceFeedback (wl_client* client, wl_resource* reso
 
 	DmaBufferDelegate* This = cast<DmaBufferDelegate> (resource);
 	wl_surface* waylandSurface = castProxy<wl_surface> (surface);
-	zwp_linux_dmabuf_feedback_v1* feedback = zwp_linux_dmabuf_v1_get_surface_feedback (This->dmaBuf, waylandSurface);
+	zwp_linux_dmabuf_feedback_v1* feedback = zwp_linux_dmabuf_v1_get_surface_feedback (This->getDmaBuffer (), waylandSurface);
 	WaylandResource* implementation = new DmaBufferFeedbackDelegate (feedback);
 	connection->addResource (implementation, id);
 }
@@ -152,9 +151,14 @@ void DmaBufferDelegate::getSurfaceFeedback (wl_client* client, wl_resource* reso
 // DmaBufferParamsDelegate
 //************************************************************************************************
 
+std::shared_ptr<BufferCache> DmaBufferParamsDelegate::bufferCache;
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
 DmaBufferParamsDelegate::DmaBufferParamsDelegate (zwp_linux_buffer_params_v1* bufferParams)
 : WaylandResource (&::zwp_linux_buffer_params_v1_interface, static_cast<zwp_linux_buffer_params_v1_interface*> (this)),
-  bufferParams (bufferParams)
+  bufferParams (bufferParams),
+  used (false)
 {
 	destroy = onDestroy;
 	add = onAdd;
@@ -173,12 +177,123 @@ DmaBufferParamsDelegate::DmaBufferParamsDelegate (zwp_linux_buffer_params_v1* bu
 
 DmaBufferParamsDelegate::~DmaBufferParamsDelegate ()
 {
+	for(Plane& plane : planes)
+		::close (plane.fd);
+
 	if(bufferParams)
 		zwp_linux_buffer_params_v1_destroy (bufferParams);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
+void DmaBufferParamsDelegate::destroyCachedBuffers ()
+{
+	bufferCache.reset ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static struct stat getAnonymousInodeStatus ()
+{
+	struct stat status = {};
+	int fd = ::eventfd (0, EFD_CLOEXEC);
+	if(fd >= 0)
+	{
+		::fstat (fd, &status);
+		::close (fd);
+	}
+	return status;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool hasUniqueInode (const struct stat& status)
+{
+	// before Linux 5.3, all dmabufs were files of the shared anonymous inode, which eventfds still use
+	static const struct stat anonymousStatus = getAnonymousInodeStatus ();
+	if(anonymousStatus.st_ino == 0)
+		return false;
+	return status.st_dev != anonymousStatus.st_dev || status.st_ino != anonymousStatus.st_ino;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+wl_buffer* DmaBufferParamsDelegate::takeCachedBuffer (int32_t width, int32_t height, uint32_t format, uint32_t flags)
+{
+	// a dmabuf is identified by the inode of its fd, which stays allocated while the session compositor holds an import
+	cacheKey = BufferCache::Key ();
+	if(planes.size () > size_t(BufferCache::Key::kMaxPlanes))
+		return nullptr;
+
+	BufferCache::Key key;
+	key.width = width;
+	key.height = height;
+	key.format = format;
+	key.flags = flags;
+	for(const Plane& plane : planes)
+	{
+		// without an inode per dmabuf, buffers of different clients would be confused
+		struct stat status;
+		if(::fstat (plane.fd, &status) != 0 || !hasUniqueInode (status))
+			return nullptr;
+
+		BufferCache::Key::Plane& keyPlane = key.planes[key.planeCount++];
+		keyPlane.index = plane.planeIndex;
+		keyPlane.offset = plane.offset;
+		keyPlane.stride = plane.stride;
+		keyPlane.device = uint64_t(status.st_dev);
+		keyPlane.inode = uint64_t(status.st_ino);
+		keyPlane.modifier = uint64_t(plane.modifierHigh) << 32 | plane.modifierLow;
+	}
+	cacheKey = key;
+
+	if(bufferCache == nullptr)
+		bufferCache = std::make_shared<BufferCache> (int(kMaxCachedBuffers));
+	return bufferCache->take (cacheKey);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void DmaBufferParamsDelegate::sendPlanes ()
+{
+	for(Plane& plane : planes)
+	{
+		if(bufferParams)
+			zwp_linux_buffer_params_v1_add (bufferParams, plane.fd, plane.planeIndex, plane.offset, plane.stride, plane.modifierHigh, plane.modifierLow);
+		::close (plane.fd);
+	}
+	planes.clear ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+BufferDelegate* DmaBufferParamsDelegate::createBufferDelegate (wl_buffer* buffer, bool cached)
+{
+	BufferDelegate* delegate = new BufferDelegate (buffer, cached);
+	if(cacheKey.planeCount > 0 && bufferCache)
+		delegate->setCache (bufferCache, cacheKey);
+	return delegate;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void DmaBufferParamsDelegate::sendCreated (wl_buffer* buffer, bool cached)
+{
+	wl_client* client = getClientHandle ();
+	WaylandServer::ClientConnection* connection = WaylandServer::instance ().findClientConnection (client);
+	if(connection == nullptr)
+	{
+		wl_client_post_no_memory (client);
+		return;
+	}
+
+	WaylandResource* implementation = createBufferDelegate (buffer, cached);
+	connection->addResource (implementation, 0);
+	zwp_linux_buffer_params_v1_send_created (resourceHandle, implementation->getResourceHandle ());
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
 void DmaBufferParamsDelegate::onDestroy (wl_client* client, wl_resource* resource)
 {
 	wl_resource_destroy (resource);
@@ -189,9 +304,7 @@ void DmaBufferParamsDelegate::onDestroy (wl_client* client, wl_resource* resourc
 void DmaBufferParamsDelegate::onAdd (wl_client* client, wl_resource* resource, int32_t fd, uint32_t planeIndex, uint32_t offset, uint32_t stride, uint32_t high, uint32_t low)
 {
 	DmaBufferParamsDelegate* This = cast<DmaBufferParamsDelegate> (resource);
-	if(This->bufferParams)
-		zwp_linux_buffer_params_v1_add (This->bufferParams, fd, planeIndex, offset, stride, high, low);
-	::close (fd);
+	This->planes.push_back ({ fd, planeIndex, offset, stride, high, low });
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -199,6 +312,22 @@ void DmaBufferParamsDelegate::onAdd (wl_client* client, wl_resource* resource, i
 void DmaBufferParamsDelegate::onCreate (wl_client* client, wl_resource* resource, int32_t width, int32_t height, uint32_t format, uint32_t flags)
 {
 	DmaBufferParamsDelegate* This = cast<DmaBufferParamsDelegate> (resource);
+	if(This->used)
+	{
+		wl_resource_post_error (resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED, "params was already used to create a wl_buffer");
+		return;
+	}
+	This->used = true;
+
+	// plug-ins rendering with the GPU cycle through a few swapchain images, which they may import again
+	wl_buffer* buffer = This->takeCachedBuffer (width, height, format, flags);
+	if(buffer)
+	{
+		This->sendCreated (buffer, true);
+		return;
+	}
+
+	This->sendPlanes ();
 	if(This->bufferParams)
 		zwp_linux_buffer_params_v1_create (This->bufferParams, width, height, format, flags);
 }
@@ -215,8 +344,22 @@ void DmaBufferParamsDelegate::onCreateImmediate (wl_client* client, wl_resource*
 	}
 
 	DmaBufferParamsDelegate* This = cast<DmaBufferParamsDelegate> (resource);
-	wl_buffer* buffer = zwp_linux_buffer_params_v1_create_immed (This->bufferParams, width, height, format, flags);
-	WaylandResource* implementation = new BufferDelegate (buffer);
+	if(This->used)
+	{
+		wl_resource_post_error (resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED, "params was already used to create a wl_buffer");
+		return;
+	}
+	This->used = true;
+
+	wl_buffer* buffer = This->takeCachedBuffer (width, height, format, flags);
+	bool cached = buffer != nullptr;
+	if(!cached)
+	{
+		This->sendPlanes ();
+		buffer = zwp_linux_buffer_params_v1_create_immed (This->bufferParams, width, height, format, flags);
+	}
+
+	WaylandResource* implementation = This->createBufferDelegate (buffer, cached);
 	connection->addResource (implementation, id);
 }
 
@@ -225,17 +368,8 @@ void DmaBufferParamsDelegate::onCreateImmediate (wl_client* client, wl_resource*
 void DmaBufferParamsDelegate::onCreated (void* data, zwp_linux_buffer_params_v1* bufferParams, wl_buffer* buffer)
 {
 	DmaBufferParamsDelegate* This = static_cast<DmaBufferParamsDelegate*> (data);
-	wl_client* client = This->getClientHandle ();
-	WaylandServer::ClientConnection* connection = WaylandServer::instance ().findClientConnection (client);
-	if(connection == nullptr)
-	{
-		wl_client_post_no_memory (client);
-		return;
-	}
-
-	WaylandResource* implementation = new BufferDelegate (buffer);
-	connection->addResource (implementation, 0);
-	zwp_linux_buffer_params_v1_send_created (This->resourceHandle, implementation->getResourceHandle ());
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
+	This->sendCreated (buffer, false);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -243,6 +377,7 @@ void DmaBufferParamsDelegate::onCreated (void* data, zwp_linux_buffer_params_v1*
 void DmaBufferParamsDelegate::onFailed (void* data, zwp_linux_buffer_params_v1* bufferParams)
 {
 	DmaBufferParamsDelegate* This = static_cast<DmaBufferParamsDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	zwp_linux_buffer_params_v1_send_failed (This->resourceHandle);
 }
 
@@ -289,6 +424,7 @@ void DmaBufferFeedbackDelegate::onDestroy (wl_client* client, wl_resource* resou
 void DmaBufferFeedbackDelegate::onDone (void* data, zwp_linux_dmabuf_feedback_v1* feedback)
 {
 	DmaBufferFeedbackDelegate* This = static_cast<DmaBufferFeedbackDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	zwp_linux_dmabuf_feedback_v1_send_done (This->resourceHandle);
 }
 
@@ -297,6 +433,7 @@ void DmaBufferFeedbackDelegate::onDone (void* data, zwp_linux_dmabuf_feedback_v1
 void DmaBufferFeedbackDelegate::onFormatTable (void* data, zwp_linux_dmabuf_feedback_v1* feedback, int32_t fd, uint32_t size)
 {
 	DmaBufferFeedbackDelegate* This = static_cast<DmaBufferFeedbackDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	zwp_linux_dmabuf_feedback_v1_send_format_table (This->resourceHandle, fd, size);
 	::close (fd);
 }
@@ -306,6 +443,7 @@ void DmaBufferFeedbackDelegate::onFormatTable (void* data, zwp_linux_dmabuf_feed
 void DmaBufferFeedbackDelegate::onMainDevice (void* data, zwp_linux_dmabuf_feedback_v1* feedback, wl_array* device)
 {
 	DmaBufferFeedbackDelegate* This = static_cast<DmaBufferFeedbackDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	zwp_linux_dmabuf_feedback_v1_send_main_device (This->resourceHandle, device);
 }
 
@@ -314,6 +452,7 @@ void DmaBufferFeedbackDelegate::onMainDevice (void* data, zwp_linux_dmabuf_feedb
 void DmaBufferFeedbackDelegate::onTrancheDone (void* data, zwp_linux_dmabuf_feedback_v1* feedback)
 {
 	DmaBufferFeedbackDelegate* This = static_cast<DmaBufferFeedbackDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	zwp_linux_dmabuf_feedback_v1_send_tranche_done (This->resourceHandle);	
 }
 
@@ -322,6 +461,7 @@ void DmaBufferFeedbackDelegate::onTrancheDone (void* data, zwp_linux_dmabuf_feed
 void DmaBufferFeedbackDelegate::onTrancheTargetDevice (void* data, zwp_linux_dmabuf_feedback_v1* feedback, wl_array* device)
 {
 	DmaBufferFeedbackDelegate* This = static_cast<DmaBufferFeedbackDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	zwp_linux_dmabuf_feedback_v1_send_tranche_target_device (This->resourceHandle, device);	
 }
 
@@ -330,6 +470,7 @@ void DmaBufferFeedbackDelegate::onTrancheTargetDevice (void* data, zwp_linux_dma
 void DmaBufferFeedbackDelegate::onTrancheFormats (void* data, zwp_linux_dmabuf_feedback_v1* feedback, wl_array* indices)
 {
 	DmaBufferFeedbackDelegate* This = static_cast<DmaBufferFeedbackDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	zwp_linux_dmabuf_feedback_v1_send_tranche_formats (This->resourceHandle, indices);	
 }
 
@@ -338,5 +479,6 @@ void DmaBufferFeedbackDelegate::onTrancheFormats (void* data, zwp_linux_dmabuf_f
 void DmaBufferFeedbackDelegate::onTrancheFlags (void* data, zwp_linux_dmabuf_feedback_v1* feedback, uint32_t flags)
 {
 	DmaBufferFeedbackDelegate* This = static_cast<DmaBufferFeedbackDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	zwp_linux_dmabuf_feedback_v1_send_tranche_flags (This->resourceHandle, flags);	
 }
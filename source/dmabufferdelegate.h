@@ -46,6 +46,8 @@
 #include "linux-dmabuf-unstable-v1-client-protocol.h"
 #endif
 
+#include "bufferdelegate.h"
+
 namespace WaylandServerDelegate {
 
 //************************************************************************************************
@@ -76,7 +78,7 @@ public:
 	// not implemented: all events are deprecated in version 4
 
 private:
-	zwp_linux_dmabuf_v1* dmaBuf;
+	zwp_linux_dmabuf_v1* getDmaBuffer () { return getWrappedProxy<zwp_linux_dmabuf_v1> (); }
 };
 
 //************************************************************************************************
@@ -91,6 +93,11 @@ public:
 	DmaBufferParamsDelegate (zwp_linux_buffer_params_v1* bufferParams);
 	~DmaBufferParamsDelegate ();
 
+	static const int kMaxCachedBuffers = 4; ///< dmabufs of destroyed client buffers stay allocated while they are cached
+
+	/** Destroy the upstream buffers kept for clients importing the same dmabufs again. */
+	static void destroyCachedBuffers ();
+
 	// interface
 	static void onDestroy (wl_client* client, wl_resource* resource);
 	static void onAdd (wl_client* client, wl_resource* resource, int32_t fd, uint32_t planeIndex, uint32_t offset, uint32_t stride, uint32_t high, uint32_t low);
@@ -102,7 +109,27 @@ public:
 	static void onFailed (void* data, zwp_linux_buffer_params_v1* bufferParams);
 
 private:
+	struct Plane
+	{
+		int fd;
+		uint32_t planeIndex;
+		uint32_t offset;
+		uint32_t stride;
+		uint32_t modifierHigh;
+		uint32_t modifierLow;
+	};
+
 	zwp_linux_buffer_params_v1* bufferParams;
+	std::vector<Plane> planes; // forwarded when the buffer isn't found in the cache
+	bool used;
+	BufferCache::Key cacheKey;
+
+	static std::shared_ptr<BufferCache> bufferCache;
+
+	wl_buffer* takeCachedBuffer (int32_t width, int32_t height, uint32_t format, uint32_t flags);
+	void sendPlanes ();
+	BufferDelegate* createBufferDelegate (wl_buffer* buffer, bool cached);
+	void sendCreated (wl_buffer* buffer, bool cached);
 };
 
 //************************************************************************************************
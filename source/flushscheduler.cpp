@@ -0,0 +1,114 @@
+//************************************************************************************************
+//
+// Wayland Server Delegate
+//
+// Copyright (c) 2023 CCL Software Licensing GmbH. All Rights Reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// - Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// - Neither the name of the wayland-server-delegate project nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS",
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Filename    : flushscheduler.cpp
+// Description : Upstream Flush Scheduler
+//
+//************************************************************************************************
+
+#include "flushscheduler.h"
+
+#include <wayland-client.h>
+
+#include <errno.h>
+
+using namespace WaylandServerDelegate;
+
+//************************************************************************************************
+// FlushScheduler
+//************************************************************************************************
+
+FlushScheduler::FlushScheduler ()
+: display (nullptr),
+  flushPolicy (IWaylandServer::kFlushPerDispatch),
+  retryPending (false),
+  flushCount (0),
+  bytesFlushed (0),
+  failedFlushCount (0)
+{}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FlushScheduler::setDisplay (wl_display* contextDisplay)
+{
+	display = contextDisplay;
+	retryPending = false;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FlushScheduler::commitForwarded ()
+{
+	if(flushPolicy == IWaylandServer::kFlushLowLatency)
+		flush ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FlushScheduler::dispatchDone ()
+{
+	// wl_display_flush returns early without a syscall if nothing has been marshalled since the last flush,
+	// so flushing unconditionally at the end of a batch costs at most one sendmsg per batch.
+	if(flushPolicy != IWaylandServer::kFlushManual || retryPending)
+		flush ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FlushScheduler::flush ()
+{
+	if(display == nullptr)
+		return;
+
+	retryPending = false;
+
+	int result = wl_display_flush (display);
+	if(result > 0)
+	{
+		flushCount++;
+		bytesFlushed += result;
+	}
+	else if(result < 0)
+	{
+		if(errno == EAGAIN)
+			retryPending = true; // socket buffer is full, try again after the next batch
+		else
+			failedFlushCount++;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FlushScheduler::getStatistics (FlushStatistics& statistics) const
+{
+	statistics.flushCount = flushCount;
+	statistics.bytesFlushed = bytesFlushed;
+	statistics.failedFlushCount = failedFlushCount;
+}
@@ -0,0 +1,79 @@
+//************************************************************************************************
+//
+// Wayland Server Delegate
+//
+// Copyright (c) 2023 CCL Software Licensing GmbH. All Rights Reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// - Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// - Neither the name of the wayland-server-delegate project nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS",
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Filename    : flushscheduler.h
+// Description : Upstream Flush Scheduler
+//
+//************************************************************************************************
+
+#ifndef _flushscheduler_h
+#define _flushscheduler_h
+
+#include "wayland-server-delegate/iwaylandserver.h"
+
+#include <atomic>
+
+namespace WaylandServerDelegate {
+
+//************************************************************************************************
+// FlushScheduler
+//************************************************************************************************
+
+class FlushScheduler
+{
+public:
+	FlushScheduler ();
+
+	void setDisplay (wl_display* display);
+	void setPolicy (IWaylandServer::FlushPolicy policy) { flushPolicy = policy; }
+	IWaylandServer::FlushPolicy getPolicy () const { return flushPolicy; }
+
+	/** Called after a surface commit has been forwarded. */
+	void commitForwarded ();
+
+	/** Called at the end of each dispatch batch. */
+	void dispatchDone ();
+
+	void getStatistics (FlushStatistics& statistics) const;
+
+private:
+	wl_display* display;
+	std::atomic<IWaylandServer::FlushPolicy> flushPolicy;
+	bool retryPending;
+	std::atomic<uint64_t> flushCount;
+	std::atomic<uint64_t> bytesFlushed;
+	std::atomic<uint64_t> failedFlushCount;
+
+	void flush ();
+};
+
+} // namespace WaylandServerDelegate
+
+#endif // _flushscheduler_h
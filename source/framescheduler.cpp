@@ -0,0 +1,492 @@
+//************************************************************************************************
+//
+// Wayland Server Delegate
+//
+// Copyright (c) 2023 CCL Software Licensing GmbH. All Rights Reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// - Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// - Neither the name of the wayland-server-delegate project nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS",
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Filename    : framescheduler.cpp
+// Description : Frame Scheduler
+//
+//************************************************************************************************
+
+#include "framescheduler.h"
+#include "callbackdelegate.h"
+#include "surfacedelegate.h"
+#include "waylandserver.h"
+
+#include "wayland-server-delegate/iwaylandclientcontext.h"
+
+#include "single-pixel-buffer-v1-client-protocol.h"
+
+#include <algorithm>
+
+#include <time.h>
+
+using namespace WaylandServerDelegate;
+
+//************************************************************************************************
+// FrameScheduler
+//************************************************************************************************
+
+const wl_callback_listener FrameScheduler::sharedCallbackListener = { onFrameDone };
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+FrameScheduler::FrameScheduler ()
+: frameClock (IWaylandServer::kFrameClockPerSurface),
+  releasePending (false),
+  hostSurface (nullptr),
+  clockSurface (nullptr),
+  clockSubSurface (nullptr),
+  clockBuffer (nullptr),
+  sharedCallback (nullptr),
+  frameRatePolicy (nullptr),
+  wheelTimer (nullptr)
+{}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+uint32_t FrameScheduler::getTimestamp ()
+{
+	timespec now {};
+	::clock_gettime (CLOCK_MONOTONIC, &now);
+	return uint32_t(uint64_t(now.tv_sec) * 1000 + uint64_t(now.tv_nsec) / 1000000);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FrameScheduler::setClock (IWaylandServer::FrameClock clock, wl_surface* surface)
+{
+	if(clock != IWaylandServer::kFrameClockShared)
+		surface = nullptr;
+	if(clock == frameClock && surface == hostSurface)
+		return;
+
+	destroyClockSurface ();
+	hostSurface = surface;
+
+	// without a surface to follow, client callbacks are forwarded to their own surfaces
+	if(clock == IWaylandServer::kFrameClockShared && !createClockSurface ())
+	{
+		hostSurface = nullptr;
+		clock = IWaylandServer::kFrameClockPerSurface;
+	}
+	frameClock = clock;
+
+	// callbacks of the previous clock would never be completed otherwise
+	tick (getTimestamp ());
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FrameScheduler::addCallback (SurfaceDelegate* surface, CallbackDelegate* callback)
+{
+	pendingRequests.push_back ({ surface, callback });
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FrameScheduler::surfaceCommitted (SurfaceDelegate* surface)
+{
+	bool scheduled = false;
+	for(auto it = pendingRequests.begin (); it != pendingRequests.end ();)
+	{
+		if(it->surface == surface)
+		{
+			if(surface->isHidden ())
+				heldRequests.push_back (*it);
+			else
+			{
+				scheduledRequests.push_back (*it);
+				scheduled = true;
+			}
+			it = pendingRequests.erase (it);
+		}
+		else
+			++it;
+	}
+
+	if(!scheduled || frameClock != IWaylandServer::kFrameClockShared || sharedCallback || clockSurface == nullptr)
+		return;
+
+	// the clock surface is drawn whenever the application surface is, client surfaces may be occluded or off screen
+	sharedCallback = wl_surface_frame (clockSurface);
+	wl_event_queue* queue = WaylandServer::instance ().getQueue ();
+	if(queue)
+		wl_proxy_set_queue (reinterpret_cast<wl_proxy*> (sharedCallback), queue);
+	wl_callback_add_listener (sharedCallback, &sharedCallbackListener, this);
+	wl_surface_commit (clockSurface);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FrameScheduler::surfaceDestroyed (SurfaceDelegate* surface)
+{
+	for(auto it = pendingRequests.begin (); it != pendingRequests.end ();)
+	{
+		if(it->surface == surface)
+			it = pendingRequests.erase (it);
+		else
+			++it;
+	}
+
+	for(auto it = heldRequests.begin (); it != heldRequests.end ();)
+	{
+		if(it->surface == surface)
+			it = heldRequests.erase (it);
+		else
+			++it;
+	}
+
+	for(FrameRequest& request : scheduledRequests)
+		if(request.surface == surface)
+			request.surface = nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FrameScheduler::callbackDestroyed (CallbackDelegate* callback)
+{
+	if(delayedCallbacks.remove (callback))
+		return;
+
+	for(auto it = pendingRequests.begin (); it != pendingRequests.end (); ++it)
+	{
+		if(it->callback == callback)
+		{
+			pendingRequests.erase (it);
+			return;
+		}
+	}
+
+	for(auto it = scheduledRequests.begin (); it != scheduledRequests.end (); ++it)
+	{
+		if(it->callback == callback)
+		{
+			scheduledRequests.erase (it);
+			return;
+		}
+	}
+
+	for(auto it = heldRequests.begin (); it != heldRequests.end (); ++it)
+	{
+		if(it->callback == callback)
+		{
+			heldRequests.erase (it);
+			return;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FrameScheduler::tick (uint32_t time)
+{
+	std::vector<FrameRequest> requests;
+	requests.swap (scheduledRequests);
+	for(FrameRequest& request : requests)
+	{
+		// the surface may have been hidden after its commit
+		if(request.surface && request.surface->isHidden ())
+			heldRequests.push_back (request);
+		else
+			complete (request.callback, time);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FrameScheduler::releaseHeld ()
+{
+	releasePending = false;
+
+	std::vector<CallbackDelegate*> callbacks;
+	for(auto it = heldRequests.begin (); it != heldRequests.end ();)
+	{
+		if(!it->surface->isHidden ())
+		{
+			callbacks.push_back (it->callback);
+			it = heldRequests.erase (it);
+		}
+		else
+			++it;
+	}
+
+	if(callbacks.empty ())
+		return;
+
+	uint32_t time = getTimestamp ();
+	for(CallbackDelegate* callback : callbacks)
+		complete (callback, time);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FrameScheduler::complete (CallbackDelegate* callback, uint32_t time)
+{
+	wl_client* client = callback->getClientHandle ();
+	int limit = getFrameRateLimit (client);
+	if(limit <= 0)
+	{
+		callback->complete (time);
+		return;
+	}
+
+	ClientFrameRate* frameRate = findClientFrameRate (client);
+	if(frameRate == nullptr)
+	{
+		clientFrameRates.push_back ({ client, 0, false, 0 });
+		frameRate = &clientFrameRates.back ();
+	}
+
+	uint32_t now = getTimestamp ();
+	uint32_t interval = 1000 / uint32_t(std::min (limit, 1000));
+	uint32_t elapsed = now - frameRate->lastFrame;
+	if(!frameRate->hasFrame || elapsed >= interval - interval / kEarlyFrameFraction || elapsed < kSameFrameTime)
+	{
+		if(!frameRate->hasFrame || elapsed >= kSameFrameTime)
+			frameRate->lastFrame = now;
+		frameRate->hasFrame = true;
+		callback->complete (time);
+		return;
+	}
+
+	delayedCallbacks.add (callback, frameRate->lastFrame + interval, now);
+	armWheelTimer ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FrameScheduler::setFrameRateLimit (wl_client* client, int framesPerSecond)
+{
+	ClientFrameRate* frameRate = findClientFrameRate (client);
+	if(frameRate)
+		frameRate->limit = std::max (framesPerSecond, 0);
+	else if(framesPerSecond > 0)
+		clientFrameRates.push_back ({ client, framesPerSecond, false, 0 });
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FrameScheduler::clientDestroyed (wl_client* client)
+{
+	for(auto it = clientFrameRates.begin (); it != clientFrameRates.end (); ++it)
+	{
+		if(it->client == client)
+		{
+			clientFrameRates.erase (it);
+			return;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+FrameScheduler::ClientFrameRate* FrameScheduler::findClientFrameRate (wl_client* client)
+{
+	for(ClientFrameRate& frameRate : clientFrameRates)
+		if(frameRate.client == client)
+			return &frameRate;
+	return nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FrameScheduler::setFrameRatePolicy (IFrameRatePolicy* policy)
+{
+	frameRatePolicy = policy;
+
+	for(ClientFrameRate& frameRate : clientFrameRates)
+		frameRate.hasPolicyLimit = false;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+int FrameScheduler::getFrameRateLimit (wl_client* client)
+{
+	ClientFrameRate* frameRate = findClientFrameRate (client);
+	if(frameRate && frameRate->limit > 0)
+		return frameRate->limit;
+	if(frameRatePolicy == nullptr)
+		return 0;
+
+	// the policy is asked once per client and refresh time, not for every callback
+	uint32_t now = getTimestamp ();
+	if(frameRate && frameRate->hasPolicyLimit && now - frameRate->policyTime < kPolicyRefreshTime)
+		return frameRate->policyLimit;
+
+	WaylandServer::ClientConnection* connection = WaylandServer::instance ().findClientConnection (client);
+	int limit = connection ? frameRatePolicy->getFrameRateLimit (connection->clientDisplay) : 0;
+	if(frameRate == nullptr)
+	{
+		clientFrameRates.push_back ({ client, 0, false, 0 });
+		frameRate = &clientFrameRates.back ();
+	}
+	frameRate->hasPolicyLimit = true;
+	frameRate->policyLimit = limit;
+	frameRate->policyTime = now;
+	return limit;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FrameScheduler::armWheelTimer ()
+{
+	if(wheelTimer == nullptr)
+	{
+		wl_event_loop* eventLoop = WaylandServer::instance ().getEventLoop ();
+		if(eventLoop == nullptr)
+			return;
+		wheelTimer = wl_event_loop_add_timer (eventLoop, onWheelTimer, this);
+	}
+
+	if(delayedCallbacks.isEmpty ())
+	{
+		wl_event_source_timer_update (wheelTimer, 0);
+		return;
+	}
+
+	int32_t delay = int32_t(delayedCallbacks.getNextDue () - getTimestamp ());
+	wl_event_source_timer_update (wheelTimer, std::max (delay, 1));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+int FrameScheduler::onWheelTimer (void* data)
+{
+	FrameScheduler* This = static_cast<FrameScheduler*> (data);
+
+	uint32_t now = getTimestamp ();
+	std::vector<CallbackDelegate*> dueCallbacks;
+	This->delayedCallbacks.advance (now, dueCallbacks);
+
+	for(CallbackDelegate* callback : dueCallbacks)
+	{
+		ClientFrameRate* frameRate = This->findClientFrameRate (callback->getClientHandle ());
+		if(frameRate && (!frameRate->hasFrame || now - frameRate->lastFrame >= kSameFrameTime))
+		{
+			frameRate->lastFrame = now;
+			frameRate->hasFrame = true;
+		}
+		callback->complete (now);
+	}
+
+	This->armWheelTimer ();
+	return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FrameScheduler::dispatchDone ()
+{
+	if(releasePending)
+		releaseHeld ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FrameScheduler::shutdown ()
+{
+	destroyClockSurface ();
+	hostSurface = nullptr;
+	if(frameClock == IWaylandServer::kFrameClockShared)
+		frameClock = IWaylandServer::kFrameClockPerSurface;
+	pendingRequests.clear ();
+	scheduledRequests.clear ();
+	heldRequests.clear ();
+	releasePending = false;
+	clientFrameRates.clear ();
+	frameRatePolicy = nullptr;
+
+	delayedCallbacks.clear ();
+	if(wheelTimer)
+		wl_event_source_remove (wheelTimer);
+	wheelTimer = nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool FrameScheduler::createClockSurface ()
+{
+	IWaylandClientContext* context = WaylandServer::instance ().getContext ();
+	wl_compositor* compositor = context ? context->getCompositor () : nullptr;
+	wl_subcompositor* subCompositor = context ? context->getSubCompositor () : nullptr;
+	wp_single_pixel_buffer_manager_v1* singlePixelBufferManager = context ? context->getSinglePixelBufferManager () : nullptr;
+	if(hostSurface == nullptr || compositor == nullptr || subCompositor == nullptr || singlePixelBufferManager == nullptr)
+		return false;
+
+	// a fully transparent pixel without input, which the session compositor draws along with the application surface
+	clockSurface = wl_compositor_create_surface (compositor);
+	clockSubSurface = wl_subcompositor_get_subsurface (subCompositor, clockSurface, hostSurface);
+	clockBuffer = wp_single_pixel_buffer_manager_v1_create_u32_rgba_buffer (singlePixelBufferManager, 0, 0, 0, 0);
+
+	wl_region* inputRegion = wl_compositor_create_region (compositor);
+	wl_surface_set_input_region (clockSurface, inputRegion);
+	wl_region_destroy (inputRegion);
+
+	wl_subsurface_set_desync (clockSubSurface);
+	wl_surface_attach (clockSurface, clockBuffer, 0, 0);
+	wl_surface_commit (clockSurface);
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FrameScheduler::destroyClockSurface ()
+{
+	destroySharedCallback ();
+
+	if(clockSubSurface)
+		wl_subsurface_destroy (clockSubSurface);
+	clockSubSurface = nullptr;
+	if(clockSurface)
+		wl_surface_destroy (clockSurface);
+	clockSurface = nullptr;
+	if(clockBuffer)
+		wl_buffer_destroy (clockBuffer);
+	clockBuffer = nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FrameScheduler::destroySharedCallback ()
+{
+	if(sharedCallback)
+		wl_callback_destroy (sharedCallback);
+	sharedCallback = nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FrameScheduler::onFrameDone (void* data, wl_callback* callback, uint32_t time)
+{
+	FrameScheduler* This = static_cast<FrameScheduler*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
+
+	This->destroySharedCallback ();
+	This->tick (time);
+}
@@ -0,0 +1,156 @@
+//************************************************************************************************
+//
+// Wayland Server Delegate
+//
+// Copyright (c) 2023 CCL Software Licensing GmbH. All Rights Reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// - Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// - Neither the name of the wayland-server-delegate project nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS",
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Filename    : framescheduler.h
+// Description : Frame Scheduler
+//
+//************************************************************************************************
+
+#ifndef _framescheduler_h
+#define _framescheduler_h
+
+#include "timerwheel.h"
+
+#include "wayland-server-delegate/iwaylandserver.h"
+
+#include <wayland-client.h>
+#include <wayland-server.h>
+
+#include <atomic>
+#include <vector>
+
+namespace WaylandServerDelegate {
+
+class SurfaceDelegate;
+class CallbackDelegate;
+
+//************************************************************************************************
+// FrameScheduler
+//************************************************************************************************
+
+/** Completes client frame callbacks from a common clock, see IWaylandServer::FrameClock. */
+class FrameScheduler
+{
+public:
+	FrameScheduler ();
+
+	void setClock (IWaylandServer::FrameClock clock, wl_surface* hostSurface);
+	IWaylandServer::FrameClock getClock () const { return frameClock; }
+
+	/** Add a frame callback requested for \a surface. It is scheduled by the next commit of the surface. */
+	void addCallback (SurfaceDelegate* surface, CallbackDelegate* callback);
+
+	/** Schedule the callbacks added for \a surface, or hold them while the surface is hidden. */
+	void surfaceCommitted (SurfaceDelegate* surface);
+
+	void surfaceDestroyed (SurfaceDelegate* surface);
+	void callbackDestroyed (CallbackDelegate* callback);
+
+	/** Complete all scheduled callbacks. */
+	void tick (uint32_t time);
+
+	/** Complete the held callbacks of surfaces which are no longer hidden. */
+	void releaseHeld ();
+
+	/** Release held callbacks after the current dispatch, for use from resource destructors. */
+	void scheduleRelease () { releasePending = true; }
+
+	/** Complete \a callback now or, if its client exceeds its frame rate limit, as soon as the limit allows. */
+	void complete (CallbackDelegate* callback, uint32_t time);
+
+	void setFrameRateLimit (wl_client* client, int framesPerSecond);
+	void setFrameRatePolicy (IFrameRatePolicy* policy);
+	void clientDestroyed (wl_client* client);
+
+	/** Called at the end of each dispatch batch. */
+	void dispatchDone ();
+
+	void shutdown ();
+
+	static uint32_t getTimestamp ();
+
+	// shared callback listener
+	static void onFrameDone (void* data, wl_callback* callback, uint32_t time);
+
+	// delayed callback timer
+	static int onWheelTimer (void* data);
+
+private:
+	static const int kWheelSlots = 256;
+	static const uint32_t kWheelResolution = 4; ///< milliseconds per slot, the wheel covers more than the longest frame interval
+	static const uint32_t kEarlyFrameFraction = 8; ///< frames up to 1/8 of the interval early pass, they are aligned to a faster clock
+	static const uint32_t kSameFrameTime = 2; ///< milliseconds within which callbacks belong to the frame already let through
+	static const uint32_t kPolicyRefreshTime = 1000; ///< milliseconds the frame rate policy's answer for a client is reused
+
+	struct FrameRequest
+	{
+		SurfaceDelegate* surface;
+		CallbackDelegate* callback;
+	};
+
+	struct ClientFrameRate
+	{
+		wl_client* client;
+		int limit; // explicit limit, 0 if the policy decides
+		bool hasFrame;
+		uint32_t lastFrame;
+		bool hasPolicyLimit = false;
+		int policyLimit = 0;
+		uint32_t policyTime = 0;
+	};
+
+	std::atomic<IWaylandServer::FrameClock> frameClock;
+	std::vector<FrameRequest> pendingRequests; // requested, but the surface hasn't been committed yet
+	std::vector<FrameRequest> scheduledRequests;
+	std::vector<FrameRequest> heldRequests; // committed while the surface is hidden
+	bool releasePending;
+	wl_surface* hostSurface; // application surface the shared clock follows
+	wl_surface* clockSurface; // transparent subsurface of hostSurface carrying the shared callback
+	wl_subsurface* clockSubSurface;
+	wl_buffer* clockBuffer;
+	wl_callback* sharedCallback;
+	std::vector<ClientFrameRate> clientFrameRates;
+	IFrameRatePolicy* frameRatePolicy;
+	TimerWheel<CallbackDelegate*, kWheelSlots, kWheelResolution> delayedCallbacks;
+	wl_event_source* wheelTimer;
+
+	static const wl_callback_listener sharedCallbackListener;
+
+	bool createClockSurface ();
+	void destroyClockSurface ();
+	void destroySharedCallback ();
+	ClientFrameRate* findClientFrameRate (wl_client* client);
+	int getFrameRateLimit (wl_client* client);
+	void armWheelTimer ();
+};
+
+} // namespace WaylandServerDelegate
+
+#endif // _framescheduler_h
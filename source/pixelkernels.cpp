@@ -0,0 +1,1429 @@
+//************************************************************************************************
+//
+// Wayland Server Delegate
+//
+// Copyright (c) 2023 CCL Software Licensing GmbH. All Rights Reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// - Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// - Neither the name of the wayland-server-delegate project nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS",
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Filename    : pixelkernels.cpp
+// Description : Vectorized Pixel Kernels
+//
+//************************************************************************************************
+
+#include "pixelkernels.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <wayland-client.h>
+
+// SSE2 is part of x86-64, 32 bit x86 uses the plain C++ kernels
+#if defined (__x86_64__)
+#define PIXELKERNELS_X86 1
+#include <immintrin.h>
+#elif defined (__aarch64__) || defined (__ARM_NEON)
+#define PIXELKERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+using namespace WaylandServerDelegate;
+
+//************************************************************************************************
+// Hash
+// All variants compute the same result: four 64 bit lanes accumulate 32 bytes per step
+// (lane += data + low32 (data ^ key) * high32 (data ^ key)), remaining bytes are mixed into lane 0.
+// The keys advance with each step, so that equal chunks at different positions (e.g. swapped rows) contribute differently.
+//************************************************************************************************
+
+static const uint64_t kHashKeys[4] = { 0x9e3779b185ebca87ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL, 0x27d4eb2f165667c5ULL };
+static const uint64_t kHashSteps[4] = { 0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL, 0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL };
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline uint64_t loadUnaligned64 (const uint8_t* data)
+{
+	uint64_t value;
+	::memcpy (&value, data, sizeof(value));
+	return value;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline void hashTail (uint64_t lanes[4], const uint8_t* data, int32_t count)
+{
+	for(int32_t i = 0; i < count; i++)
+		lanes[0] = (lanes[0] ^ data[i]) * 0x100000001b3ULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline uint64_t hashFinish (const uint64_t lanes[4], int32_t rowBytes, int32_t rows)
+{
+	uint64_t hash = uint64_t(rowBytes) * kHashKeys[0] + uint64_t(rows);
+	for(int i = 0; i < 4; i++)
+	{
+		hash ^= lanes[i] + kHashKeys[i] + (hash << 6) + (hash >> 2);
+		hash ^= hash >> 33;
+		hash *= 0xff51afd7ed558ccdULL;
+		hash ^= hash >> 33;
+	}
+	return hash;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint64_t hashPixelsScalar (const uint8_t* data, int32_t stride, int32_t rowBytes, int32_t rows)
+{
+	uint64_t lanes[4] = { kHashKeys[0], kHashKeys[1], kHashKeys[2], kHashKeys[3] };
+	uint64_t keys[4] = { kHashKeys[0], kHashKeys[1], kHashKeys[2], kHashKeys[3] };
+	for(int32_t y = 0; y < rows; y++)
+	{
+		const uint8_t* row = data + size_t(y) * stride;
+		int32_t x = 0;
+		for(; x + 32 <= rowBytes; x += 32)
+		{
+			for(int i = 0; i < 4; i++)
+			{
+				uint64_t value = loadUnaligned64 (row + x + 8 * i);
+				uint64_t key = value ^ keys[i];
+				lanes[i] += value + (key & 0xffffffffULL) * (key >> 32);
+				keys[i] += kHashSteps[i];
+			}
+		}
+		hashTail (lanes, row + x, rowBytes - x);
+	}
+	return hashFinish (lanes, rowBytes, rows);
+}
+
+#if PIXELKERNELS_X86
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint64_t hashPixelsSSE2 (const uint8_t* data, int32_t stride, int32_t rowBytes, int32_t rows)
+{
+	const __m128i steps0 = _mm_set_epi64x (int64_t(kHashSteps[1]), int64_t(kHashSteps[0]));
+	const __m128i steps1 = _mm_set_epi64x (int64_t(kHashSteps[3]), int64_t(kHashSteps[2]));
+	__m128i keys0 = _mm_set_epi64x (int64_t(kHashKeys[1]), int64_t(kHashKeys[0]));
+	__m128i keys1 = _mm_set_epi64x (int64_t(kHashKeys[3]), int64_t(kHashKeys[2]));
+	__m128i lanes0 = keys0;
+	__m128i lanes1 = keys1;
+	uint64_t lanes[4];
+
+	for(int32_t y = 0; y < rows; y++)
+	{
+		const uint8_t* row = data + size_t(y) * stride;
+		int32_t x = 0;
+		for(; x + 32 <= rowBytes; x += 32)
+		{
+			__m128i value0 = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (row + x));
+			__m128i value1 = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (row + x + 16));
+			__m128i key0 = _mm_xor_si128 (value0, keys0);
+			__m128i key1 = _mm_xor_si128 (value1, keys1);
+			lanes0 = _mm_add_epi64 (lanes0, _mm_add_epi64 (value0, _mm_mul_epu32 (key0, _mm_srli_epi64 (key0, 32))));
+			lanes1 = _mm_add_epi64 (lanes1, _mm_add_epi64 (value1, _mm_mul_epu32 (key1, _mm_srli_epi64 (key1, 32))));
+			keys0 = _mm_add_epi64 (keys0, steps0);
+			keys1 = _mm_add_epi64 (keys1, steps1);
+		}
+		if(x < rowBytes)
+		{
+			_mm_storeu_si128 (reinterpret_cast<__m128i*> (lanes), lanes0);
+			_mm_storeu_si128 (reinterpret_cast<__m128i*> (lanes + 2), lanes1);
+			hashTail (lanes, row + x, rowBytes - x);
+			lanes0 = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (lanes));
+		}
+	}
+
+	_mm_storeu_si128 (reinterpret_cast<__m128i*> (lanes), lanes0);
+	_mm_storeu_si128 (reinterpret_cast<__m128i*> (lanes + 2), lanes1);
+	return hashFinish (lanes, rowBytes, rows);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+__attribute__ ((target ("avx2")))
+static uint64_t hashPixelsAVX2 (const uint8_t* data, int32_t stride, int32_t rowBytes, int32_t rows)
+{
+	const __m256i steps = _mm256_loadu_si256 (reinterpret_cast<const __m256i*> (kHashSteps));
+	__m256i keys = _mm256_loadu_si256 (reinterpret_cast<const __m256i*> (kHashKeys));
+	__m256i accumulator = keys;
+	alignas (32) uint64_t lanes[4];
+
+	for(int32_t y = 0; y < rows; y++)
+	{
+		const uint8_t* row = data + size_t(y) * stride;
+		int32_t x = 0;
+		for(; x + 32 <= rowBytes; x += 32)
+		{
+			__m256i value = _mm256_loadu_si256 (reinterpret_cast<const __m256i*> (row + x));
+			__m256i key = _mm256_xor_si256 (value, keys);
+			accumulator = _mm256_add_epi64 (accumulator, _mm256_add_epi64 (value, _mm256_mul_epu32 (key, _mm256_srli_epi64 (key, 32))));
+			keys = _mm256_add_epi64 (keys, steps);
+		}
+		if(x < rowBytes)
+		{
+			_mm256_store_si256 (reinterpret_cast<__m256i*> (lanes), accumulator);
+			hashTail (lanes, row + x, rowBytes - x);
+			accumulator = _mm256_load_si256 (reinterpret_cast<const __m256i*> (lanes));
+		}
+	}
+
+	_mm256_store_si256 (reinterpret_cast<__m256i*> (lanes), accumulator);
+	return hashFinish (lanes, rowBytes, rows);
+}
+#endif
+
+#if PIXELKERNELS_NEON
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint64_t hashPixelsNEON (const uint8_t* data, int32_t stride, int32_t rowBytes, int32_t rows)
+{
+	const uint64x2_t steps0 = vld1q_u64 (kHashSteps);
+	const uint64x2_t steps1 = vld1q_u64 (kHashSteps + 2);
+	uint64x2_t keys0 = vld1q_u64 (kHashKeys);
+	uint64x2_t keys1 = vld1q_u64 (kHashKeys + 2);
+	uint64x2_t lanes0 = keys0;
+	uint64x2_t lanes1 = keys1;
+	uint64_t lanes[4];
+
+	for(int32_t y = 0; y < rows; y++)
+	{
+		const uint8_t* row = data + size_t(y) * stride;
+		int32_t x = 0;
+		for(; x + 32 <= rowBytes; x += 32)
+		{
+			uint64x2_t value0 = vreinterpretq_u64_u8 (vld1q_u8 (row + x));
+			uint64x2_t value1 = vreinterpretq_u64_u8 (vld1q_u8 (row + x + 16));
+			uint64x2_t key0 = veorq_u64 (value0, keys0);
+			uint64x2_t key1 = veorq_u64 (value1, keys1);
+			lanes0 = vmlal_u32 (vaddq_u64 (lanes0, value0), vmovn_u64 (key0), vshrn_n_u64 (key0, 32));
+			lanes1 = vmlal_u32 (vaddq_u64 (lanes1, value1), vmovn_u64 (key1), vshrn_n_u64 (key1, 32));
+			keys0 = vaddq_u64 (keys0, steps0);
+			keys1 = vaddq_u64 (keys1, steps1);
+		}
+		if(x < rowBytes)
+		{
+			vst1q_u64 (lanes, lanes0);
+			vst1q_u64 (lanes + 2, lanes1);
+			hashTail (lanes, row + x, rowBytes - x);
+			lanes0 = vld1q_u64 (lanes);
+		}
+	}
+
+	vst1q_u64 (lanes, lanes0);
+	vst1q_u64 (lanes + 2, lanes1);
+	return hashFinish (lanes, rowBytes, rows);
+}
+#endif
+
+//************************************************************************************************
+// Row Comparison
+//************************************************************************************************
+
+static bool rowsEqualScalar (const uint8_t* a, const uint8_t* b, int32_t count)
+{
+	return ::memcmp (a, b, size_t(count)) == 0;
+}
+
+#if PIXELKERNELS_X86
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool rowsEqualSSE2 (const uint8_t* a, const uint8_t* b, int32_t count)
+{
+	int32_t x = 0;
+	for(; x + 32 <= count; x += 32)
+	{
+		__m128i difference0 = _mm_xor_si128 (_mm_loadu_si128 (reinterpret_cast<const __m128i*> (a + x)), _mm_loadu_si128 (reinterpret_cast<const __m128i*> (b + x)));
+		__m128i difference1 = _mm_xor_si128 (_mm_loadu_si128 (reinterpret_cast<const __m128i*> (a + x + 16)), _mm_loadu_si128 (reinterpret_cast<const __m128i*> (b + x + 16)));
+		if(_mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_or_si128 (difference0, difference1), _mm_setzero_si128 ())) != 0xffff)
+			return false;
+	}
+	return rowsEqualScalar (a + x, b + x, count - x);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+__attribute__ ((target ("avx2")))
+static bool rowsEqualAVX2 (const uint8_t* a, const uint8_t* b, int32_t count)
+{
+	int32_t x = 0;
+	for(; x + 64 <= count; x += 64)
+	{
+		__m256i difference0 = _mm256_xor_si256 (_mm256_loadu_si256 (reinterpret_cast<const __m256i*> (a + x)), _mm256_loadu_si256 (reinterpret_cast<const __m256i*> (b + x)));
+		__m256i difference1 = _mm256_xor_si256 (_mm256_loadu_si256 (reinterpret_cast<const __m256i*> (a + x + 32)), _mm256_loadu_si256 (reinterpret_cast<const __m256i*> (b + x + 32)));
+		if(!_mm256_testz_si256 (_mm256_or_si256 (difference0, difference1), _mm256_or_si256 (difference0, difference1)))
+			return false;
+	}
+	for(; x + 32 <= count; x += 32)
+	{
+		__m256i difference = _mm256_xor_si256 (_mm256_loadu_si256 (reinterpret_cast<const __m256i*> (a + x)), _mm256_loadu_si256 (reinterpret_cast<const __m256i*> (b + x)));
+		if(!_mm256_testz_si256 (difference, difference))
+			return false;
+	}
+	return rowsEqualScalar (a + x, b + x, count - x);
+}
+#endif
+
+#if PIXELKERNELS_NEON
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool rowsEqualNEON (const uint8_t* a, const uint8_t* b, int32_t count)
+{
+	int32_t x = 0;
+	for(; x + 32 <= count; x += 32)
+	{
+		uint8x16_t difference0 = veorq_u8 (vld1q_u8 (a + x), vld1q_u8 (b + x));
+		uint8x16_t difference1 = veorq_u8 (vld1q_u8 (a + x + 16), vld1q_u8 (b + x + 16));
+		uint64x2_t difference = vreinterpretq_u64_u8 (vorrq_u8 (difference0, difference1));
+		if((vgetq_lane_u64 (difference, 0) | vgetq_lane_u64 (difference, 1)) != 0)
+			return false;
+	}
+	return rowsEqualScalar (a + x, b + x, count - x);
+}
+#endif
+
+//************************************************************************************************
+// Alpha Scan
+// Pixels are combined with a bitwise AND, the alpha byte (byte 3 of each pixel) stays 0xff only if all pixels are opaque.
+//************************************************************************************************
+
+static inline bool isOpaqueMask (uint32_t mask)
+{
+	uint8_t bytes[4];
+	::memcpy (bytes, &mask, sizeof(bytes));
+	return bytes[3] == 0xff;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool rowIsOpaqueScalar (const uint8_t* row, int32_t width)
+{
+	uint32_t mask = 0xffffffff;
+	for(int32_t x = 0; x < width; x++)
+	{
+		uint32_t pixel;
+		::memcpy (&pixel, row + size_t(x) * 4, sizeof(pixel));
+		mask &= pixel;
+	}
+	return isOpaqueMask (mask);
+}
+
+#if PIXELKERNELS_X86
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool rowIsOpaqueSSE2 (const uint8_t* row, int32_t width)
+{
+	__m128i mask = _mm_set1_epi32 (-1);
+	int32_t x = 0;
+	for(; x + 8 <= width; x += 8)
+	{
+		mask = _mm_and_si128 (mask, _mm_loadu_si128 (reinterpret_cast<const __m128i*> (row + size_t(x) * 4)));
+		mask = _mm_and_si128 (mask, _mm_loadu_si128 (reinterpret_cast<const __m128i*> (row + size_t(x) * 4 + 16)));
+	}
+	// alpha bytes are bits 3, 7, 11 and 15 of the byte mask
+	if((_mm_movemask_epi8 (_mm_cmpeq_epi8 (mask, _mm_set1_epi32 (-1))) & 0x8888) != 0x8888)
+		return false;
+	return rowIsOpaqueScalar (row + size_t(x) * 4, width - x);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+__attribute__ ((target ("avx2")))
+static bool rowIsOpaqueAVX2 (const uint8_t* row, int32_t width)
+{
+	__m256i mask = _mm256_set1_epi32 (-1);
+	int32_t x = 0;
+	for(; x + 16 <= width; x += 16)
+	{
+		mask = _mm256_and_si256 (mask, _mm256_loadu_si256 (reinterpret_cast<const __m256i*> (row + size_t(x) * 4)));
+		mask = _mm256_and_si256 (mask, _mm256_loadu_si256 (reinterpret_cast<const __m256i*> (row + size_t(x) * 4 + 32)));
+	}
+	if((uint32_t(_mm256_movemask_epi8 (_mm256_cmpeq_epi8 (mask, _mm256_set1_epi32 (-1)))) & 0x88888888) != 0x88888888)
+		return false;
+	return rowIsOpaqueScalar (row + size_t(x) * 4, width - x);
+}
+#endif
+
+#if PIXELKERNELS_NEON
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool rowIsOpaqueNEON (const uint8_t* row, int32_t width)
+{
+	uint8x16_t mask = vdupq_n_u8 (0xff);
+	int32_t x = 0;
+	for(; x + 8 <= width; x += 8)
+	{
+		mask = vandq_u8 (mask, vld1q_u8 (row + size_t(x) * 4));
+		mask = vandq_u8 (mask, vld1q_u8 (row + size_t(x) * 4 + 16));
+	}
+	uint32_t lanes[4];
+	vst1q_u32 (lanes, vreinterpretq_u32_u8 (mask));
+	if(!isOpaqueMask (lanes[0] & lanes[1] & lanes[2] & lanes[3]))
+		return false;
+	return rowIsOpaqueScalar (row + size_t(x) * 4, width - x);
+}
+#endif
+
+//************************************************************************************************
+// Uniform Scan
+//************************************************************************************************
+
+static bool rowIsUniformScalar (const uint8_t* row, int32_t width, uint32_t pixel)
+{
+	for(int32_t x = 0; x < width; x++)
+	{
+		uint32_t value;
+		::memcpy (&value, row + size_t(x) * 4, sizeof(value));
+		if(value != pixel)
+			return false;
+	}
+	return true;
+}
+
+#if PIXELKERNELS_X86
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool rowIsUniformSSE2 (const uint8_t* row, int32_t width, uint32_t pixel)
+{
+	const __m128i pixels = _mm_set1_epi32 (int32_t(pixel));
+	int32_t x = 0;
+	for(; x + 8 <= width; x += 8)
+	{
+		__m128i equal0 = _mm_cmpeq_epi32 (_mm_loadu_si128 (reinterpret_cast<const __m128i*> (row + size_t(x) * 4)), pixels);
+		__m128i equal1 = _mm_cmpeq_epi32 (_mm_loadu_si128 (reinterpret_cast<const __m128i*> (row + size_t(x) * 4 + 16)), pixels);
+		if(_mm_movemask_epi8 (_mm_and_si128 (equal0, equal1)) != 0xffff)
+			return false;
+	}
+	return rowIsUniformScalar (row + size_t(x) * 4, width - x, pixel);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+__attribute__ ((target ("avx2")))
+static bool rowIsUniformAVX2 (const uint8_t* row, int32_t width, uint32_t pixel)
+{
+	const __m256i pixels = _mm256_set1_epi32 (int32_t(pixel));
+	int32_t x = 0;
+	for(; x + 16 <= width; x += 16)
+	{
+		__m256i difference0 = _mm256_xor_si256 (_mm256_loadu_si256 (reinterpret_cast<const __m256i*> (row + size_t(x) * 4)), pixels);
+		__m256i difference1 = _mm256_xor_si256 (_mm256_loadu_si256 (reinterpret_cast<const __m256i*> (row + size_t(x) * 4 + 32)), pixels);
+		__m256i difference = _mm256_or_si256 (difference0, difference1);
+		if(!_mm256_testz_si256 (difference, difference))
+			return false;
+	}
+	return rowIsUniformScalar (row + size_t(x) * 4, width - x, pixel);
+}
+#endif
+
+#if PIXELKERNELS_NEON
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool rowIsUniformNEON (const uint8_t* row, int32_t width, uint32_t pixel)
+{
+	const uint32x4_t pixels = vdupq_n_u32 (pixel);
+	int32_t x = 0;
+	for(; x + 8 <= width; x += 8)
+	{
+		uint32x4_t difference0 = veorq_u32 (vreinterpretq_u32_u8 (vld1q_u8 (row + size_t(x) * 4)), pixels);
+		uint32x4_t difference1 = veorq_u32 (vreinterpretq_u32_u8 (vld1q_u8 (row + size_t(x) * 4 + 16)), pixels);
+		uint64x2_t difference = vreinterpretq_u64_u32 (vorrq_u32 (difference0, difference1));
+		if((vgetq_lane_u64 (difference, 0) | vgetq_lane_u64 (difference, 1)) != 0)
+			return false;
+	}
+	return rowIsUniformScalar (row + size_t(x) * 4, width - x, pixel);
+}
+#endif
+
+//************************************************************************************************
+// Opaque Copy
+// The alpha byte (byte 3 of each pixel) is set to 0xff while copying, e.g. for XRGB8888 pixels.
+//************************************************************************************************
+
+static void copyOpaqueRowScalar (uint8_t* destination, const uint8_t* source, int32_t width)
+{
+	::memcpy (destination, source, size_t(width) * 4);
+	for(int32_t x = 0; x < width; x++)
+		destination[size_t(x) * 4 + 3] = 0xff;
+}
+
+#if PIXELKERNELS_X86
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void copyOpaqueRowSSE2 (uint8_t* destination, const uint8_t* source, int32_t width)
+{
+	const __m128i alpha = _mm_set1_epi32 (int32_t(0xff000000));
+	int32_t x = 0;
+	for(; x + 4 <= width; x += 4)
+	{
+		__m128i pixels = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (source + size_t(x) * 4));
+		_mm_storeu_si128 (reinterpret_cast<__m128i*> (destination + size_t(x) * 4), _mm_or_si128 (pixels, alpha));
+	}
+	copyOpaqueRowScalar (destination + size_t(x) * 4, source + size_t(x) * 4, width - x);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+__attribute__ ((target ("avx2")))
+static void copyOpaqueRowAVX2 (uint8_t* destination, const uint8_t* source, int32_t width)
+{
+	const __m256i alpha = _mm256_set1_epi32 (int32_t(0xff000000));
+	int32_t x = 0;
+	for(; x + 8 <= width; x += 8)
+	{
+		__m256i pixels = _mm256_loadu_si256 (reinterpret_cast<const __m256i*> (source + size_t(x) * 4));
+		_mm256_storeu_si256 (reinterpret_cast<__m256i*> (destination + size_t(x) * 4), _mm256_or_si256 (pixels, alpha));
+	}
+	copyOpaqueRowScalar (destination + size_t(x) * 4, source + size_t(x) * 4, width - x);
+}
+#endif
+
+#if PIXELKERNELS_NEON
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void copyOpaqueRowNEON (uint8_t* destination, const uint8_t* source, int32_t width)
+{
+	const uint32x4_t alpha = vdupq_n_u32 (0xff000000);
+	int32_t x = 0;
+	for(; x + 4 <= width; x += 4)
+	{
+		uint32x4_t pixels = vreinterpretq_u32_u8 (vld1q_u8 (source + size_t(x) * 4));
+		vst1q_u8 (destination + size_t(x) * 4, vreinterpretq_u8_u32 (vorrq_u32 (pixels, alpha)));
+	}
+	copyOpaqueRowScalar (destination + size_t(x) * 4, source + size_t(x) * 4, width - x);
+}
+#endif
+
+//************************************************************************************************
+// Blending
+// All variants compute the same result per channel: min (255, source + (destination * (255 - alpha)) / 255),
+// with the division rounded as (t + 128 + ((t + 128) >> 8)) >> 8. Opaque source pixels replace the destination,
+// transparent ones (all bytes zero) leave it unchanged.
+//************************************************************************************************
+
+static void blendRowScalar (uint8_t* destination, const uint8_t* source, int32_t width)
+{
+	for(int32_t x = 0; x < width; x++, source += 4, destination += 4)
+	{
+		uint32_t inverseAlpha = 255 - source[3];
+		if(inverseAlpha == 0)
+		{
+			::memcpy (destination, source, 4);
+			continue;
+		}
+
+		for(int i = 0; i < 4; i++)
+		{
+			uint32_t value = destination[i] * inverseAlpha + 128;
+			value = ((value + (value >> 8)) >> 8) + source[i];
+			destination[i] = uint8_t(value < 255 ? value : 255);
+		}
+	}
+}
+
+#if PIXELKERNELS_X86
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline __m128i multiplyInverseAlphaSSE2 (__m128i channels, __m128i pixels)
+{
+	// broadcast the alpha word of each pixel to its four channels
+	__m128i alpha = _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (pixels, _MM_SHUFFLE (3, 3, 3, 3)), _MM_SHUFFLE (3, 3, 3, 3));
+	__m128i value = _mm_add_epi16 (_mm_mullo_epi16 (channels, _mm_sub_epi16 (_mm_set1_epi16 (255), alpha)), _mm_set1_epi16 (128));
+	return _mm_srli_epi16 (_mm_add_epi16 (value, _mm_srli_epi16 (value, 8)), 8);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void blendRowSSE2 (uint8_t* destination, const uint8_t* source, int32_t width)
+{
+	const __m128i zero = _mm_setzero_si128 ();
+	int32_t x = 0;
+	for(; x + 4 <= width; x += 4)
+	{
+		__m128i pixels = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (source + size_t(x) * 4));
+		if((_mm_movemask_epi8 (_mm_cmpeq_epi8 (pixels, _mm_set1_epi32 (-1))) & 0x8888) == 0x8888)
+		{
+			_mm_storeu_si128 (reinterpret_cast<__m128i*> (destination + size_t(x) * 4), pixels);
+			continue;
+		}
+		if(_mm_movemask_epi8 (_mm_cmpeq_epi8 (pixels, zero)) == 0xffff)
+			continue;
+
+		__m128i background = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (destination + size_t(x) * 4));
+		__m128i low = multiplyInverseAlphaSSE2 (_mm_unpacklo_epi8 (background, zero), _mm_unpacklo_epi8 (pixels, zero));
+		__m128i high = multiplyInverseAlphaSSE2 (_mm_unpackhi_epi8 (background, zero), _mm_unpackhi_epi8 (pixels, zero));
+		_mm_storeu_si128 (reinterpret_cast<__m128i*> (destination + size_t(x) * 4), _mm_adds_epu8 (_mm_packus_epi16 (low, high), pixels));
+	}
+	blendRowScalar (destination + size_t(x) * 4, source + size_t(x) * 4, width - x);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+__attribute__ ((target ("avx2")))
+static inline __m256i multiplyInverseAlphaAVX2 (__m256i channels, __m256i pixels)
+{
+	__m256i alpha = _mm256_shufflehi_epi16 (_mm256_shufflelo_epi16 (pixels, _MM_SHUFFLE (3, 3, 3, 3)), _MM_SHUFFLE (3, 3, 3, 3));
+	__m256i value = _mm256_add_epi16 (_mm256_mullo_epi16 (channels, _mm256_sub_epi16 (_mm256_set1_epi16 (255), alpha)), _mm256_set1_epi16 (128));
+	return _mm256_srli_epi16 (_mm256_add_epi16 (value, _mm256_srli_epi16 (value, 8)), 8);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+__attribute__ ((target ("avx2")))
+static void blendRowAVX2 (uint8_t* destination, const uint8_t* source, int32_t width)
+{
+	const __m256i zero = _mm256_setzero_si256 ();
+	int32_t x = 0;
+	for(; x + 8 <= width; x += 8)
+	{
+		__m256i pixels = _mm256_loadu_si256 (reinterpret_cast<const __m256i*> (source + size_t(x) * 4));
+		if((uint32_t(_mm256_movemask_epi8 (_mm256_cmpeq_epi8 (pixels, _mm256_set1_epi32 (-1)))) & 0x88888888) == 0x88888888)
+		{
+			_mm256_storeu_si256 (reinterpret_cast<__m256i*> (destination + size_t(x) * 4), pixels);
+			continue;
+		}
+		if(_mm256_testz_si256 (pixels, pixels))
+			continue;
+
+		// unpacking and packing work within 128 bit lanes, so the pixel order is preserved
+		__m256i background = _mm256_loadu_si256 (reinterpret_cast<const __m256i*> (destination + size_t(x) * 4));
+		__m256i low = multiplyInverseAlphaAVX2 (_mm256_unpacklo_epi8 (background, zero), _mm256_unpacklo_epi8 (pixels, zero));
+		__m256i high = multiplyInverseAlphaAVX2 (_mm256_unpackhi_epi8 (background, zero), _mm256_unpackhi_epi8 (pixels, zero));
+		_mm256_storeu_si256 (reinterpret_cast<__m256i*> (destination + size_t(x) * 4), _mm256_adds_epu8 (_mm256_packus_epi16 (low, high), pixels));
+	}
+	blendRowScalar (destination + size_t(x) * 4, source + size_t(x) * 4, width - x);
+}
+#endif
+
+#if PIXELKERNELS_NEON
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline uint8x16_t multiplyNEON (uint8x16_t channel, uint8x16_t inverseAlpha)
+{
+	uint16x8_t low = vmull_u8 (vget_low_u8 (channel), vget_low_u8 (inverseAlpha));
+	uint16x8_t high = vmull_u8 (vget_high_u8 (channel), vget_high_u8 (inverseAlpha));
+	return vcombine_u8 (vraddhn_u16 (low, vrshrq_n_u16 (low, 8)), vraddhn_u16 (high, vrshrq_n_u16 (high, 8)));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void blendRowNEON (uint8_t* destination, const uint8_t* source, int32_t width)
+{
+	int32_t x = 0;
+	for(; x + 16 <= width; x += 16)
+	{
+		// channels are deinterleaved, val[3] holds the alpha bytes of 16 pixels
+		uint8x16x4_t pixels = vld4q_u8 (source + size_t(x) * 4);
+		uint8x16x4_t background = vld4q_u8 (destination + size_t(x) * 4);
+		uint8x16_t inverseAlpha = vmvnq_u8 (pixels.val[3]);
+		for(int i = 0; i < 4; i++)
+			background.val[i] = vqaddq_u8 (pixels.val[i], multiplyNEON (background.val[i], inverseAlpha));
+		vst4q_u8 (destination + size_t(x) * 4, background);
+	}
+	blendRowScalar (destination + size_t(x) * 4, source + size_t(x) * 4, width - x);
+}
+#endif
+
+//************************************************************************************************
+// Format Conversion
+// Pixels of other shm formats are converted to ARGB8888 (bytes B, G, R, A in memory). Formats without
+// alpha channel become opaque, channels are widened by replicating their high bits and narrowed by truncation.
+// 32 bit formats are byte permutations of ARGB8888: rotated right by 8 bits, red and blue swapped, or both.
+//************************************************************************************************
+
+struct ConversionInfo
+{
+	int bytesPerPixel;
+	bool rotate; // 32 bit formats with alpha (or padding) in the lowest byte
+	bool swap; // red and blue exchanged
+	bool opaque;
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool getConversionInfo (ConversionInfo& info, uint32_t format)
+{
+	switch(format)
+	{
+	case WL_SHM_FORMAT_ARGB8888 : info = { 4, false, false, false }; return true;
+	case WL_SHM_FORMAT_XRGB8888 : info = { 4, false, false, true }; return true;
+	case WL_SHM_FORMAT_ABGR8888 : info = { 4, false, true, false }; return true;
+	case WL_SHM_FORMAT_XBGR8888 : info = { 4, false, true, true }; return true;
+	case WL_SHM_FORMAT_RGBA8888 : info = { 4, true, false, false }; return true;
+	case WL_SHM_FORMAT_RGBX8888 : info = { 4, true, false, true }; return true;
+	case WL_SHM_FORMAT_BGRA8888 : info = { 4, true, true, false }; return true;
+	case WL_SHM_FORMAT_BGRX8888 : info = { 4, true, true, true }; return true;
+	case WL_SHM_FORMAT_ARGB2101010 : info = { 4, false, false, false }; return true;
+	case WL_SHM_FORMAT_XRGB2101010 : info = { 4, false, false, true }; return true;
+	case WL_SHM_FORMAT_ABGR2101010 : info = { 4, false, true, false }; return true;
+	case WL_SHM_FORMAT_XBGR2101010 : info = { 4, false, true, true }; return true;
+	case WL_SHM_FORMAT_RGB888 : info = { 3, false, false, true }; return true;
+	case WL_SHM_FORMAT_BGR888 : info = { 3, false, true, true }; return true;
+	case WL_SHM_FORMAT_RGB565 : info = { 2, false, false, true }; return true;
+	case WL_SHM_FORMAT_BGR565 : info = { 2, false, true, true }; return true;
+	case WL_SHM_FORMAT_ARGB4444 : info = { 2, false, false, false }; return true;
+	case WL_SHM_FORMAT_XRGB4444 : info = { 2, false, false, true }; return true;
+	case WL_SHM_FORMAT_ARGB1555 : info = { 2, false, false, false }; return true;
+	case WL_SHM_FORMAT_XRGB1555 : info = { 2, false, false, true }; return true;
+	}
+	return false;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline bool is2101010 (uint32_t format)
+{
+	return format == WL_SHM_FORMAT_ARGB2101010 || format == WL_SHM_FORMAT_XRGB2101010 ||
+		   format == WL_SHM_FORMAT_ABGR2101010 || format == WL_SHM_FORMAT_XBGR2101010;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline uint32_t packPixel (uint32_t alpha, uint32_t red, uint32_t green, uint32_t blue, bool swap)
+{
+	return swap ? (alpha << 24) | (blue << 16) | (green << 8) | red : (alpha << 24) | (red << 16) | (green << 8) | blue;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void convertRowScalar (uint8_t* destination, const uint8_t* source, int32_t width, uint32_t format)
+{
+	ConversionInfo info;
+	if(!getConversionInfo (info, format))
+		return;
+
+	for(int32_t x = 0; x < width; x++, source += info.bytesPerPixel, destination += 4)
+	{
+		uint32_t pixel = 0;
+		::memcpy (&pixel, source, size_t(info.bytesPerPixel));
+
+		uint32_t result = 0;
+		if(is2101010 (format))
+		{
+			uint32_t alpha = info.opaque ? 0xff : (pixel >> 30) * 0x55;
+			result = packPixel (alpha, (pixel >> 22) & 0xff, (pixel >> 12) & 0xff, (pixel >> 2) & 0xff, info.swap);
+		}
+		else if(info.bytesPerPixel == 4)
+		{
+			result = info.rotate ? (pixel >> 8) | (pixel << 24) : pixel;
+			if(info.swap)
+				result = (result & 0xff00ff00) | ((result >> 16) & 0xff) | ((result & 0xff) << 16);
+			if(info.opaque)
+				result |= 0xff000000;
+		}
+		else if(info.bytesPerPixel == 3)
+			result = packPixel (0xff, (pixel >> 16) & 0xff, (pixel >> 8) & 0xff, pixel & 0xff, info.swap);
+		else if(format == WL_SHM_FORMAT_RGB565 || format == WL_SHM_FORMAT_BGR565)
+		{
+			uint32_t high = pixel >> 11;
+			uint32_t green = (pixel >> 5) & 0x3f;
+			uint32_t low = pixel & 0x1f;
+			result = packPixel (0xff, (high << 3) | (high >> 2), (green << 2) | (green >> 4), (low << 3) | (low >> 2), info.swap);
+		}
+		else if(format == WL_SHM_FORMAT_ARGB4444 || format == WL_SHM_FORMAT_XRGB4444)
+		{
+			uint32_t alpha = info.opaque ? 0xff : (pixel >> 12) * 0x11;
+			result = packPixel (alpha, ((pixel >> 8) & 0xf) * 0x11, ((pixel >> 4) & 0xf) * 0x11, (pixel & 0xf) * 0x11, false);
+		}
+		else
+		{
+			uint32_t alpha = info.opaque || (pixel & 0x8000) ? 0xff : 0;
+			uint32_t red = (pixel >> 10) & 0x1f;
+			uint32_t green = (pixel >> 5) & 0x1f;
+			uint32_t blue = pixel & 0x1f;
+			result = packPixel (alpha, (red << 3) | (red >> 2), (green << 3) | (green >> 2), (blue << 3) | (blue >> 2), false);
+		}
+		::memcpy (destination, &result, 4);
+	}
+}
+
+#if PIXELKERNELS_X86
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline __m128i swapRedBlueSSE2 (__m128i pixels)
+{
+	const __m128i greenAlpha = _mm_set1_epi32 (int32_t(0xff00ff00));
+	const __m128i low = _mm_set1_epi32 (0xff);
+	return _mm_or_si128 (_mm_and_si128 (pixels, greenAlpha),
+						 _mm_or_si128 (_mm_and_si128 (_mm_srli_epi32 (pixels, 16), low), _mm_slli_epi32 (_mm_and_si128 (pixels, low), 16)));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline __m128i widenSSE2 (__m128i value, int bits)
+{
+	// replicates the high bits into the low ones, e.g. 5 bit 0x1f becomes 0xff
+	return _mm_or_si128 (_mm_slli_epi32 (value, 8 - bits), _mm_srli_epi32 (value, 2 * bits - 8));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline __m128i convert565SSE2 (__m128i pixels, bool swap)
+{
+	const __m128i mask5 = _mm_set1_epi32 (0x1f);
+	const __m128i mask6 = _mm_set1_epi32 (0x3f);
+	__m128i high = widenSSE2 (_mm_srli_epi32 (pixels, 11), 5);
+	__m128i green = widenSSE2 (_mm_and_si128 (_mm_srli_epi32 (pixels, 5), mask6), 6);
+	__m128i low = widenSSE2 (_mm_and_si128 (pixels, mask5), 5);
+	__m128i result = _mm_or_si128 (_mm_set1_epi32 (int32_t(0xff000000)), _mm_slli_epi32 (green, 8));
+	return _mm_or_si128 (result, swap ? _mm_or_si128 (_mm_slli_epi32 (low, 16), high) : _mm_or_si128 (_mm_slli_epi32 (high, 16), low));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline __m128i convert2101010SSE2 (__m128i pixels, bool opaque)
+{
+	const __m128i mask = _mm_set1_epi32 (0xff);
+	__m128i red = _mm_and_si128 (_mm_srli_epi32 (pixels, 22), mask);
+	__m128i green = _mm_and_si128 (_mm_srli_epi32 (pixels, 12), mask);
+	__m128i blue = _mm_and_si128 (_mm_srli_epi32 (pixels, 2), mask);
+	__m128i alpha = _mm_set1_epi32 (int32_t(0xff000000));
+	if(!opaque)
+	{
+		// 2 bit alpha times 0x55
+		__m128i value = _mm_srli_epi32 (pixels, 30);
+		value = _mm_or_si128 (value, _mm_slli_epi32 (value, 2));
+		alpha = _mm_slli_epi32 (_mm_or_si128 (value, _mm_slli_epi32 (value, 4)), 24);
+	}
+	return _mm_or_si128 (_mm_or_si128 (alpha, _mm_slli_epi32 (red, 16)), _mm_or_si128 (_mm_slli_epi32 (green, 8), blue));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void convertRowSSE2 (uint8_t* destination, const uint8_t* source, int32_t width, uint32_t format)
+{
+	ConversionInfo info;
+	if(!getConversionInfo (info, format))
+		return;
+
+	const __m128i alpha = _mm_set1_epi32 (int32_t(0xff000000));
+	int32_t x = 0;
+	if(is2101010 (format))
+	{
+		for(; x + 4 <= width; x += 4)
+		{
+			__m128i pixels = convert2101010SSE2 (_mm_loadu_si128 (reinterpret_cast<const __m128i*> (source + size_t(x) * 4)), info.opaque);
+			if(info.swap)
+				pixels = swapRedBlueSSE2 (pixels);
+			_mm_storeu_si128 (reinterpret_cast<__m128i*> (destination + size_t(x) * 4), pixels);
+		}
+	}
+	else if(info.bytesPerPixel == 4)
+	{
+		for(; x + 4 <= width; x += 4)
+		{
+			__m128i pixels = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (source + size_t(x) * 4));
+			if(info.rotate)
+				pixels = _mm_or_si128 (_mm_srli_epi32 (pixels, 8), _mm_slli_epi32 (pixels, 24));
+			if(info.swap)
+				pixels = swapRedBlueSSE2 (pixels);
+			if(info.opaque)
+				pixels = _mm_or_si128 (pixels, alpha);
+			_mm_storeu_si128 (reinterpret_cast<__m128i*> (destination + size_t(x) * 4), pixels);
+		}
+	}
+	else if(format == WL_SHM_FORMAT_RGB565 || format == WL_SHM_FORMAT_BGR565)
+	{
+		const __m128i zero = _mm_setzero_si128 ();
+		for(; x + 8 <= width; x += 8)
+		{
+			__m128i pixels = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (source + size_t(x) * 2));
+			_mm_storeu_si128 (reinterpret_cast<__m128i*> (destination + size_t(x) * 4), convert565SSE2 (_mm_unpacklo_epi16 (pixels, zero), info.swap));
+			_mm_storeu_si128 (reinterpret_cast<__m128i*> (destination + size_t(x) * 4 + 16), convert565SSE2 (_mm_unpackhi_epi16 (pixels, zero), info.swap));
+		}
+	}
+	convertRowScalar (destination + size_t(x) * 4, source + size_t(x) * info.bytesPerPixel, width - x, format);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+__attribute__ ((target ("avx2")))
+static inline __m256i swapRedBlueAVX2 (__m256i pixels)
+{
+	const __m256i greenAlpha = _mm256_set1_epi32 (int32_t(0xff00ff00));
+	const __m256i low = _mm256_set1_epi32 (0xff);
+	return _mm256_or_si256 (_mm256_and_si256 (pixels, greenAlpha),
+							_mm256_or_si256 (_mm256_and_si256 (_mm256_srli_epi32 (pixels, 16), low), _mm256_slli_epi32 (_mm256_and_si256 (pixels, low), 16)));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+__attribute__ ((target ("avx2")))
+static inline __m256i convert565AVX2 (__m256i pixels, bool swap)
+{
+	// the shift counts differ per channel, so each one is widened separately
+	__m256i high = _mm256_srli_epi32 (pixels, 11);
+	__m256i green = _mm256_and_si256 (_mm256_srli_epi32 (pixels, 5), _mm256_set1_epi32 (0x3f));
+	__m256i low = _mm256_and_si256 (pixels, _mm256_set1_epi32 (0x1f));
+	high = _mm256_or_si256 (_mm256_slli_epi32 (high, 3), _mm256_srli_epi32 (high, 2));
+	green = _mm256_or_si256 (_mm256_slli_epi32 (green, 2), _mm256_srli_epi32 (green, 4));
+	low = _mm256_or_si256 (_mm256_slli_epi32 (low, 3), _mm256_srli_epi32 (low, 2));
+	__m256i result = _mm256_or_si256 (_mm256_set1_epi32 (int32_t(0xff000000)), _mm256_slli_epi32 (green, 8));
+	return _mm256_or_si256 (result, swap ? _mm256_or_si256 (_mm256_slli_epi32 (low, 16), high) : _mm256_or_si256 (_mm256_slli_epi32 (high, 16), low));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+__attribute__ ((target ("avx2")))
+static inline __m256i convert2101010AVX2 (__m256i pixels, bool opaque)
+{
+	const __m256i mask = _mm256_set1_epi32 (0xff);
+	__m256i red = _mm256_and_si256 (_mm256_srli_epi32 (pixels, 22), mask);
+	__m256i green = _mm256_and_si256 (_mm256_srli_epi32 (pixels, 12), mask);
+	__m256i blue = _mm256_and_si256 (_mm256_srli_epi32 (pixels, 2), mask);
+	__m256i alpha = _mm256_set1_epi32 (int32_t(0xff000000));
+	if(!opaque)
+		alpha = _mm256_slli_epi32 (_mm256_mullo_epi32 (_mm256_srli_epi32 (pixels, 30), _mm256_set1_epi32 (0x55)), 24);
+	return _mm256_or_si256 (_mm256_or_si256 (alpha, _mm256_slli_epi32 (red, 16)), _mm256_or_si256 (_mm256_slli_epi32 (green, 8), blue));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+__attribute__ ((target ("avx2")))
+static void convertRowAVX2 (uint8_t* destination, const uint8_t* source, int32_t width, uint32_t format)
+{
+	ConversionInfo info;
+	if(!getConversionInfo (info, format))
+		return;
+
+	const __m256i alpha = _mm256_set1_epi32 (int32_t(0xff000000));
+	int32_t x = 0;
+	if(is2101010 (format))
+	{
+		for(; x + 8 <= width; x += 8)
+		{
+			__m256i pixels = convert2101010AVX2 (_mm256_loadu_si256 (reinterpret_cast<const __m256i*> (source + size_t(x) * 4)), info.opaque);
+			if(info.swap)
+				pixels = swapRedBlueAVX2 (pixels);
+			_mm256_storeu_si256 (reinterpret_cast<__m256i*> (destination + size_t(x) * 4), pixels);
+		}
+	}
+	else if(info.bytesPerPixel == 4)
+	{
+		for(; x + 8 <= width; x += 8)
+		{
+			__m256i pixels = _mm256_loadu_si256 (reinterpret_cast<const __m256i*> (source + size_t(x) * 4));
+			if(info.rotate)
+				pixels = _mm256_or_si256 (_mm256_srli_epi32 (pixels, 8), _mm256_slli_epi32 (pixels, 24));
+			if(info.swap)
+				pixels = swapRedBlueAVX2 (pixels);
+			if(info.opaque)
+				pixels = _mm256_or_si256 (pixels, alpha);
+			_mm256_storeu_si256 (reinterpret_cast<__m256i*> (destination + size_t(x) * 4), pixels);
+		}
+	}
+	else if(info.bytesPerPixel == 3)
+	{
+		// 4 pixels of each 16 byte load are spread to 32 bits, the load reads 4 bytes beyond them
+		const __m128i spread = info.swap ? _mm_setr_epi8 (2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1)
+										 : _mm_setr_epi8 (0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		const __m256i shuffle = _mm256_broadcastsi128_si256 (spread);
+		for(; x + 10 <= width; x += 8)
+		{
+			const uint8_t* data = source + size_t(x) * 3;
+			__m256i pixels = _mm256_set_m128i (_mm_loadu_si128 (reinterpret_cast<const __m128i*> (data + 12)), _mm_loadu_si128 (reinterpret_cast<const __m128i*> (data)));
+			_mm256_storeu_si256 (reinterpret_cast<__m256i*> (destination + size_t(x) * 4), _mm256_or_si256 (_mm256_shuffle_epi8 (pixels, shuffle), alpha));
+		}
+	}
+	else if(format == WL_SHM_FORMAT_RGB565 || format == WL_SHM_FORMAT_BGR565)
+	{
+		for(; x + 8 <= width; x += 8)
+		{
+			__m256i pixels = _mm256_cvtepu16_epi32 (_mm_loadu_si128 (reinterpret_cast<const __m128i*> (source + size_t(x) * 2)));
+			_mm256_storeu_si256 (reinterpret_cast<__m256i*> (destination + size_t(x) * 4), convert565AVX2 (pixels, info.swap));
+		}
+	}
+	convertRowScalar (destination + size_t(x) * 4, source + size_t(x) * info.bytesPerPixel, width - x, format);
+}
+#endif
+
+#if PIXELKERNELS_NEON
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline uint32x4_t convert565NEON (uint32x4_t pixels, bool swap)
+{
+	uint32x4_t high = vshrq_n_u32 (pixels, 11);
+	uint32x4_t green = vandq_u32 (vshrq_n_u32 (pixels, 5), vdupq_n_u32 (0x3f));
+	uint32x4_t low = vandq_u32 (pixels, vdupq_n_u32 (0x1f));
+	high = vorrq_u32 (vshlq_n_u32 (high, 3), vshrq_n_u32 (high, 2));
+	green = vorrq_u32 (vshlq_n_u32 (green, 2), vshrq_n_u32 (green, 4));
+	low = vorrq_u32 (vshlq_n_u32 (low, 3), vshrq_n_u32 (low, 2));
+	uint32x4_t result = vorrq_u32 (vdupq_n_u32 (0xff000000), vshlq_n_u32 (green, 8));
+	return vorrq_u32 (result, swap ? vorrq_u32 (vshlq_n_u32 (low, 16), high) : vorrq_u32 (vshlq_n_u32 (high, 16), low));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void convertRowNEON (uint8_t* destination, const uint8_t* source, int32_t width, uint32_t format)
+{
+	ConversionInfo info;
+	if(!getConversionInfo (info, format))
+		return;
+
+	int32_t x = 0;
+	if(is2101010 (format))
+	{
+		const uint32x4_t mask = vdupq_n_u32 (0xff);
+		for(; x + 4 <= width; x += 4)
+		{
+			uint32x4_t pixels = vreinterpretq_u32_u8 (vld1q_u8 (source + size_t(x) * 4));
+			uint32x4_t red = vandq_u32 (vshrq_n_u32 (pixels, 22), mask);
+			uint32x4_t blue = vandq_u32 (vshrq_n_u32 (pixels, 2), mask);
+			uint32x4_t green = vandq_u32 (vshrq_n_u32 (pixels, 12), mask);
+			uint32x4_t alpha = info.opaque ? vdupq_n_u32 (0xff000000) : vshlq_n_u32 (vmulq_n_u32 (vshrq_n_u32 (pixels, 30), 0x55), 24);
+			uint32x4_t result = vorrq_u32 (vorrq_u32 (alpha, vshlq_n_u32 (green, 8)), info.swap ? vorrq_u32 (vshlq_n_u32 (blue, 16), red) : vorrq_u32 (vshlq_n_u32 (red, 16), blue));
+			vst1q_u8 (destination + size_t(x) * 4, vreinterpretq_u8_u32 (result));
+		}
+	}
+	else if(info.bytesPerPixel == 4)
+	{
+		// channels are deinterleaved by byte position, so the permutation only reorders the vectors
+		for(; x + 16 <= width; x += 16)
+		{
+			uint8x16x4_t pixels = vld4q_u8 (source + size_t(x) * 4);
+			uint8x16x4_t result = pixels;
+			if(info.rotate)
+			{
+				result.val[0] = pixels.val[1];
+				result.val[1] = pixels.val[2];
+				result.val[2] = pixels.val[3];
+				result.val[3] = pixels.val[0];
+			}
+			if(info.swap)
+			{
+				uint8x16_t first = result.val[0];
+				result.val[0] = result.val[2];
+				result.val[2] = first;
+			}
+			if(info.opaque)
+				result.val[3] = vdupq_n_u8 (0xff);
+			vst4q_u8 (destination + size_t(x) * 4, result);
+		}
+	}
+	else if(info.bytesPerPixel == 3)
+	{
+		for(; x + 16 <= width; x += 16)
+		{
+			uint8x16x3_t pixels = vld3q_u8 (source + size_t(x) * 3);
+			uint8x16x4_t result;
+			result.val[0] = info.swap ? pixels.val[2] : pixels.val[0];
+			result.val[1] = pixels.val[1];
+			result.val[2] = info.swap ? pixels.val[0] : pixels.val[2];
+			result.val[3] = vdupq_n_u8 (0xff);
+			vst4q_u8 (destination + size_t(x) * 4, result);
+		}
+	}
+	else if(format == WL_SHM_FORMAT_RGB565 || format == WL_SHM_FORMAT_BGR565)
+	{
+		for(; x + 8 <= width; x += 8)
+		{
+			uint16x8_t pixels = vld1q_u16 (reinterpret_cast<const uint16_t*> (source + size_t(x) * 2));
+			vst1q_u8 (destination + size_t(x) * 4, vreinterpretq_u8_u32 (convert565NEON (vmovl_u16 (vget_low_u16 (pixels)), info.swap)));
+			vst1q_u8 (destination + size_t(x) * 4 + 16, vreinterpretq_u8_u32 (convert565NEON (vmovl_u16 (vget_high_u16 (pixels)), info.swap)));
+		}
+	}
+	convertRowScalar (destination + size_t(x) * 4, source + size_t(x) * info.bytesPerPixel, width - x, format);
+}
+#endif
+
+//************************************************************************************************
+// Downscaling
+// Source rows covered by a destination row are summed per byte into 32 bit column sums,
+// the sums of the columns covered by a destination pixel are averaged afterwards.
+//************************************************************************************************
+
+static void accumulateRowScalar (uint32_t* sums, const uint8_t* row, int32_t count)
+{
+	for(int32_t i = 0; i < count; i++)
+		sums[i] += row[i];
+}
+
+#if PIXELKERNELS_X86
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void accumulateRowSSE2 (uint32_t* sums, const uint8_t* row, int32_t count)
+{
+	const __m128i zero = _mm_setzero_si128 ();
+	int32_t i = 0;
+	for(; i + 16 <= count; i += 16)
+	{
+		__m128i bytes = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (row + i));
+		__m128i low = _mm_unpacklo_epi8 (bytes, zero);
+		__m128i high = _mm_unpackhi_epi8 (bytes, zero);
+		__m128i* target = reinterpret_cast<__m128i*> (sums + i);
+		_mm_storeu_si128 (target, _mm_add_epi32 (_mm_loadu_si128 (target), _mm_unpacklo_epi16 (low, zero)));
+		_mm_storeu_si128 (target + 1, _mm_add_epi32 (_mm_loadu_si128 (target + 1), _mm_unpackhi_epi16 (low, zero)));
+		_mm_storeu_si128 (target + 2, _mm_add_epi32 (_mm_loadu_si128 (target + 2), _mm_unpacklo_epi16 (high, zero)));
+		_mm_storeu_si128 (target + 3, _mm_add_epi32 (_mm_loadu_si128 (target + 3), _mm_unpackhi_epi16 (high, zero)));
+	}
+	accumulateRowScalar (sums + i, row + i, count - i);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+__attribute__ ((target ("avx2")))
+static void accumulateRowAVX2 (uint32_t* sums, const uint8_t* row, int32_t count)
+{
+	int32_t i = 0;
+	for(; i + 16 <= count; i += 16)
+	{
+		__m128i bytes = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (row + i));
+		__m256i* target = reinterpret_cast<__m256i*> (sums + i);
+		_mm256_storeu_si256 (target, _mm256_add_epi32 (_mm256_loadu_si256 (target), _mm256_cvtepu8_epi32 (bytes)));
+		_mm256_storeu_si256 (target + 1, _mm256_add_epi32 (_mm256_loadu_si256 (target + 1), _mm256_cvtepu8_epi32 (_mm_srli_si128 (bytes, 8))));
+	}
+	accumulateRowScalar (sums + i, row + i, count - i);
+}
+#endif
+
+#if PIXELKERNELS_NEON
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void accumulateRowNEON (uint32_t* sums, const uint8_t* row, int32_t count)
+{
+	int32_t i = 0;
+	for(; i + 16 <= count; i += 16)
+	{
+		uint8x16_t bytes = vld1q_u8 (row + i);
+		uint16x8_t low = vmovl_u8 (vget_low_u8 (bytes));
+		uint16x8_t high = vmovl_u8 (vget_high_u8 (bytes));
+		vst1q_u32 (sums + i, vaddw_u16 (vld1q_u32 (sums + i), vget_low_u16 (low)));
+		vst1q_u32 (sums + i + 4, vaddw_u16 (vld1q_u32 (sums + i + 4), vget_high_u16 (low)));
+		vst1q_u32 (sums + i + 8, vaddw_u16 (vld1q_u32 (sums + i + 8), vget_low_u16 (high)));
+		vst1q_u32 (sums + i + 12, vaddw_u16 (vld1q_u32 (sums + i + 12), vget_high_u16 (high)));
+	}
+	accumulateRowScalar (sums + i, row + i, count - i);
+}
+#endif
+
+//************************************************************************************************
+// PixelKernels
+//************************************************************************************************
+
+enum SimdLevel
+{
+	kScalar,
+	kSSE2,
+	kAVX2,
+	kNEON
+};
+
+static SimdLevel detectSimdLevel ()
+{
+	#if PIXELKERNELS_X86
+	if(__builtin_cpu_supports ("avx2"))
+		return kAVX2;
+	return kSSE2;
+	#elif PIXELKERNELS_NEON
+	return kNEON;
+	#else
+	return kScalar;
+	#endif
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static SimdLevel getSimdLevel ()
+{
+	static const SimdLevel level = detectSimdLevel ();
+	return level;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef uint64_t (*HashFunction) (const uint8_t* data, int32_t stride, int32_t rowBytes, int32_t rows);
+typedef bool (*CompareFunction) (const uint8_t* a, const uint8_t* b, int32_t count);
+typedef bool (*AlphaFunction) (const uint8_t* row, int32_t width);
+typedef bool (*UniformFunction) (const uint8_t* row, int32_t width, uint32_t pixel);
+typedef void (*RowFunction) (uint8_t* destination, const uint8_t* source, int32_t width);
+typedef void (*ConvertFunction) (uint8_t* destination, const uint8_t* source, int32_t width, uint32_t format);
+typedef void (*AccumulateFunction) (uint32_t* sums, const uint8_t* row, int32_t count);
+
+static HashFunction selectHashFunction ()
+{
+	#if PIXELKERNELS_X86
+	if(getSimdLevel () == kAVX2)
+		return hashPixelsAVX2;
+	if(getSimdLevel () == kSSE2)
+		return hashPixelsSSE2;
+	#elif PIXELKERNELS_NEON
+	return hashPixelsNEON;
+	#endif
+	return hashPixelsScalar;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static CompareFunction selectCompareFunction ()
+{
+	#if PIXELKERNELS_X86
+	if(getSimdLevel () == kAVX2)
+		return rowsEqualAVX2;
+	if(getSimdLevel () == kSSE2)
+		return rowsEqualSSE2;
+	#elif PIXELKERNELS_NEON
+	return rowsEqualNEON;
+	#endif
+	return rowsEqualScalar;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static AlphaFunction selectAlphaFunction ()
+{
+	#if PIXELKERNELS_X86
+	if(getSimdLevel () == kAVX2)
+		return rowIsOpaqueAVX2;
+	if(getSimdLevel () == kSSE2)
+		return rowIsOpaqueSSE2;
+	#elif PIXELKERNELS_NEON
+	return rowIsOpaqueNEON;
+	#endif
+	return rowIsOpaqueScalar;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static UniformFunction selectUniformFunction ()
+{
+	#if PIXELKERNELS_X86
+	if(getSimdLevel () == kAVX2)
+		return rowIsUniformAVX2;
+	if(getSimdLevel () == kSSE2)
+		return rowIsUniformSSE2;
+	#elif PIXELKERNELS_NEON
+	return rowIsUniformNEON;
+	#endif
+	return rowIsUniformScalar;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static RowFunction selectCopyOpaqueFunction ()
+{
+	#if PIXELKERNELS_X86
+	if(getSimdLevel () == kAVX2)
+		return copyOpaqueRowAVX2;
+	if(getSimdLevel () == kSSE2)
+		return copyOpaqueRowSSE2;
+	#elif PIXELKERNELS_NEON
+	return copyOpaqueRowNEON;
+	#endif
+	return copyOpaqueRowScalar;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static RowFunction selectBlendFunction ()
+{
+	#if PIXELKERNELS_X86
+	if(getSimdLevel () == kAVX2)
+		return blendRowAVX2;
+	if(getSimdLevel () == kSSE2)
+		return blendRowSSE2;
+	#elif PIXELKERNELS_NEON
+	return blendRowNEON;
+	#endif
+	return blendRowScalar;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static ConvertFunction selectConvertFunction ()
+{
+	#if PIXELKERNELS_X86
+	if(getSimdLevel () == kAVX2)
+		return convertRowAVX2;
+	if(getSimdLevel () == kSSE2)
+		return convertRowSSE2;
+	#elif PIXELKERNELS_NEON
+	return convertRowNEON;
+	#endif
+	return convertRowScalar;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static AccumulateFunction selectAccumulateFunction ()
+{
+	#if PIXELKERNELS_X86
+	if(getSimdLevel () == kAVX2)
+		return accumulateRowAVX2;
+	if(getSimdLevel () == kSSE2)
+		return accumulateRowSSE2;
+	#elif PIXELKERNELS_NEON
+	return accumulateRowNEON;
+	#endif
+	return accumulateRowScalar;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+uint64_t PixelKernels::hashPixels (const uint8_t* data, int32_t stride, int32_t rowBytes, int32_t rows)
+{
+	static const HashFunction function = selectHashFunction ();
+	return function (data, stride, rowBytes, rows);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool PixelKernels::findChangedRows (const uint8_t* data, int32_t stride, const uint8_t* previous, int32_t previousStride,
+									int32_t rowBytes, int32_t rows, int32_t& firstRow, int32_t& lastRow)
+{
+	static const CompareFunction rowsEqual = selectCompareFunction ();
+
+	int32_t first = 0;
+	while(first < rows && rowsEqual (data + size_t(first) * stride, previous + size_t(first) * previousStride, rowBytes))
+		first++;
+	if(first == rows)
+		return false;
+
+	int32_t last = rows - 1;
+	while(last > first && rowsEqual (data + size_t(last) * stride, previous + size_t(last) * previousStride, rowBytes))
+		last--;
+
+	firstRow = first;
+	lastRow = last;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool PixelKernels::isOpaque (const uint8_t* data, int32_t stride, int32_t width, int32_t rows)
+{
+	static const AlphaFunction rowIsOpaque = selectAlphaFunction ();
+
+	for(int32_t y = 0; y < rows; y++)
+		if(!rowIsOpaque (data + size_t(y) * stride, width))
+			return false;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool PixelKernels::isUniform (const uint8_t* data, int32_t stride, int32_t width, int32_t rows, uint32_t pixel)
+{
+	static const UniformFunction rowIsUniform = selectUniformFunction ();
+
+	for(int32_t y = 0; y < rows; y++)
+		if(!rowIsUniform (data + size_t(y) * stride, width, pixel))
+			return false;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PixelKernels::copyPixels (uint8_t* destination, int32_t destinationStride, const uint8_t* source, int32_t sourceStride,
+							   int32_t width, int32_t rows, bool opaque)
+{
+	static const RowFunction copyOpaqueRow = selectCopyOpaqueFunction ();
+
+	for(int32_t y = 0; y < rows; y++)
+	{
+		uint8_t* destinationRow = destination + size_t(y) * destinationStride;
+		const uint8_t* sourceRow = source + size_t(y) * sourceStride;
+		if(opaque)
+			copyOpaqueRow (destinationRow, sourceRow, width);
+		else
+			::memcpy (destinationRow, sourceRow, size_t(width) * 4);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PixelKernels::blendPixels (uint8_t* destination, int32_t destinationStride, const uint8_t* source, int32_t sourceStride,
+								int32_t width, int32_t rows)
+{
+	static const RowFunction blendRow = selectBlendFunction ();
+
+	for(int32_t y = 0; y < rows; y++)
+		blendRow (destination + size_t(y) * destinationStride, source + size_t(y) * sourceStride, width);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+int PixelKernels::getBytesPerPixel (uint32_t format)
+{
+	ConversionInfo info;
+	return getConversionInfo (info, format) ? info.bytesPerPixel : 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool PixelKernels::hasAlpha (uint32_t format)
+{
+	ConversionInfo info;
+	return getConversionInfo (info, format) && !info.opaque;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PixelKernels::convertPixels (uint8_t* destination, int32_t destinationStride, const uint8_t* source, int32_t sourceStride,
+								  int32_t width, int32_t rows, uint32_t format)
+{
+	static const ConvertFunction convertRow = selectConvertFunction ();
+
+	for(int32_t y = 0; y < rows; y++)
+		convertRow (destination + size_t(y) * destinationStride, source + size_t(y) * sourceStride, width, format);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PixelKernels::downscalePixels (uint8_t* destination, int32_t destinationStride, int32_t destinationWidth, int32_t destinationHeight,
+								   const uint8_t* source, int32_t sourceStride, int32_t sourceWidth, int32_t sourceHeight, bool opaque)
+{
+	static const AccumulateFunction accumulateRow = selectAccumulateFunction ();
+
+	if(destinationWidth <= 0 || destinationHeight <= 0 || destinationWidth > sourceWidth || destinationHeight > sourceHeight)
+		return;
+
+	std::vector<uint32_t> sums (size_t(sourceWidth) * 4);
+	for(int32_t y = 0; y < destinationHeight; y++)
+	{
+		int32_t firstRow = int32_t(int64_t(y) * sourceHeight / destinationHeight);
+		int32_t lastRow = int32_t(int64_t(y + 1) * sourceHeight / destinationHeight);
+		std::fill (sums.begin (), sums.end (), 0);
+		for(int32_t row = firstRow; row < lastRow; row++)
+			accumulateRow (sums.data (), source + size_t(row) * sourceStride, sourceWidth * 4);
+
+		uint8_t* pixel = destination + size_t(y) * destinationStride;
+		for(int32_t x = 0; x < destinationWidth; x++, pixel += 4)
+		{
+			int32_t firstColumn = int32_t(int64_t(x) * sourceWidth / destinationWidth);
+			int32_t lastColumn = int32_t(int64_t(x + 1) * sourceWidth / destinationWidth);
+			uint64_t count = uint64_t(lastColumn - firstColumn) * (lastRow - firstRow);
+			for(int channel = 0; channel < 4; channel++)
+			{
+				uint64_t total = 0;
+				for(int32_t column = firstColumn; column < lastColumn; column++)
+					total += sums[size_t(column) * 4 + channel];
+				pixel[channel] = uint8_t((total + count / 2) / count);
+			}
+			if(opaque)
+				pixel[3] = 0xff;
+		}
+	}
+}
@@ -0,0 +1,97 @@
+//************************************************************************************************
+//
+// Wayland Server Delegate
+//
+// Copyright (c) 2023 CCL Software Licensing GmbH. All Rights Reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// - Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// - Neither the name of the wayland-server-delegate project nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS",
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Filename    : pixelkernels.h
+// Description : Vectorized Pixel Kernels
+//
+//************************************************************************************************
+
+#ifndef _pixelkernels_h
+#define _pixelkernels_h
+
+#include <stdint.h>
+
+namespace WaylandServerDelegate {
+
+//************************************************************************************************
+// PixelKernels
+//************************************************************************************************
+
+/** Pixel analysis, conversion and compositing routines for shared memory buffers.
+ * The CPU is checked once, each routine binds the best implementation (AVX2, SSE2, NEON or plain C++) on its first call.
+ */
+class PixelKernels
+{
+public:
+	/** 64 bit hash of \a rows rows of \a rowBytes bytes each. */
+	static uint64_t hashPixels (const uint8_t* data, int32_t stride, int32_t rowBytes, int32_t rows);
+
+	/** Compare \a rows rows of \a rowBytes bytes each.
+	 * Returns false if both areas are equal, otherwise the first and last differing rows are returned.
+	 */
+	static bool findChangedRows (const uint8_t* data, int32_t stride, const uint8_t* previous, int32_t previousStride,
+								 int32_t rowBytes, int32_t rows, int32_t& firstRow, int32_t& lastRow);
+
+	/** Check if all \a width x \a rows pixels of an ARGB8888 area have an alpha value of 0xff. */
+	static bool isOpaque (const uint8_t* data, int32_t stride, int32_t width, int32_t rows);
+
+	/** Check if all \a width x \a rows 32 bit pixels are equal to \a pixel. */
+	static bool isUniform (const uint8_t* data, int32_t stride, int32_t width, int32_t rows, uint32_t pixel);
+
+	/** Copy \a width x \a rows 32 bit pixels. With \a opaque, the alpha byte is set to 0xff, e.g. to convert XRGB8888 to ARGB8888. */
+	static void copyPixels (uint8_t* destination, int32_t destinationStride, const uint8_t* source, int32_t sourceStride,
+							int32_t width, int32_t rows, bool opaque);
+
+	/** Blend \a width x \a rows premultiplied ARGB8888 pixels over \a destination (Porter-Duff OVER). */
+	static void blendPixels (uint8_t* destination, int32_t destinationStride, const uint8_t* source, int32_t sourceStride,
+							 int32_t width, int32_t rows);
+
+	/** Size of a pixel of a wl_shm \a format, 0 if \a format can't be converted by convertPixels. */
+	static int getBytesPerPixel (uint32_t format);
+
+	/** Check if a wl_shm \a format has an alpha channel. */
+	static bool hasAlpha (uint32_t format);
+
+	/** Convert \a width x \a rows pixels of a wl_shm \a format to ARGB8888.
+	 * Formats without alpha channel become opaque, premultiplied alpha is preserved.
+	 */
+	static void convertPixels (uint8_t* destination, int32_t destinationStride, const uint8_t* source, int32_t sourceStride,
+							   int32_t width, int32_t rows, uint32_t format);
+
+	/** Downscale ARGB8888 pixels to \a destinationWidth x \a destinationHeight by averaging the source pixels covered by each destination pixel.
+	 * The destination must not be larger than the source. With \a opaque, the alpha byte is set to 0xff.
+	 */
+	static void downscalePixels (uint8_t* destination, int32_t destinationStride, int32_t destinationWidth, int32_t destinationHeight,
+								 const uint8_t* source, int32_t sourceStride, int32_t sourceWidth, int32_t sourceHeight, bool opaque);
+};
+
+} // namespace WaylandServerDelegate
+
+#endif // _pixelkernels_h
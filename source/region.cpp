@@ -0,0 +1,330 @@
+//************************************************************************************************
+//
+// Wayland Server Delegate
+//
+// Copyright (c) 2023 CCL Software Licensing GmbH. All Rights Reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// - Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// - Neither the name of the wayland-server-delegate project nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS",
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Filename    : region.cpp
+// Description : Rectangle Region
+//
+//************************************************************************************************
+
+#include "region.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace WaylandServerDelegate;
+
+//************************************************************************************************
+// Rect
+//************************************************************************************************
+
+Rect::Rect (int32_t x, int32_t y, int32_t width, int32_t height)
+: left (x),
+  top (y)
+{
+	// clients may pass INT32_MAX sized rectangles to damage everything
+	const int64_t kMax = std::numeric_limits<int32_t>::max ();
+	right = int32_t(std::min<int64_t> (int64_t(x) + std::max<int32_t> (width, 0), kMax));
+	bottom = int32_t(std::min<int64_t> (int64_t(y) + std::max<int32_t> (height, 0), kMax));
+}
+
+//************************************************************************************************
+// Region
+//************************************************************************************************
+
+Region::Region (const Rect& rect)
+{
+	unite (rect);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Region::clear ()
+{
+	rects.clear ();
+	extents = Rect ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Region::unite (const Rect& rect)
+{
+	if(rect.isEmpty ())
+		return;
+
+	if(isEmpty () || rect.contains (extents))
+	{
+		rects.assign (1, rect);
+		extents = rect;
+		return;
+	}
+
+	if(rects.size () == 1 && extents.contains (rect))
+		return;
+
+	combine (Region (rect), kUnite);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Region::unite (const Region& other)
+{
+	if(other.isEmpty ())
+		return;
+
+	if(other.rects.size () == 1)
+		unite (other.extents);
+	else if(isEmpty ())
+		*this = other;
+	else
+		combine (other, kUnite);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Region::subtract (const Rect& rect)
+{
+	if(rect.isEmpty () || isEmpty ())
+		return;
+
+	if(rect.contains (extents))
+	{
+		clear ();
+		return;
+	}
+
+	combine (Region (rect), kSubtract);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Region::subtract (const Region& other)
+{
+	if(other.isEmpty () || isEmpty ())
+		return;
+
+	combine (other, kSubtract);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Region::intersect (const Rect& rect)
+{
+	if(isEmpty ())
+		return;
+
+	if(rect.isEmpty ())
+	{
+		clear ();
+		return;
+	}
+
+	if(rect.contains (extents))
+		return;
+
+	combine (Region (rect), kIntersect);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Region::intersect (const Region& other)
+{
+	if(isEmpty ())
+		return;
+
+	if(other.isEmpty ())
+	{
+		clear ();
+		return;
+	}
+
+	combine (other, kIntersect);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Region::combine (const Region& other, Operation operation)
+{
+	if(extents.right <= other.extents.left || extents.left >= other.extents.right 
+		|| extents.bottom <= other.extents.top || extents.top >= other.extents.bottom)
+	{
+		// no overlap, only an intersection changes this region
+		if(operation == kIntersect)
+			clear ();
+		if(operation != kUnite)
+			return;
+	}
+
+	// collect all band edges of both regions
+	std::vector<int32_t> edges;
+	edges.reserve (2 * (rects.size () + other.rects.size ()));
+	for(const Rect& rect : rects)
+	{
+		edges.push_back (rect.top);
+		edges.push_back (rect.bottom);
+	}
+	for(const Rect& rect : other.rects)
+	{
+		edges.push_back (rect.top);
+		edges.push_back (rect.bottom);
+	}
+	std::sort (edges.begin (), edges.end ());
+	edges.erase (std::unique (edges.begin (), edges.end ()), edges.end ());
+
+	std::vector<Rect> result;
+	std::vector<int32_t> spanEdges;
+	std::vector<Rect> band;
+	size_t previousBand = 0;
+	size_t a = 0;
+	size_t b = 0;
+
+	for(size_t i = 0; i + 1 < edges.size (); i++)
+	{
+		int32_t top = edges[i];
+		int32_t bottom = edges[i + 1];
+
+		// find the bands of both regions covering [top, bottom)
+		while(a < rects.size () && rects[a].bottom <= top)
+			a++;
+		while(b < other.rects.size () && other.rects[b].bottom <= top)
+			b++;
+
+		size_t aEnd = a;
+		if(a < rects.size () && rects[a].top <= top)
+			while(aEnd < rects.size () && rects[aEnd].top == rects[a].top)
+				aEnd++;
+
+		size_t bEnd = b;
+		if(b < other.rects.size () && other.rects[b].top <= top)
+			while(bEnd < other.rects.size () && other.rects[bEnd].top == other.rects[b].top)
+				bEnd++;
+
+		if(a == aEnd && (operation != kUnite || b == bEnd))
+			continue;
+		if(b == bEnd && operation == kIntersect)
+			continue;
+
+		// combine the horizontal spans
+		spanEdges.clear ();
+		for(size_t k = a; k < aEnd; k++)
+		{
+			spanEdges.push_back (rects[k].left);
+			spanEdges.push_back (rects[k].right);
+		}
+		for(size_t k = b; k < bEnd; k++)
+		{
+			spanEdges.push_back (other.rects[k].left);
+			spanEdges.push_back (other.rects[k].right);
+		}
+		std::sort (spanEdges.begin (), spanEdges.end ());
+		spanEdges.erase (std::unique (spanEdges.begin (), spanEdges.end ()), spanEdges.end ());
+
+		band.clear ();
+		size_t spanA = a;
+		size_t spanB = b;
+		for(size_t k = 0; k + 1 < spanEdges.size (); k++)
+		{
+			int32_t left = spanEdges[k];
+			int32_t right = spanEdges[k + 1];
+
+			while(spanA < aEnd && rects[spanA].right <= left)
+				spanA++;
+			while(spanB < bEnd && other.rects[spanB].right <= left)
+				spanB++;
+
+			bool inA = spanA < aEnd && rects[spanA].left <= left;
+			bool inB = spanB < bEnd && other.rects[spanB].left <= left;
+
+			bool inside = false;
+			switch(operation)
+			{
+			case kUnite : inside = inA || inB; break;
+			case kSubtract : inside = inA && !inB; break;
+			case kIntersect : inside = inA && inB; break;
+			}
+			if(!inside)
+				continue;
+
+			if(!band.empty () && band.back ().right == left)
+				band.back ().right = right;
+			else
+			{
+				Rect rect;
+				rect.left = left;
+				rect.top = top;
+				rect.right = right;
+				rect.bottom = bottom;
+				band.push_back (rect);
+			}
+		}
+
+		if(band.empty ())
+			continue;
+
+		// coalesce with the previous band if the spans are equal
+		bool coalesce = previousBand < result.size () && result[previousBand].bottom == top && result.size () - previousBand == band.size ();
+		for(size_t k = 0; coalesce && k < band.size (); k++)
+			coalesce = result[previousBand + k].left == band[k].left && result[previousBand + k].right == band[k].right;
+
+		if(coalesce)
+		{
+			for(size_t k = previousBand; k < result.size (); k++)
+				result[k].bottom = bottom;
+		}
+		else
+		{
+			previousBand = result.size ();
+			result.insert (result.end (), band.begin (), band.end ());
+		}
+	}
+
+	rects.swap (result);
+	updateExtents ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Region::updateExtents ()
+{
+	if(rects.empty ())
+	{
+		extents = Rect ();
+		return;
+	}
+
+	extents.top = rects.front ().top;
+	extents.bottom = rects.back ().bottom;
+	extents.left = rects.front ().left;
+	extents.right = rects.front ().right;
+	for(const Rect& rect : rects)
+	{
+		extents.left = std::min (extents.left, rect.left);
+		extents.right = std::max (extents.right, rect.right);
+	}
+}
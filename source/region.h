@@ -0,0 +1,113 @@
+//************************************************************************************************
+//
+// Wayland Server Delegate
+//
+// Copyright (c) 2023 CCL Software Licensing GmbH. All Rights Reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// - Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// - Neither the name of the wayland-server-delegate project nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS",
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Filename    : region.h
+// Description : Rectangle Region
+//
+//************************************************************************************************
+
+#ifndef _region_h
+#define _region_h
+
+#include <stdint.h>
+#include <vector>
+
+namespace WaylandServerDelegate {
+
+//************************************************************************************************
+// Rect
+//************************************************************************************************
+
+struct Rect
+{
+	int32_t left = 0;
+	int32_t top = 0;
+	int32_t right = 0;
+	int32_t bottom = 0;
+
+	Rect () {}
+	Rect (int32_t x, int32_t y, int32_t width, int32_t height);
+
+	int32_t getWidth () const { return right - left; }
+	int32_t getHeight () const { return bottom - top; }
+	bool isEmpty () const { return right <= left || bottom <= top; }
+	bool contains (const Rect& other) const { return left <= other.left && top <= other.top && right >= other.right && bottom >= other.bottom; }
+
+	bool operator == (const Rect& other) const { return left == other.left && top == other.top && right == other.right && bottom == other.bottom; }
+	bool operator != (const Rect& other) const { return !(*this == other); }
+};
+
+//************************************************************************************************
+// Region
+//************************************************************************************************
+
+/** Set of non-overlapping rectangles, stored as horizontal bands sorted by y, then by x.
+ * Rectangles within a band share top and bottom, vertically adjacent bands with equal spans are coalesced.
+ */
+class Region
+{
+public:
+	Region () {}
+	Region (const Rect& rect);
+
+	bool isEmpty () const { return rects.empty (); }
+	int countRects () const { return int(rects.size ()); }
+	const std::vector<Rect>& getRects () const { return rects; }
+	const Rect& getExtents () const { return extents; }
+
+	void clear ();
+	void unite (const Rect& rect);
+	void unite (const Region& other);
+	void subtract (const Rect& rect);
+	void subtract (const Region& other);
+	void intersect (const Rect& rect);
+	void intersect (const Region& other);
+
+	bool operator == (const Region& other) const { return rects == other.rects; }
+	bool operator != (const Region& other) const { return !(*this == other); }
+
+private:
+	enum Operation
+	{
+		kUnite,
+		kSubtract,
+		kIntersect
+	};
+
+	std::vector<Rect> rects;
+	Rect extents;
+
+	void combine (const Region& other, Operation operation);
+	void updateExtents ();
+};
+
+} // namespace WaylandServerDelegate
+
+#endif // _region_h
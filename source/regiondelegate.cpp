@@ -40,29 +40,53 @@
 
 #include <wayland-client.h>
 
+#include <algorithm>
+#include <limits>
+
 using namespace WaylandServerDelegate;
 
 //************************************************************************************************
 // RegionDelegate
 //************************************************************************************************
 
-RegionDelegate::RegionDelegate (wl_region* region)
-: WaylandResource (&::wl_region_interface, static_cast<wl_region_interface*> (this)),
-  region (region)
+RegionDelegate::RegionDelegate ()
+: WaylandResource (&::wl_region_interface, static_cast<wl_region_interface*> (this))
 {
 	destroy = onDestroy;
 	add = onAdd;
 	subtract = onSubtract;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+wl_region* RegionDelegate::createUpstreamRegion (const Region& region)
+{
+	// a fresh region is cheaper than clearing a reused one, a single request can't cover the whole int32 range
+	IWaylandClientContext* context = WaylandServer::instance ().getContext ();
+	wl_compositor* compositor = context ? context->getCompositor () : nullptr;
+	if(compositor == nullptr)
+		return nullptr;
+
+	wl_region* upstreamRegion = wl_compositor_create_region (compositor);
+	if(upstreamRegion == nullptr)
+		return nullptr;
+
+	// rectangles wider or higher than INT32_MAX, e.g. from -1 to INT32_MAX, are split
+	const int64_t kMaxSize = std::numeric_limits<int32_t>::max ();
+	for(const Rect& rect : region.getRects ())
+		for(int64_t y = rect.top; y < rect.bottom; y += kMaxSize)
+			for(int64_t x = rect.left; x < rect.right; x += kMaxSize)
+				wl_region_add (upstreamRegion, int32_t(x), int32_t(y), int32_t(std::min (rect.right - x, kMaxSize)), int32_t(std::min (rect.bottom - y, kMaxSize)));
 
-	setProxy (reinterpret_cast<wl_proxy*> (region));
+	return upstreamRegion;
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
-RegionDelegate::~RegionDelegate ()
+void RegionDelegate::destroyUpstreamRegion (wl_region* upstreamRegion)
 {
-	if(region)
-		wl_region_destroy (region);
+	if(upstreamRegion)
+		wl_region_destroy (upstreamRegion);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -77,8 +101,7 @@ void RegionDelegate::onDestroy (wl_client* client, wl_resource* resource)
 void RegionDelegate::onAdd (wl_client* client, wl_resource* resource, int32_t x, int32_t y, int32_t width, int32_t height)
 {
 	RegionDelegate* This = cast<RegionDelegate> (resource);
-	if(This->region)
-		wl_region_add (This->region, x, y, width, height);
+	This->region.unite (Rect (x, y, width, height));
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -86,6 +109,5 @@ void RegionDelegate::onAdd (wl_client* client, wl_resource* resource, int32_t x,
 void RegionDelegate::onSubtract (wl_client* client, wl_resource* resource, int32_t x, int32_t y, int32_t width, int32_t height)
 {
 	RegionDelegate* This = cast<RegionDelegate> (resource);
-	if(This->region)
-		wl_region_subtract (This->region, x, y, width, height);
+	This->region.subtract (Rect (x, y, width, height));
 }
@@ -36,6 +36,8 @@
 #ifndef _regiondelegate_h
 #define _regiondelegate_h
 
+#include "region.h"
+
 #include "wayland-server-delegate/waylandresource.h"
 
 namespace WaylandServerDelegate {
@@ -48,8 +50,13 @@ class RegionDelegate: public WaylandResource,
 					  public wl_region_interface
 {
 public:
-	RegionDelegate (wl_region* region);
-	~RegionDelegate ();
+	RegionDelegate ();
+
+	const Region& getRegion () const { return region; }
+
+	/** Create an upstream region with the given contents, destroy it with destroyUpstreamRegion once it has been set. */
+	static wl_region* createUpstreamRegion (const Region& region);
+	static void destroyUpstreamRegion (wl_region* upstreamRegion);
 
 	// interface
 	static void onDestroy (wl_client* client, wl_resource* resource);
@@ -57,7 +64,7 @@ public:
 	static void onSubtract (wl_client* client, wl_resource* resource, int32_t x, int32_t y, int32_t width, int32_t height);
 
 private:
-	wl_region* region;
+	Region region;
 };
 
 } // namespace WaylandServerDelegate
@@ -45,6 +45,7 @@
 #include "wayland-server-delegate/iwaylandclientcontext.h"
 
 #include <algorithm>
+#include <cstring>
 #include <unistd.h>
 
 using namespace WaylandServerDelegate;
@@ -100,12 +101,16 @@ void RegistryDelegate::shutdown ()
 	}
 	globals.clear ();
 	outputs.clear ();
+	seatResources.clear ();
+	outputResources.clear ();
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
 void RegistryDelegate::contextChanged (ChangeType type)
 {
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
+
 	switch(type)
 	{
 	case kSeatCapabilitiesChanged :
@@ -122,77 +127,122 @@ void RegistryDelegate::contextChanged (ChangeType type)
 
 void RegistryDelegate::updateSeatCapabilities ()
 {
-	WaylandServer& server = WaylandServer::instance ();
-	IWaylandClientContext* context = server.getContext ();
-
-	for(auto& connection : server.getConnections ())
-	{
-		WaylandResource* resource = server.findClientResource (connection.clientHandle, reinterpret_cast<wl_proxy*> (context->getSeat ()));
-		if(resource == nullptr)
-			continue;
-
-		static_cast<SeatDelegate*> (resource)->sendCapabilities ();
-	}
+	for(SeatDelegate* seat : seatResources)
+		seat->sendCapabilities ();
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
 void RegistryDelegate::updateOutputs ()
 {
-	WaylandServer& server = WaylandServer::instance ();
-	IWaylandClientContext* context = server.getContext ();
+	IWaylandClientContext* context = WaylandServer::instance ().getContext ();
 
-	std::vector<uint32_t> newOutputs;
-	std::vector<int> addedOutputs;
+	std::unordered_map<uint32_t, WaylandOutput> newOutputs;
 	for(int i = 0; i < context->countOutputs (); i++)
 	{
-		wl_proxy* proxy = reinterpret_cast<wl_proxy*> (context->getOutput (i).handle);
-		uint32_t id = wl_proxy_get_id (proxy);
-		newOutputs.push_back (id);
-		if(std::find (outputs.begin (), outputs.end (), id) == outputs.end ())
-			addedOutputs.push_back (i);
+		const WaylandOutput& output = context->getOutput (i);
+		if(output.handle == nullptr)
+			continue;
+		newOutputs.insert ({ wl_proxy_get_id (reinterpret_cast<wl_proxy*> (output.handle)), output });
 	}
-	std::sort (newOutputs.begin (), newOutputs.end ());
 
-	std::vector<uint32_t> removedOutputs;
-	std::set_difference (outputs.begin (), outputs.end (), newOutputs.begin (), newOutputs.end (), std::inserter (removedOutputs, removedOutputs.begin ()));
-	
-	for(uint32_t removedOutput : removedOutputs)
+	for(const auto& output : outputs)
 	{
-		auto global = globals.find (removedOutput);
-		if(global == globals.end ())
+		if(newOutputs.find (output.first) != newOutputs.end ())
 			continue;
 
-		unregisterGlobal (global->second);
+		auto global = globals.find (output.first);
+		if(global != globals.end ())
+			unregisterGlobal (global->second);
+
+		// the id may be reused by a new output, resources still bound to the removed one stay inert
+		auto resources = outputResources.find (output.first);
+		if(resources != outputResources.end ())
+		{
+			for(OutputDelegate* resource : resources->second)
+				resource->detach ();
+			outputResources.erase (resources);
+		}
 	}
 
-	for(int addedOutputIndex : addedOutputs)
+	std::vector<std::pair<uint32_t, int>> changedOutputs;
+	for(const auto& output : newOutputs)
 	{
-		wl_proxy* proxy = reinterpret_cast<wl_proxy*> (context->getOutput (addedOutputIndex).handle);
-		uint32_t id = wl_proxy_get_id (proxy);
-		registerGlobal (id, &wl_output_interface, OutputDelegate::kMaxVersion, reinterpret_cast<void*> (int64_t(addedOutputIndex)), bind<OutputDelegate>);
+		auto previous = outputs.find (output.first);
+		if(previous == outputs.end ())
+		{
+			registerGlobal (output.first, &wl_output_interface, OutputDelegate::kMaxVersion, reinterpret_cast<void*> (uintptr_t(output.first)), bindOutput);
+			continue;
+		}
+
+		int changes = OutputDelegate::getChanges (previous->second, output.second);
+		if(changes != 0)
+			changedOutputs.push_back ({ output.first, changes });
 	}
 
-	outputs = newOutputs;
+	outputs.swap (newOutputs);
 
-	for(int i = 0; i < context->countOutputs (); i++)
+	for(const auto& changedOutput : changedOutputs)
 	{
-		if(std::find (addedOutputs.begin (), addedOutputs.end (), i) != addedOutputs.end ())
+		auto resources = outputResources.find (changedOutput.first);
+		if(resources == outputResources.end ())
 			continue;
 
-		for(auto& connection : server.getConnections ())
-		{
-			WaylandResource* resource = server.findClientResource (connection.clientHandle, reinterpret_cast<wl_proxy*> (context->getOutput (i).handle));
-			if(resource == nullptr)
-				continue;
-
-			static_cast<OutputDelegate*> (resource)->sendProperties ();
-		}
+		for(OutputDelegate* output : resources->second)
+			output->sendProperties (changedOutput.second);
 	}
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
+const WaylandOutput* RegistryDelegate::findOutput (uint32_t outputId) const
+{
+	auto output = outputs.find (outputId);
+	if(output == outputs.end ())
+		return nullptr;
+	return &output->second;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void RegistryDelegate::addSeatResource (SeatDelegate* seat)
+{
+	seatResources.push_back (seat);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void RegistryDelegate::removeSeatResource (SeatDelegate* seat)
+{
+	auto it = std::find (seatResources.begin (), seatResources.end (), seat);
+	if(it != seatResources.end ())
+		seatResources.erase (it);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void RegistryDelegate::addOutputResource (uint32_t outputId, OutputDelegate* output)
+{
+	outputResources[outputId].push_back (output);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void RegistryDelegate::removeOutputResource (uint32_t outputId, OutputDelegate* output)
+{
+	auto resources = outputResources.find (outputId);
+	if(resources == outputResources.end ())
+		return;
+
+	auto it = std::find (resources->second.begin (), resources->second.end (), output);
+	if(it != resources->second.end ())
+		resources->second.erase (it);
+	if(resources->second.empty ())
+		outputResources.erase (resources);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
 wl_global* RegistryDelegate::registerGlobal (wl_proxy* proxy, const wl_interface* interface, int maxVersion, void* data, wl_global_bind_func_t bindFunction)
 {
 	if(proxy == nullptr)
@@ -225,7 +275,8 @@ void RegistryDelegate::unregisterGlobal (wl_global* handle)
 		if(global->second == handle)
 		{
 			wl_global_destroy (global->second);
-			global = globals.erase (global);
+			globals.erase (global);
+			return;
 		}
 	}
 }
@@ -275,6 +326,22 @@ void RegistryDelegate::bind (wl_client* client, void* data, uint32_t version, ui
 	instance ().bind (implementation, client, selectedVersion, id);
 }
 
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void RegistryDelegate::bindOutput (wl_client* client, void* data, uint32_t version, uint32_t id)
+{
+	uint32_t selectedVersion = std::min<uint32_t> (OutputDelegate::kMaxVersion, version);
+
+	if(selectedVersion < OutputDelegate::kMinVersion)
+	{
+		sendInvalidVersion (client, wl_output_interface.name, OutputDelegate::kMinVersion);
+		return;
+	}
+
+	WaylandResource* implementation = new OutputDelegate (uint32_t(uintptr_t(data)));
+	instance ().bind (implementation, client, selectedVersion, id);
+}
+
 //************************************************************************************************
 // CompositorDelegate
 //************************************************************************************************
@@ -288,7 +355,6 @@ CompositorDelegate::CompositorDelegate ()
 	IWaylandClientContext* context = WaylandServer::instance ().getContext ();
 	setProxy (reinterpret_cast<wl_proxy*> (context ? context->getCompositor () : nullptr));
 	wrapProxy ();
-	compositor = reinterpret_cast<wl_compositor*> (proxyWrapper);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -303,10 +369,11 @@ void CompositorDelegate::onCreateSurface (wl_client* client, wl_resource* resour
 	}
 
 	CompositorDelegate* This = cast<CompositorDelegate> (resource);
-	if(This->compositor == nullptr)
+	wl_compositor* compositor = This->getCompositor ();
+	if(compositor == nullptr)
 		return;
 	
-	wl_surface* surface = wl_compositor_create_surface (This->compositor);
+	wl_surface* surface = wl_compositor_create_surface (compositor);
 	WaylandResource* implementation = new SurfaceDelegate (surface);
 	connection->addResource (implementation, id);
 }
@@ -322,13 +389,9 @@ void CompositorDelegate::onCreateRegion (wl_client* client, wl_resource* resourc
 		return;
 	}
 
-	CompositorDelegate* This = cast<CompositorDelegate> (resource);
-	if(This->compositor == nullptr)
-		return;
-	
-	wl_region* region = wl_compositor_create_region (This->compositor);
-	WaylandResource* implementation = new RegionDelegate (region);
-	connection->addResource (implementation, id);
+	// regions are kept locally, see SurfaceDelegate::setOpaqueRegion
+	WaylandResource* implementation = new RegionDelegate;
+	connection->addResource (implementation, wl_resource_get_version (resource), id);
 }
 
 //************************************************************************************************
@@ -344,7 +407,6 @@ SubCompositorDelegate::SubCompositorDelegate ()
 	IWaylandClientContext* context = WaylandServer::instance ().getContext ();
 	setProxy (reinterpret_cast<wl_proxy*> (context ? context->getSubCompositor () : nullptr));
 	wrapProxy ();
-	subCompositor = reinterpret_cast<wl_subcompositor*> (proxyWrapper);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -380,14 +442,17 @@ void SubCompositorDelegate::getSubsurface (wl_client* client, wl_resource* resou
 	}
 
 	SubCompositorDelegate* This = cast<SubCompositorDelegate> (resource);
-	if(This->subCompositor == nullptr)
+	wl_subcompositor* subCompositor = This->getSubCompositor ();
+	if(subCompositor == nullptr)
 		return;
 	
 	wl_surface* waylandSurface = reinterpret_cast<wl_surface*> (waylandSurfaceResource->getProxy ());
 	wl_surface* parentSurface = reinterpret_cast<wl_surface*> (parentSurfaceResource->getProxy ());
-	wl_subsurface* subSurface = wl_subcompositor_get_subsurface (This->subCompositor, waylandSurface, parentSurface);
+	wl_subsurface* subSurface = wl_subcompositor_get_subsurface (subCompositor, waylandSurface, parentSurface);
 
-	WaylandResource* implementation = new SubSurfaceDelegate (subSurface);
+	SurfaceDelegate* surfaceDelegate = dynamic_cast<SurfaceDelegate*> (waylandSurfaceResource);
+	SurfaceDelegate* parentDelegate = dynamic_cast<SurfaceDelegate*> (parentSurfaceResource);
+	WaylandResource* implementation = new SubSurfaceDelegate (subSurface, surfaceDelegate, parentDelegate, parentSurface);
 	connection->addResource (implementation, id);
 }
 
@@ -403,7 +468,40 @@ SharedMemoryDelegate::SharedMemoryDelegate ()
 	IWaylandClientContext* context = WaylandServer::instance ().getContext ();
 	setProxy (reinterpret_cast<wl_proxy*> (context ? context->getSharedMemory () : nullptr));
 	wrapProxy ();
-	shm = reinterpret_cast<wl_shm*> (proxyWrapper);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SharedMemoryDelegate::initialize ()
+{
+	std::vector<uint32_t> formats = { WL_SHM_FORMAT_ARGB8888, WL_SHM_FORMAT_XRGB8888 };
+
+	// formats missing upstream are converted, which needs the list of the session compositor
+	IWaylandClientContext* context = WaylandServer::instance ().getContext ();
+	int count = context ? context->countSharedMemoryFormats () : 0;
+	for(int i = 0; i < count; i++)
+		formats.push_back (context->getSharedMemoryFormat (i));
+	if(count > 0)
+	{
+		static const uint32_t kConvertedFormats[] =
+		{
+			WL_SHM_FORMAT_ABGR8888, WL_SHM_FORMAT_XBGR8888, WL_SHM_FORMAT_RGBA8888, WL_SHM_FORMAT_RGBX8888,
+			WL_SHM_FORMAT_BGRA8888, WL_SHM_FORMAT_BGRX8888, WL_SHM_FORMAT_ARGB2101010, WL_SHM_FORMAT_XRGB2101010,
+			WL_SHM_FORMAT_ABGR2101010, WL_SHM_FORMAT_XBGR2101010, WL_SHM_FORMAT_RGB888, WL_SHM_FORMAT_BGR888,
+			WL_SHM_FORMAT_RGB565, WL_SHM_FORMAT_BGR565, WL_SHM_FORMAT_ARGB4444, WL_SHM_FORMAT_XRGB4444,
+			WL_SHM_FORMAT_ARGB1555, WL_SHM_FORMAT_XRGB1555
+		};
+		formats.insert (formats.end (), std::begin (kConvertedFormats), std::end (kConvertedFormats));
+	}
+
+	std::vector<uint32_t> sent;
+	for(uint32_t format : formats)
+	{
+		if(std::find (sent.begin (), sent.end (), format) != sent.end ())
+			continue;
+		wl_shm_send_format (resourceHandle, format);
+		sent.push_back (format);
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -418,12 +516,11 @@ void SharedMemoryDelegate::createPool (wl_client* client, wl_resource* resource,
 	}
 
 	SharedMemoryDelegate* This = cast<SharedMemoryDelegate> (resource);
-	if(This->shm == nullptr)
+	wl_shm* shm = This->getSharedMemory ();
+	if(shm == nullptr)
 		return;
 	
-	wl_shm_pool* pool = wl_shm_create_pool (This->shm, fd, size);
-
-	WaylandResource* implementation = new SharedMemoryPoolDelegate (pool);
+	WaylandResource* implementation = new SharedMemoryPoolDelegate (SharedMemoryPool::acquire (shm, fd, size), fd, size);
 	connection->addResource (implementation, id);
 
 	::close (fd);
@@ -434,8 +531,7 @@ void SharedMemoryDelegate::createPool (wl_client* client, wl_resource* resource,
 //************************************************************************************************
 
 SeatDelegate::SeatDelegate ()
-: WaylandResource (&::wl_seat_interface, static_cast<wl_seat_interface*> (this)),
-  seat (nullptr)
+: WaylandResource (&::wl_seat_interface, static_cast<wl_seat_interface*> (this))
 {
 	wl_seat_interface::release = onRelease;
 	get_pointer = getPointer;
@@ -445,13 +541,21 @@ SeatDelegate::SeatDelegate ()
 	IWaylandClientContext* context = WaylandServer::instance ().getContext ();
 	setProxy (reinterpret_cast<wl_proxy*> (context->getSeat ()));
 	wrapProxy ();
-	seat = reinterpret_cast<wl_seat*> (proxyWrapper);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+SeatDelegate::~SeatDelegate ()
+{
+	RegistryDelegate::instance ().removeSeatResource (this);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
 void SeatDelegate::initialize ()
 {
+	RegistryDelegate::instance ().addSeatResource (this);
+
 	sendCapabilities ();
 	sendName ();
 }
@@ -491,7 +595,7 @@ void SeatDelegate::getPointer (wl_client* client, wl_resource* resource, uint32_
 	}
 
 	SeatDelegate* This = cast<SeatDelegate> (resource);
-	WaylandResource* implementation = new PointerDelegate (This->seat);
+	WaylandResource* implementation = new PointerDelegate (This->getSeat ());
 	connection->addResource (implementation, id);
 }
 
@@ -507,7 +611,7 @@ void SeatDelegate::getKeyboard (wl_client* client, wl_resource* resource, uint32
 	}
 
 	SeatDelegate* This = cast<SeatDelegate> (resource);
-	WaylandResource* implementation = new KeyboardDelegate (This->seat);
+	WaylandResource* implementation = new KeyboardDelegate (This->getSeat ());
 	connection->addResource (implementation, id);
 }
 
@@ -523,7 +627,7 @@ void SeatDelegate::getTouch (wl_client* client, wl_resource* resource, uint32_t
 	}
 
 	SeatDelegate* This = cast<SeatDelegate> (resource);
-	WaylandResource* implementation = new TouchDelegate (This->seat);
+	WaylandResource* implementation = new TouchDelegate (This->getSeat ());
 	connection->addResource (implementation, id);
 }
 
@@ -531,38 +635,71 @@ void SeatDelegate::getTouch (wl_client* client, wl_resource* resource, uint32_t
 // OutputDelegate
 //************************************************************************************************
 
-OutputDelegate::OutputDelegate (int index)
+OutputDelegate::OutputDelegate (uint32_t outputId)
 : WaylandResource (&::wl_output_interface, static_cast<wl_output_interface*> (this)),
-  index (index),
-  outputHandle (nullptr)
+  outputId (outputId)
 {
 	wl_output_interface::release = onRelease;
 
-	IWaylandClientContext* context = WaylandServer::instance ().getContext ();
-	const WaylandOutput& output = context->getOutput (index);
-	outputHandle = output.handle;
+	const WaylandOutput* output = RegistryDelegate::instance ().findOutput (outputId);
+	setProxy (reinterpret_cast<wl_proxy*> (output ? output->handle : nullptr));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+OutputDelegate::~OutputDelegate ()
+{
+	RegistryDelegate::instance ().removeOutputResource (outputId, this);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
 
-	setProxy (reinterpret_cast<wl_proxy*> (outputHandle));
+void OutputDelegate::detach ()
+{
+	outputId = 0;
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
 void OutputDelegate::initialize ()
 {
+	RegistryDelegate::instance ().addOutputResource (outputId, this);
+
 	sendProperties ();
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
-void OutputDelegate::sendProperties () const
+int OutputDelegate::getChanges (const WaylandOutput& previous, const WaylandOutput& current)
 {
-	IWaylandClientContext* context = WaylandServer::instance ().getContext ();
-	const WaylandOutput& output = context->getOutput (index);
+	int changes = 0;
+	if(previous.x != current.x || previous.y != current.y 
+		|| previous.physicalWidth != current.physicalWidth || previous.physicalHeight != current.physicalHeight
+		|| previous.subPixelOrientation != current.subPixelOrientation || previous.transformType != current.transformType
+		|| ::strcmp (previous.manufacturer, current.manufacturer) != 0 || ::strcmp (previous.model, current.model) != 0)
+		changes |= kGeometryChanged;
+	if(previous.width != current.width || previous.height != current.height || previous.refreshRate != current.refreshRate)
+		changes |= kModeChanged;
+	if(previous.scaleFactor != current.scaleFactor)
+		changes |= kScaleChanged;
+	return changes;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
 
-	wl_output_send_geometry (getResourceHandle (), output.x, output.y, output.physicalWidth, output.physicalHeight, 
-		output.subPixelOrientation, output.manufacturer, output.model, output.transformType);
-	wl_output_send_mode (getResourceHandle (), WL_OUTPUT_MODE_CURRENT, output.width, output.height, output.refreshRate);
-	wl_output_send_scale (getResourceHandle (), output.scaleFactor);
+void OutputDelegate::sendProperties (int changes) const
+{
+	const WaylandOutput* output = RegistryDelegate::instance ().findOutput (outputId);
+	if(output == nullptr || changes == 0)
+		return;
+
+	if(changes & kGeometryChanged)
+		wl_output_send_geometry (getResourceHandle (), output->x, output->y, output->physicalWidth, output->physicalHeight, 
+			output->subPixelOrientation, output->manufacturer, output->model, output->transformType);
+	if(changes & kModeChanged)
+		wl_output_send_mode (getResourceHandle (), WL_OUTPUT_MODE_CURRENT, output->width, output->height, output->refreshRate);
+	if(changes & kScaleChanged)
+		wl_output_send_scale (getResourceHandle (), output->scaleFactor);
 	wl_output_send_done (getResourceHandle ());
 }
 
@@ -578,8 +715,7 @@ void OutputDelegate::onRelease (wl_client* client, wl_resource* resource)
 //************************************************************************************************
 
 XdgWindowManagerDelegate::XdgWindowManagerDelegate ()
-: WaylandResource (&::xdg_wm_base_interface, static_cast<xdg_wm_base_interface*> (this)),
-  windowManager (nullptr)
+: WaylandResource (&::xdg_wm_base_interface, static_cast<xdg_wm_base_interface*> (this))
 {
 	destroy = onDestroy;
 	create_positioner = createPositioner;
@@ -589,7 +725,6 @@ XdgWindowManagerDelegate::XdgWindowManagerDelegate ()
 	IWaylandClientContext* context = WaylandServer::instance ().getContext ();
 	setProxy (reinterpret_cast<wl_proxy*> (context ? context->getWindowManager () : nullptr));
 	wrapProxy ();
-	windowManager = reinterpret_cast<xdg_wm_base*> (proxyWrapper);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -602,6 +737,14 @@ void XdgWindowManagerDelegate::sendPing ()
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
+xdg_surface* XdgWindowManagerDelegate::createXdgSurface (wl_surface* surface)
+{
+	xdg_wm_base* windowManager = getWindowManager ();
+	return windowManager ? xdg_wm_base_get_xdg_surface (windowManager, surface) : nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
 void XdgWindowManagerDelegate::onDestroy (wl_client* client, wl_resource* resource)
 {
 	wl_resource_destroy (resource);
@@ -619,10 +762,11 @@ void XdgWindowManagerDelegate::createPositioner (wl_client* client, wl_resource*
 	}
 
 	XdgWindowManagerDelegate* This = cast<XdgWindowManagerDelegate> (resource);
-	if(This->windowManager == nullptr)
+	xdg_wm_base* windowManager = This->getWindowManager ();
+	if(windowManager == nullptr)
 		return;
 
-	xdg_positioner* positioner = xdg_wm_base_create_positioner (This->windowManager);
+	xdg_positioner* positioner = xdg_wm_base_create_positioner (windowManager);
 	WaylandResource* implementation = new XdgPositionerDelegate (positioner);
 	connection->addResource (implementation, id);
 }
@@ -649,10 +793,14 @@ void XdgWindowManagerDelegate::getXdgSurface (wl_client* client, wl_resource* re
 	if(waylandSurface == nullptr)
 		return;
 
+	// the xdg surface of a redirected toplevel must not exist upstream, the wl_surface becomes a subsurface instead
 	XdgWindowManagerDelegate* This = cast<XdgWindowManagerDelegate> (resource);
-	xdg_surface* xdgSurface = xdg_wm_base_get_xdg_surface (This->windowManager, waylandSurface);
-	WaylandResource* implementation = new XdgSurfaceDelegate (This, xdgSurface);
-	connection->addResource (implementation, id);
+	xdg_surface* xdgSurface = nullptr;
+	if(connection->toplevelRedirection.parentSurface == nullptr)
+		xdgSurface = This->createXdgSurface (waylandSurface);
+
+	WaylandResource* implementation = new XdgSurfaceDelegate (This, xdgSurface, dynamic_cast<SurfaceDelegate*> (waylandSurfaceResource), waylandSurface);
+	connection->addResource (implementation, wl_resource_get_version (resource), id);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -64,6 +64,9 @@
 
 namespace WaylandServerDelegate {
 
+class SeatDelegate;
+class OutputDelegate;
+
 //************************************************************************************************
 // RegistryDelegate
 //************************************************************************************************
@@ -81,13 +84,23 @@ public:
 
 	void bind (WaylandResource* implementation, wl_client* client, uint32_t version, uint32_t id);
 	template<class T> static void bind (wl_client* client, void* data, uint32_t version, uint32_t id);
+	static void bindOutput (wl_client* client, void* data, uint32_t version, uint32_t id);
+
+	const WaylandOutput* findOutput (uint32_t outputId) const;
+
+	void addSeatResource (SeatDelegate* seat);
+	void removeSeatResource (SeatDelegate* seat);
+	void addOutputResource (uint32_t outputId, OutputDelegate* output);
+	void removeOutputResource (uint32_t outputId, OutputDelegate* output);
 
 	// IContextListener
 	void contextChanged (ChangeType type) override;
 
 private:
 	std::unordered_map<uint32_t, wl_global*> globals;
-	std::vector<uint32_t> outputs;
+	std::unordered_map<uint32_t, WaylandOutput> outputs; // last state sent to clients, by proxy id
+	std::vector<SeatDelegate*> seatResources;
+	std::unordered_map<uint32_t, std::vector<OutputDelegate*>> outputResources;
 
 	RegistryDelegate ();
 
@@ -117,7 +130,7 @@ public:
 	static void onCreateRegion (wl_client* client, wl_resource* resource, uint32_t id);
 
 private:
-	wl_compositor* compositor;
+	wl_compositor* getCompositor () { return getWrappedProxy<wl_compositor> (); }
 };
 
 //************************************************************************************************
@@ -138,7 +151,7 @@ public:
 	static void getSubsurface (wl_client* client, wl_resource* resource, uint32_t id, wl_resource* surface, wl_resource* parent);
 
 private:
-	wl_subcompositor* subCompositor;
+	wl_subcompositor* getSubCompositor () { return getWrappedProxy<wl_subcompositor> (); }
 };
 
 //************************************************************************************************
@@ -154,11 +167,14 @@ public:
 	static const int kMinVersion = 1;
 	static const int kMaxVersion = 1;
 
+	// WaylandResource
+	void initialize () override;
+
 	// interface
 	static void createPool (wl_client* client, wl_resource* resource,  uint32_t id, int32_t fd, int32_t size);
 
 private:
-	wl_shm* shm;
+	wl_shm* getSharedMemory () { return getWrappedProxy<wl_shm> (); }
 };
 
 //************************************************************************************************
@@ -170,6 +186,7 @@ class SeatDelegate: public WaylandResource,
 {
 public:
 	SeatDelegate ();
+	~SeatDelegate ();
 
 	static const int kMinVersion = WL_POINTER_AXIS_DISCRETE_SINCE_VERSION;
 	static const int kMaxVersion = WAYLAND_SEAT_VERSION;
@@ -187,7 +204,7 @@ public:
 	static void getTouch (wl_client* client, wl_resource* resource, uint32_t id);
 
 private:
-	wl_seat* seat;
+	wl_seat* getSeat () { return getWrappedProxy<wl_seat> (); }
 };
 
 //************************************************************************************************
@@ -198,12 +215,26 @@ class OutputDelegate: public WaylandResource,
 					  public wl_output_interface
 {
 public:
-	OutputDelegate (int index = 0);
+	OutputDelegate (uint32_t outputId = 0);
+	~OutputDelegate ();
 
 	static const int kMinVersion = 3;
 	static const int kMaxVersion = 3;
 
-	void sendProperties () const;
+	enum Changes
+	{
+		kGeometryChanged = 1 << 0,
+		kModeChanged = 1 << 1,
+		kScaleChanged = 1 << 2,
+		kAllChanged = kGeometryChanged|kModeChanged|kScaleChanged
+	};
+
+	static int getChanges (const WaylandOutput& previous, const WaylandOutput& current);
+
+	void sendProperties (int changes = kAllChanged) const;
+
+	/** Called when the output has been removed, the resource no longer receives properties. */
+	void detach ();
 
 	// WaylandResource
 	void initialize () override;
@@ -212,8 +243,7 @@ public:
 	static void onRelease (wl_client* client, wl_resource* resource);
 
 private:
-	wl_output* outputHandle;
-	int index;
+	uint32_t outputId;
 };
 
 //************************************************************************************************
@@ -230,6 +260,7 @@ public:
 	static const int kMaxVersion = 7;
 
 	void sendPing ();
+	xdg_surface* createXdgSurface (wl_surface* surface);
 
 	// interface
 	static void onDestroy (wl_client* client, wl_resource* resource);
@@ -238,7 +269,7 @@ public:
 	static void onPong (wl_client* client, wl_resource* resource, uint32_t serial);
 
 private:
-	xdg_wm_base* windowManager;
+	xdg_wm_base* getWindowManager () { return getWrappedProxy<xdg_wm_base> (); }
 };
 
 } // namespace WaylandServerDelegate
@@ -50,8 +50,14 @@ PointerDelegate::PointerDelegate (wl_seat* seat)
 : WaylandResource (&::wl_pointer_interface, static_cast<wl_pointer_interface*> (this)),
   pointer (nullptr),
   savedFocus (nullptr),
+  focus (nullptr),
   offsetX (0),
-  offsetY (0)
+  offsetY (0),
+  pickedFocus (nullptr),
+  pickedX (0),
+  pickedY (0),
+  enterSerial (0),
+  buttons (0)
 {
 	enter = onPointerEnter;
 	leave = onPointerLeave;
@@ -110,15 +116,25 @@ void PointerDelegate::onPointerEnter (void* data, wl_pointer* pointer, uint32_t
 {
 	PointerDelegate* This = static_cast<PointerDelegate*> (data);
 	WaylandServer& server = WaylandServer::instance ();
+	WaylandServer::ScopedLock scopedLock (server.getLock ());
 	WaylandServer::ClientConnection* connection = server.findClientConnection (This->clientHandle);
 	if(connection == nullptr)
 		return;
 	WaylandResource* resource = connection->findResource (reinterpret_cast<wl_proxy*> (surface));
+	This->pickedFocus = nullptr;
+	This->pickedX = 0;
+	This->pickedY = 0;
+	This->enterSerial = serial;
+	This->buttons = 0;
 	if(resource)
 	{
 		This->offsetX = 0;
 		This->offsetY = 0;
-		wl_pointer_send_enter (This->getResourceHandle (), serial, resource->getResourceHandle (), x, y);
+		This->focus = surface;
+		if(server.getContentOptimizations () & IWaylandServer::kFlattenSubsurfaces)
+			This->pickFocus (x, y);
+		else
+			wl_pointer_send_enter (This->getResourceHandle (), serial, resource->getResourceHandle (), x, y);
 	}
 	else if(This->savedFocus && This->savedFocus != surface)
 	{
@@ -127,7 +143,10 @@ void PointerDelegate::onPointerEnter (void* data, wl_pointer* pointer, uint32_t
 			IWaylandClientContext* context = server.getContext ();
 			bool succeeded = context ? context->getSubSurfaceOffset (This->offsetX, This->offsetY, connection->clientDisplay, surface, This->savedFocus) : false;
 			if(succeeded)
+			{
+				This->focus = This->savedFocus;
 				wl_pointer_send_enter (This->getResourceHandle (), serial, resource->getResourceHandle (), x - This->offsetX, y - This->offsetY);
+			}
 		}
 		This->savedFocus = nullptr;
 	}
@@ -139,12 +158,19 @@ void PointerDelegate::onPointerLeave (void* data, wl_pointer* pointer, uint32_t
 {
 	PointerDelegate* This = static_cast<PointerDelegate*> (data);
 	WaylandServer& server = WaylandServer::instance ();
+	WaylandServer::ScopedLock scopedLock (server.getLock ());
 	WaylandResource* resource = server.findClientResource (This->clientHandle, reinterpret_cast<wl_proxy*> (surface));
 	if(resource)
 	{
-		wl_pointer_send_leave (This->getResourceHandle (), serial, resource->getResourceHandle ());
+		WaylandResource* pickedResource = This->pickedFocus ? server.findClientResource (This->clientHandle, reinterpret_cast<wl_proxy*> (This->pickedFocus)) : resource;
+		if(pickedResource)
+			wl_pointer_send_leave (This->getResourceHandle (), serial, pickedResource->getResourceHandle ());
 		This->savedFocus = surface;
 	}
+	This->focus = nullptr;
+	This->pickedFocus = nullptr;
+	This->pickedX = 0;
+	This->pickedY = 0;
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -152,7 +178,62 @@ void PointerDelegate::onPointerLeave (void* data, wl_pointer* pointer, uint32_t
 void PointerDelegate::onPointerMotion (void* data, wl_pointer* pointer, uint32_t time, wl_fixed_t x, wl_fixed_t y)
 {
 	PointerDelegate* This = static_cast<PointerDelegate*> (data);
-	wl_pointer_send_motion (This->getResourceHandle (), time, x - This->offsetX, y - This->offsetY);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
+
+	// the application may ask to drop motion over surfaces it has hidden
+	WaylandServer& server = WaylandServer::instance ();
+	if(This->focus && server.hasHiddenSurfaces ())
+	{
+		SurfaceDelegate* surface = dynamic_cast<SurfaceDelegate*> (server.findClientResource (This->clientHandle, reinterpret_cast<wl_proxy*> (This->focus)));
+		bool dropPointerMotion = false;
+		if(surface && surface->isHidden (&dropPointerMotion) && dropPointerMotion)
+			return;
+	}
+
+	// like an implicit grab, the picked surface keeps the focus while buttons are pressed
+	if(This->pickedFocus && This->buttons == 0)
+		This->pickFocus (x, y);
+
+	wl_pointer_send_motion (This->getResourceHandle (), time, x - This->offsetX - wl_fixed_from_int (This->pickedX), y - This->offsetY - wl_fixed_from_int (This->pickedY));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void PointerDelegate::pickFocus (wl_fixed_t x, wl_fixed_t y)
+{
+	// the session compositor only sees the root of a flattened tree, so focus changes within the tree are sent here
+	WaylandServer& server = WaylandServer::instance ();
+	WaylandServer::ClientConnection* connection = server.findClientConnection (clientHandle);
+	SurfaceDelegate* root = connection ? dynamic_cast<SurfaceDelegate*> (connection->findResource (reinterpret_cast<wl_proxy*> (focus))) : nullptr;
+	if(root == nullptr)
+		return;
+
+	// outside of all input regions, the root keeps the focus
+	int32_t targetX = 0;
+	int32_t targetY = 0;
+	SurfaceDelegate* target = root->isFlattened () ? root->pickSurface (wl_fixed_to_int (x), wl_fixed_to_int (y), targetX, targetY) : nullptr;
+	if(target == nullptr)
+	{
+		target = root;
+		targetX = 0;
+		targetY = 0;
+	}
+
+	wl_surface* targetSurface = reinterpret_cast<wl_surface*> (target->getOriginalProxy ());
+	if(targetSurface == pickedFocus)
+		return;
+
+	if(pickedFocus)
+	{
+		WaylandResource* resource = connection->findResource (reinterpret_cast<wl_proxy*> (pickedFocus));
+		if(resource)
+			wl_pointer_send_leave (getResourceHandle (), enterSerial, resource->getResourceHandle ());
+	}
+
+	pickedFocus = targetSurface;
+	pickedX = targetX;
+	pickedY = targetY;
+	wl_pointer_send_enter (getResourceHandle (), enterSerial, target->getResourceHandle (), x - wl_fixed_from_int (targetX), y - wl_fixed_from_int (targetY));
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -160,6 +241,11 @@ void PointerDelegate::onPointerMotion (void* data, wl_pointer* pointer, uint32_t
 void PointerDelegate::onPointerButton (void* data, wl_pointer* pointer, uint32_t serial, uint32_t time, uint32_t button, uint32_t state)
 {
 	PointerDelegate* This = static_cast<PointerDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
+	if(state == WL_POINTER_BUTTON_STATE_PRESSED)
+		This->buttons++;
+	else if(This->buttons > 0)
+		This->buttons--;
 	wl_pointer_send_button (This->getResourceHandle (), serial, time, button, state);
 }
 
@@ -168,6 +254,7 @@ void PointerDelegate::onPointerButton (void* data, wl_pointer* pointer, uint32_t
 void PointerDelegate::onPointerAxis (void* data, wl_pointer* pointer, uint32_t time, uint32_t axis, wl_fixed_t value)
 {
 	PointerDelegate* This = static_cast<PointerDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	wl_pointer_send_axis (This->getResourceHandle (), time, axis, value);
 }
 
@@ -176,6 +263,7 @@ void PointerDelegate::onPointerAxis (void* data, wl_pointer* pointer, uint32_t t
 void PointerDelegate::onPointerAxisSource (void* data, wl_pointer* pointer, uint32_t axisSource)
 {
 	PointerDelegate* This = static_cast<PointerDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	wl_pointer_send_axis_source (This->getResourceHandle (), axisSource);
 }
 
@@ -184,6 +272,7 @@ void PointerDelegate::onPointerAxisSource (void* data, wl_pointer* pointer, uint
 void PointerDelegate::onPointerAxisStop (void* data, wl_pointer* pointer, uint32_t time, uint32_t axis)
 {
 	PointerDelegate* This = static_cast<PointerDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	wl_pointer_send_axis_stop (This->getResourceHandle (), time, axis);
 }
 
@@ -192,6 +281,7 @@ void PointerDelegate::onPointerAxisStop (void* data, wl_pointer* pointer, uint32
 void PointerDelegate::onPointerAxisDiscrete (void* data, wl_pointer* pointer, uint32_t axis, int32_t discrete)
 {
 	PointerDelegate* This = static_cast<PointerDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	wl_pointer_send_axis_discrete (This->getResourceHandle (), axis, discrete);
 }
 
@@ -200,6 +290,7 @@ void PointerDelegate::onPointerAxisDiscrete (void* data, wl_pointer* pointer, ui
 void PointerDelegate::onPointerAxis120 (void* data, wl_pointer* pointer, uint32_t axis, int32_t discrete)
 {
 	PointerDelegate* This = static_cast<PointerDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	#ifdef WL_POINTER_AXIS_VALUE120_SINCE_VERSION
 	if(wl_resource_get_version (This->getResourceHandle ()) >= WL_POINTER_AXIS_VALUE120_SINCE_VERSION)
 		wl_pointer_send_axis_value120 (This->getResourceHandle (), axis, discrete);
@@ -216,6 +307,7 @@ void PointerDelegate::onPointerAxisRelativeDirection (void* data, wl_pointer* po
 {
 	#ifdef WL_POINTER_AXIS_RELATIVE_DIRECTION_SINCE_VERSION
 	PointerDelegate* This = static_cast<PointerDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	if(wl_resource_get_version (This->getResourceHandle ()) >= WL_POINTER_AXIS_RELATIVE_DIRECTION_SINCE_VERSION)
 		wl_pointer_send_axis_relative_direction (This->getResourceHandle (), axis, direction);
 	#endif
@@ -226,6 +318,7 @@ void PointerDelegate::onPointerAxisRelativeDirection (void* data, wl_pointer* po
 void PointerDelegate::onPointerFrame (void* data, wl_pointer* pointer)
 {
 	PointerDelegate* This = static_cast<PointerDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	wl_pointer_send_frame (This->getResourceHandle ());
 }
 
@@ -273,6 +366,7 @@ void KeyboardDelegate::onRelease (wl_client* client, wl_resource* resource)
 void KeyboardDelegate::onKeymapReceived (void* data, wl_keyboard* keyboard, uint32_t format, int32_t fd, uint32_t size)
 {
 	KeyboardDelegate* This = static_cast<KeyboardDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	wl_keyboard_send_keymap (This->getResourceHandle (), format, fd, size);
 	::close (fd);
 }
@@ -283,6 +377,7 @@ void KeyboardDelegate::onKeyboardFocusEnter (void* data, wl_keyboard* keyboard,
 {
 	KeyboardDelegate* This = static_cast<KeyboardDelegate*> (data);
 	WaylandServer& server = WaylandServer::instance ();
+	WaylandServer::ScopedLock scopedLock (server.getLock ());
 	WaylandResource* resource = server.findClientResource (This->clientHandle, reinterpret_cast<wl_proxy*> (surface));
 	if(resource)
 		wl_keyboard_send_enter (This->getResourceHandle (), serial, resource->getResourceHandle (), keys);
@@ -294,6 +389,7 @@ void KeyboardDelegate::onKeyboardFocusLeave (void* data, wl_keyboard* keyboard,
 {
 	KeyboardDelegate* This = static_cast<KeyboardDelegate*> (data);
 	WaylandServer& server = WaylandServer::instance ();
+	WaylandServer::ScopedLock scopedLock (server.getLock ());
 	WaylandResource* resource = server.findClientResource (This->clientHandle, reinterpret_cast<wl_proxy*> (surface));
 	if(resource)
 		wl_keyboard_send_leave (This->getResourceHandle (), serial, resource->getResourceHandle ());	
@@ -304,6 +400,7 @@ void KeyboardDelegate::onKeyboardFocusLeave (void* data, wl_keyboard* keyboard,
 void KeyboardDelegate::onKey (void* data, wl_keyboard* keyboard, uint32_t serial, uint32_t time, uint32_t key, uint32_t state)
 {
 	KeyboardDelegate* This = static_cast<KeyboardDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	#ifdef WL_KEYBOARD_KEY_STATE_REPEATED_SINCE_VERSION
 	if(wl_resource_get_version (This->getResourceHandle ()) < WL_KEYBOARD_KEY_STATE_REPEATED_SINCE_VERSION)
 	{
@@ -319,6 +416,7 @@ void KeyboardDelegate::onKey (void* data, wl_keyboard* keyboard, uint32_t serial
 void KeyboardDelegate::onModifiers (void* data, wl_keyboard* keyboard, uint32_t serial, uint32_t depressedModifiers, uint32_t latchedModifiers, uint32_t lockedModifiers, uint32_t group)
 {
 	KeyboardDelegate* This = static_cast<KeyboardDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	wl_keyboard_send_modifiers (This->getResourceHandle (), serial, depressedModifiers, latchedModifiers, lockedModifiers, group);
 }
 
@@ -327,6 +425,7 @@ void KeyboardDelegate::onModifiers (void* data, wl_keyboard* keyboard, uint32_t
 void KeyboardDelegate::onRepeatInfo (void* data, wl_keyboard* keyboard, int32_t rate, int32_t delay)
 {
 	KeyboardDelegate* This = static_cast<KeyboardDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	wl_keyboard_send_repeat_info (This->getResourceHandle (), rate, delay);
 }
 
@@ -376,6 +475,7 @@ void TouchDelegate::onTouchDown (void* data, wl_touch* touch, uint32_t serial, u
 {
 	TouchDelegate* This = static_cast<TouchDelegate*> (data);
 	WaylandServer& server = WaylandServer::instance ();
+	WaylandServer::ScopedLock scopedLock (server.getLock ());
 	WaylandResource* resource = server.findClientResource (This->clientHandle, reinterpret_cast<wl_proxy*> (surface));
 	if(resource)
 		wl_touch_send_down (This->getResourceHandle (), serial, time, resource->getResourceHandle (), id, x, y);
@@ -386,6 +486,7 @@ void TouchDelegate::onTouchDown (void* data, wl_touch* touch, uint32_t serial, u
 void TouchDelegate::onTouchUp (void* data, wl_touch* touch, uint32_t serial, uint32_t time, int32_t id)
 {
 	TouchDelegate* This = static_cast<TouchDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	wl_touch_send_up (This->getResourceHandle (), serial, time, id);
 }
 
@@ -394,6 +495,7 @@ void TouchDelegate::onTouchUp (void* data, wl_touch* touch, uint32_t serial, uin
 void TouchDelegate::onTouchMotion (void* data, wl_touch* touch, uint32_t time, int32_t id, wl_fixed_t x, wl_fixed_t y)
 {
 	TouchDelegate* This = static_cast<TouchDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	wl_touch_send_motion (This->getResourceHandle (), time, id, x, y);
 }
 
@@ -402,6 +504,7 @@ void TouchDelegate::onTouchMotion (void* data, wl_touch* touch, uint32_t time, i
 void TouchDelegate::onTouchCancel (void* data, wl_touch* touch)
 {
 	TouchDelegate* This = static_cast<TouchDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	wl_touch_send_cancel (This->getResourceHandle ());
 }
 
@@ -410,6 +513,7 @@ void TouchDelegate::onTouchCancel (void* data, wl_touch* touch)
 void TouchDelegate::onTouchShape (void* data, wl_touch* touch, int32_t id, wl_fixed_t major, wl_fixed_t minor)
 {
 	TouchDelegate* This = static_cast<TouchDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	wl_touch_send_shape (This->getResourceHandle (), id, major, minor);
 }
 
@@ -418,6 +522,7 @@ void TouchDelegate::onTouchShape (void* data, wl_touch* touch, int32_t id, wl_fi
 void TouchDelegate::onTouchOrientation (void* data, wl_touch* touch, int32_t id, wl_fixed_t orientation)
 {
 	TouchDelegate* This = static_cast<TouchDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	wl_touch_send_orientation (This->getResourceHandle (), id, orientation);
 }
 
@@ -426,5 +531,6 @@ void TouchDelegate::onTouchOrientation (void* data, wl_touch* touch, int32_t id,
 void TouchDelegate::onTouchFrame (void* data, wl_touch* touch)
 {
 	TouchDelegate* This = static_cast<TouchDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	wl_touch_send_frame (This->getResourceHandle ());
 }
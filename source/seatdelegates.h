@@ -74,8 +74,16 @@ public:
 private:
 	wl_pointer* pointer;
 	wl_surface* savedFocus;
+	wl_surface* focus; // upstream surface of the client surface with pointer focus
 	int32_t offsetX;
 	int32_t offsetY;
+	wl_surface* pickedFocus; // upstream surface of the client surface picked within a flattened tree, see SurfaceDelegate::pickSurface
+	int32_t pickedX;
+	int32_t pickedY;
+	uint32_t enterSerial;
+	int buttons; // pressed buttons, the picked surface keeps the focus while there are any
+
+	void pickFocus (wl_fixed_t x, wl_fixed_t y);
 };
 
 //************************************************************************************************
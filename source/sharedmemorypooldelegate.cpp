@@ -35,35 +35,258 @@
 
 #include "sharedmemorypooldelegate.h"
 #include "bufferdelegate.h"
+#include "pixelkernels.h"
 #include "waylandserver.h"
 
 #include "wayland-server-delegate/iwaylandclientcontext.h"
 
+#include <algorithm>
+#include <limits>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 using namespace WaylandServerDelegate;
 
 //************************************************************************************************
-// SharedMemoryPoolDelegate
+// SharedMemoryMapping
 //************************************************************************************************
 
-SharedMemoryPoolDelegate::SharedMemoryPoolDelegate (wl_shm_pool* pool)
-: WaylandResource (&::wl_shm_pool_interface, static_cast<wl_shm_pool_interface*> (this)),
-  pool (pool)
+SharedMemoryMapping::SharedMemoryMapping (int poolFd, int32_t size)
+: fd (-1),
+  data (nullptr),
+  size (size),
+  mappedSize (0)
 {
-	create_buffer = createBuffer;
-	destroy = onDestroy;
-	resize = onResize;
+	if(poolFd < 0 || size <= 0)
+		return;
+
+	fd = ::fcntl (poolFd, F_DUPFD_CLOEXEC, 0);
+	if(fd < 0)
+		return;
+
+	// the file size of a sealed file can only grow, it is checked once per pool size
+	int seals = ::fcntl (fd, F_GET_SEALS);
+	struct stat status;
+	if(seals < 0 || (seals & F_SEAL_SHRINK) == 0 || ::fstat (fd, &status) != 0 || status.st_size <= 0)
+		return;
+
+	int32_t length = int32_t(std::min<int64_t> (size, status.st_size));
+	void* address = ::mmap (nullptr, size_t(length), PROT_READ, MAP_SHARED, fd, 0);
+	if(address == MAP_FAILED)
+		return;
+
+	data = static_cast<uint8_t*> (address);
+	mappedSize = length;
+}
 
-	setProxy (reinterpret_cast<wl_proxy*> (pool));
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+SharedMemoryMapping::~SharedMemoryMapping ()
+{
+	if(data)
+		::munmap (data, size_t(mappedSize));
+	if(fd >= 0)
+		::close (fd);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+const uint8_t* SharedMemoryMapping::read (std::vector<uint8_t>& copy, int32_t offset, int32_t length) const
+{
+	if(fd < 0 || offset < 0 || length <= 0 || int64_t(offset) + length > size)
+		return nullptr;
+
+	if(int64_t(offset) + length <= mappedSize)
+		return data + offset;
+
+	// pread stops at the end of the file where a read of the mapping would fault
+	copy.resize (size_t(length));
+	size_t done = 0;
+	while(done < size_t(length))
+	{
+		ssize_t result = ::pread (fd, copy.data () + done, size_t(length) - done, off_t(offset) + off_t(done));
+		if(result < 0 && errno == EINTR)
+			continue;
+		if(result <= 0)
+			return nullptr;
+		done += size_t(result);
+	}
+	return copy.data ();
 }
 
+//************************************************************************************************
+// SharedMemoryPool
+//************************************************************************************************
+
+SharedMemoryPool::SharedMemoryPool (wl_shm_pool* pool, int32_t size)
+: pool (pool),
+  fd (-1),
+  device (0),
+  inode (0),
+  size (size),
+  bufferCache (std::make_shared<BufferCache> (int(kMaxCachedBuffers)))
+{}
+
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
-SharedMemoryPoolDelegate::~SharedMemoryPoolDelegate ()
+SharedMemoryPool::~SharedMemoryPool ()
 {
+	// cached buffers are destroyed before their pool
+	bufferCache.reset ();
+
 	if(pool)
 		wl_shm_pool_destroy (pool);
+	if(fd >= 0)
+		::close (fd);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::shared_ptr<SharedMemoryPool> SharedMemoryPool::acquire (wl_shm* shm, int fd, int32_t size)
+{
+	// clients recreate pools over the same memfd or open several pools on one file,
+	// sharing the upstream pool saves the session compositor from mapping the file again
+	struct stat status;
+	bool identified = ::fstat (fd, &status) == 0;
+
+	std::vector<std::weak_ptr<SharedMemoryPool>>& pools = WaylandServer::instance ().getSharedMemoryPools ();
+	for(auto it = pools.begin (); it != pools.end ();)
+	{
+		std::shared_ptr<SharedMemoryPool> pool = it->lock ();
+		if(pool == nullptr)
+		{
+			it = pools.erase (it);
+			continue;
+		}
+
+		if(identified && pool->device == status.st_dev && pool->inode == status.st_ino && pool->size == size)
+			return pool;
+		++it;
+	}
+
+	std::shared_ptr<SharedMemoryPool> pool (new SharedMemoryPool (wl_shm_create_pool (shm, fd, size), size));
+	if(identified)
+		pool->fd = ::fcntl (fd, F_DUPFD_CLOEXEC, 0);
+	if(pool->fd >= 0)
+	{
+		pool->device = status.st_dev;
+		pool->inode = status.st_ino;
+		pools.push_back (pool);
+	}
+	return pool;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::shared_ptr<SharedMemoryPool> SharedMemoryPool::resize (const std::shared_ptr<SharedMemoryPool>& pool, int32_t size)
+{
+	if(size <= pool->size)
+		return pool;
+
+	// growing a shared pool would change the mapping of the other client pools in the session compositor
+	if(pool.use_count () == 1 || pool->fd < 0)
+	{
+		pool->size = size;
+		if(pool->pool)
+			wl_shm_pool_resize (pool->pool, size);
+		return pool;
+	}
+
+	// the wl_shm proxy of the client pool may be gone, the context's proxy isn't wrapped
+	IWaylandClientContext* context = WaylandServer::instance ().getContext ();
+	wl_shm* shm = context ? context->getSharedMemory () : nullptr;
+	if(shm == nullptr)
+		return pool;
+
+	std::shared_ptr<SharedMemoryPool> resized = acquire (shm, pool->fd, size);
+	wl_event_queue* queue = WaylandServer::instance ().getQueue ();
+	if(resized->pool && queue)
+		wl_proxy_set_queue (reinterpret_cast<wl_proxy*> (resized->pool), queue);
+	return resized;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+wl_buffer* SharedMemoryPool::createHostBuffer (int32_t width, int32_t height, uint32_t format, uint8_t*& data, size_t& size)
+{
+	data = nullptr;
+	size = 0;
+
+	IWaylandClientContext* context = WaylandServer::instance ().getContext ();
+	wl_shm* shm = context ? context->getSharedMemory () : nullptr;
+	int bytesPerPixel = PixelKernels::getBytesPerPixel (format);
+	if(shm == nullptr || bytesPerPixel == 0 || width <= 0 || height <= 0 || int64_t(width) * height * bytesPerPixel > std::numeric_limits<int32_t>::max ())
+		return nullptr;
+
+	int fd = ::memfd_create ("wayland-server-delegate", MFD_CLOEXEC);
+	if(fd < 0)
+		return nullptr;
+
+	int32_t stride = width * bytesPerPixel;
+	size_t length = size_t(stride) * height;
+	void* address = MAP_FAILED;
+	if(::ftruncate (fd, off_t(length)) == 0)
+		address = ::mmap (nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(address == MAP_FAILED)
+	{
+		::close (fd);
+		return nullptr;
+	}
+
+	// the session compositor keeps its own mapping of the pool
+	wl_shm_pool* hostPool = wl_shm_create_pool (shm, fd, int32_t(length));
+	wl_buffer* buffer = hostPool ? wl_shm_pool_create_buffer (hostPool, 0, width, height, stride, format) : nullptr;
+	if(hostPool)
+		wl_shm_pool_destroy (hostPool);
+	::close (fd);
+
+	if(buffer == nullptr)
+	{
+		::munmap (address, length);
+		return nullptr;
+	}
+
+	// the context's wl_shm isn't wrapped, its buffers would be dispatched on the default queue
+	wl_event_queue* queue = WaylandServer::instance ().getQueue ();
+	if(queue)
+		wl_proxy_set_queue (reinterpret_cast<wl_proxy*> (buffer), queue);
+
+	data = static_cast<uint8_t*> (address);
+	size = length;
+	return buffer;
+}
+
+//************************************************************************************************
+// SharedMemoryPoolDelegate
+//************************************************************************************************
+
+SharedMemoryPoolDelegate::SharedMemoryPoolDelegate (const std::shared_ptr<SharedMemoryPool>& pool, int fd, int32_t size)
+: WaylandResource (&::wl_shm_pool_interface, static_cast<wl_shm_pool_interface*> (this)),
+  pool (pool),
+  size (size)
+{
+	create_buffer = createBuffer;
+	destroy = onDestroy;
+	resize = onResize;
+
+	setProxy (reinterpret_cast<wl_proxy*> (pool->getPool ()));
+
+	// buffers in formats unknown to the session compositor are converted from the mapping, the host may view buffer contents
+	const WaylandServer& server = WaylandServer::instance ();
+	bool converting = server.getContext () && server.getContext ()->countSharedMemoryFormats () > 0;
+	if(fd >= 0 && (server.getContentOptimizations () != 0 || converting || server.getContentObserver ()))
+	{
+		mapping = std::make_shared<SharedMemoryMapping> (fd, size);
+		if(!mapping->isValid ())
+			mapping.reset ();
+	}
 }
 
+
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
 void SharedMemoryPoolDelegate::onDestroy (wl_client* client, wl_resource* resource)
@@ -83,8 +306,85 @@ void SharedMemoryPoolDelegate::createBuffer (wl_client* client, wl_resource* poo
 		return;
 	}
 
-	wl_buffer* buffer = wl_shm_pool_create_buffer (This->pool, offset, width, height, stride, format);
+	// the upstream pool may be larger than the client pool, so it doesn't catch all invalid buffers
+	if(offset < 0 || width <= 0 || height <= 0 || stride < width || int64_t(offset) + int64_t(stride) * height > This->size)
+	{
+		wl_resource_post_error (poolResource, WL_SHM_ERROR_INVALID_STRIDE, "invalid buffer layout (%d, %dx%d, %d)", offset, width, height, stride);
+		return;
+	}
+
+	if(!WaylandServer::instance ().isSharedMemoryFormatSupported (format))
+	{
+		convertBuffer (client, poolResource, id, offset, width, height, stride, format);
+		return;
+	}
+
+	// toolkits often recreate buffers with the same layout, e.g. for each frame,
+	// reusing a released upstream buffer saves the session compositor from importing it again
+	const std::shared_ptr<BufferCache>& bufferCache = This->pool->getBufferCache ();
+	BufferCache::Key key = { offset, width, height, stride, format };
+	wl_buffer* buffer = bufferCache->take (key);
+	bool reused = buffer != nullptr;
+	if(!reused)
+		buffer = wl_shm_pool_create_buffer (This->pool->getPool (), offset, width, height, stride, format);
+
+	BufferDelegate* delegate = new BufferDelegate (buffer, reused);
+	delegate->setCache (bufferCache, key);
+	if(This->mapping)
+	{
+		SharedMemoryContent content;
+		content.mapping = This->mapping;
+		content.offset = offset;
+		content.width = width;
+		content.height = height;
+		content.stride = stride;
+		content.format = format;
+		delegate->setContent (content);
+	}
+	connection->addResource (delegate, id);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SharedMemoryPoolDelegate::convertBuffer (wl_client* client, wl_resource* poolResource, uint32_t id, int32_t offset, int32_t width, int32_t height, int32_t stride, uint32_t format)
+{
+	SharedMemoryPoolDelegate* This = cast<SharedMemoryPoolDelegate> (poolResource);
+	WaylandServer::ClientConnection* connection = WaylandServer::instance ().findClientConnection (client);
+
+	// forwarding the format would raise a protocol error on the session compositor connection
+	int bytesPerPixel = PixelKernels::getBytesPerPixel (format);
+	if(bytesPerPixel == 0 || This->mapping == nullptr)
+	{
+		wl_resource_post_error (poolResource, WL_SHM_ERROR_INVALID_FORMAT, "unsupported format 0x%x", format);
+		return;
+	}
+	if(int64_t(width) * bytesPerPixel > stride)
+	{
+		wl_resource_post_error (poolResource, WL_SHM_ERROR_INVALID_STRIDE, "invalid stride %d for width %d", stride, width);
+		return;
+	}
+
+	uint8_t* data = nullptr;
+	size_t size = 0;
+	uint32_t hostFormat = PixelKernels::hasAlpha (format) ? WL_SHM_FORMAT_ARGB8888 : WL_SHM_FORMAT_XRGB8888;
+	wl_buffer* buffer = SharedMemoryPool::createHostBuffer (width, height, hostFormat, data, size);
+	if(buffer == nullptr)
+	{
+		wl_client_post_no_memory (client);
+		return;
+	}
+
+	// pixels are converted when the buffer is attached
 	BufferDelegate* delegate = new BufferDelegate (buffer);
+	SharedMemoryContent content;
+	content.mapping = This->mapping;
+	content.offset = offset;
+	content.width = width;
+	content.height = height;
+	content.stride = stride;
+	content.format = format;
+	delegate->setContent (content);
+	delegate->setConversion (data, size);
 	connection->addResource (delegate, id);
 }
 
@@ -93,6 +393,21 @@ void SharedMemoryPoolDelegate::createBuffer (wl_client* client, wl_resource* poo
 void SharedMemoryPoolDelegate::onResize (wl_client* client, wl_resource* resource, int32_t size)
 {
 	SharedMemoryPoolDelegate* This = cast<SharedMemoryPoolDelegate> (resource);
-	if(This->pool)
-		wl_shm_pool_resize (This->pool, size);
+	if(size < This->size)
+	{
+		wl_resource_post_error (resource, WL_SHM_ERROR_INVALID_STRIDE, "shrinking pool invalid");
+		return;
+	}
+
+	This->size = size;
+	This->pool = SharedMemoryPool::resize (This->pool, size);
+	This->setProxy (reinterpret_cast<wl_proxy*> (This->pool->getPool ()));
+
+	// existing buffers keep the old mapping, which still covers them
+	if(This->mapping)
+	{
+		This->mapping = std::make_shared<SharedMemoryMapping> (This->mapping->getFileDescriptor (), size);
+		if(!This->mapping->isValid ())
+			This->mapping.reset ();
+	}
 }
@@ -38,8 +38,85 @@
 
 #include "wayland-server-delegate/waylandresource.h"
 
+#include <wayland-client.h>
+
+#include <memory>
+#include <vector>
+
+#include <sys/types.h>
+
 namespace WaylandServerDelegate {
 
+class BufferCache;
+
+//************************************************************************************************
+// SharedMemoryMapping
+//************************************************************************************************
+
+/** Read-only access to a client shm pool, used to analyze buffer contents.
+ * The client may shrink the file at any time and reading a mapping beyond its end raises SIGBUS,
+ * so only files sealed against shrinking are mapped, others are copied with pread.
+ */
+class SharedMemoryMapping
+{
+public:
+	SharedMemoryMapping (int fd, int32_t size);
+	~SharedMemoryMapping ();
+
+	bool isValid () const { return fd >= 0; }
+	int32_t getSize () const { return size; }
+	int getFileDescriptor () const { return fd; }
+
+	/** Get \a length bytes at \a offset, from the mapping or copied to \a copy.
+	 * Data read from the mapping stays valid as long as the mapping, the file can't shrink.
+	 * Returns nullptr if the range is not (or no longer) backed by the file.
+	 */
+	const uint8_t* read (std::vector<uint8_t>& copy, int32_t offset, int32_t length) const;
+
+private:
+	int fd;
+	uint8_t* data;
+	int32_t size;
+	int32_t mappedSize; // the sealed file may be smaller than the pool
+};
+
+//************************************************************************************************
+// SharedMemoryPool
+//************************************************************************************************
+
+/** Upstream pool shared by all client pools backed by the same file. */
+class SharedMemoryPool
+{
+public:
+	~SharedMemoryPool ();
+
+	static const int kMaxCachedBuffers = 8;
+
+	/** Get the upstream pool for \a fd, shared with other client pools with the same file and \a size. */
+	static std::shared_ptr<SharedMemoryPool> acquire (wl_shm* shm, int fd, int32_t size);
+
+	/** Get an upstream pool of \a size for the file of \a pool, which is grown itself if no other client pool uses it. */
+	static std::shared_ptr<SharedMemoryPool> resize (const std::shared_ptr<SharedMemoryPool>& pool, int32_t size);
+
+	wl_shm_pool* getPool () const { return pool; }
+	const std::shared_ptr<BufferCache>& getBufferCache () const { return bufferCache; }
+
+	/** Create a \a width x \a height buffer in a memfd owned by the server, dispatched on the server queue.
+	 * \a data receives a writable mapping of \a size bytes, which the caller unmaps.
+	 */
+	static wl_buffer* createHostBuffer (int32_t width, int32_t height, uint32_t format, uint8_t*& data, size_t& size);
+
+private:
+	wl_shm_pool* pool;
+	int fd; // kept for resizing a shared pool, -1 if the file couldn't be identified
+	dev_t device;
+	ino_t inode;
+	int32_t size;
+	std::shared_ptr<BufferCache> bufferCache;
+
+	SharedMemoryPool (wl_shm_pool* pool, int32_t size);
+};
+
 //************************************************************************************************
 // SharedMemoryPoolDelegate
 //************************************************************************************************
@@ -48,15 +125,19 @@ class SharedMemoryPoolDelegate: public WaylandResource,
 								public wl_shm_pool_interface
 {
 public:
-	SharedMemoryPoolDelegate (wl_shm_pool* pool);
-	~SharedMemoryPoolDelegate ();
+	SharedMemoryPoolDelegate (const std::shared_ptr<SharedMemoryPool>& pool, int fd, int32_t size);
 
 	static void onDestroy (wl_client* client, wl_resource* resource);
 	static void createBuffer (wl_client* client, wl_resource* resource, uint32_t id, int32_t offset, int32_t width, int32_t height, int32_t stride, uint32_t format);
 	static void onResize (wl_client* client, wl_resource* resource, int32_t size);
 
 protected:
-	wl_shm_pool* pool;
+	/** Create a buffer in a host pool for a \a format the session compositor doesn't support. */
+	static void convertBuffer (wl_client* client, wl_resource* poolResource, uint32_t id, int32_t offset, int32_t width, int32_t height, int32_t stride, uint32_t format);
+
+	std::shared_ptr<SharedMemoryPool> pool;
+	int32_t size; // size of the client pool, the upstream pool may be larger
+	std::shared_ptr<SharedMemoryMapping> mapping;
 };
 
 } // namespace WaylandServerDelegate
@@ -0,0 +1,328 @@
+//************************************************************************************************
+//
+// Wayland Server Delegate
+//
+// Copyright (c) 2023 CCL Software Licensing GmbH. All Rights Reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// - Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// - Neither the name of the wayland-server-delegate project nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS",
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Filename    : surfacecompositor.cpp
+// Description : Subsurface Tree Compositor
+//
+//************************************************************************************************
+
+#include "surfacecompositor.h"
+#include "bufferdelegate.h"
+#include "pixelkernels.h"
+#include "sharedmemorypooldelegate.h"
+#include "waylandserver.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <sys/mman.h>
+
+using namespace WaylandServerDelegate;
+
+//************************************************************************************************
+// SurfaceLayer
+//************************************************************************************************
+
+bool SurfaceLayer::update (const SharedMemoryContent& content, const Region& bufferDamage)
+{
+	if(!content.hasPixels ())
+	{
+		valid = false;
+		return false;
+	}
+
+	// a new size or a layer which doesn't match the upstream content needs a full copy
+	Region area (Rect (0, 0, content.width, content.height));
+	bool resized = !valid || content.width != width || content.height != height;
+	if(!resized)
+		area.intersect (bufferDamage);
+
+	// only the rows of the damaged area are read
+	const Rect& extents = area.getExtents ();
+	const uint8_t* source = nullptr;
+	if(!area.isEmpty ())
+	{
+		source = content.readRows (sourceCopy, extents.top, extents.bottom);
+		if(source == nullptr)
+		{
+			valid = false;
+			return false;
+		}
+	}
+
+	if(resized)
+	{
+		width = content.width;
+		height = content.height;
+		pixels.resize (size_t(width) * height * 4);
+	}
+
+	bool opaque = content.format == WL_SHM_FORMAT_XRGB8888;
+	int32_t stride = getStride ();
+	for(const Rect& rect : area.getRects ())
+		PixelKernels::copyPixels (pixels.data () + size_t(rect.top) * stride + size_t(rect.left) * 4, stride,
+								  source + size_t(rect.top - extents.top) * content.stride + size_t(rect.left) * 4, content.stride,
+								  rect.getWidth (), rect.getHeight (), opaque);
+
+	damage.unite (area);
+	valid = true;
+	mapped = true;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+wl_buffer* SurfaceLayer::createBuffer () const
+{
+	uint8_t* data = nullptr;
+	size_t size = 0;
+	wl_buffer* buffer = SharedMemoryPool::createHostBuffer (width, height, WL_SHM_FORMAT_ARGB8888, data, size);
+	if(buffer == nullptr)
+		return nullptr;
+
+	::memcpy (data, pixels.data (), size);
+	::munmap (data, size);
+	return buffer;
+}
+
+//************************************************************************************************
+// SurfaceCompositor
+//************************************************************************************************
+
+const wl_buffer_listener SurfaceCompositor::bufferListener = { onRelease };
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+SurfaceCompositor::SurfaceCompositor ()
+: state (kCollecting),
+  width (0),
+  height (0)
+{}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+SurfaceCompositor::~SurfaceCompositor ()
+{
+	destroyBuffers ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceCompositor::setState (State newState)
+{
+	state = newState;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceCompositor::addDamage (const Rect& rect)
+{
+	pendingDamage.unite (rect);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool SurfaceCompositor::compose (const std::vector<Item>& items, wl_buffer*& buffer, Region& damage)
+{
+	buffer = nullptr;
+	damage.clear ();
+	if(items.empty () || !items[0].layer->valid || !items[0].layer->mapped)
+		return false;
+
+	const SurfaceLayer& root = *items[0].layer;
+	Rect area (0, 0, root.width, root.height);
+	if(root.width != width || root.height != height)
+	{
+		width = root.width;
+		height = root.height;
+		pendingDamage.unite (area);
+	}
+
+	// moved, resized or (un)mapped layers damage their old and new area
+	for(const Item& item : items)
+	{
+		SurfaceLayer& layer = *item.layer;
+		if(!layer.valid)
+			return false;
+
+		Rect bounds;
+		if(layer.mapped && item.visible)
+			bounds = Rect (item.x, item.y, layer.width, layer.height);
+		if(!bounds.isEmpty () && !area.contains (bounds))
+			return false;
+
+		if(bounds != layer.bounds)
+		{
+			pendingDamage.unite (layer.bounds);
+			pendingDamage.unite (bounds);
+			layer.bounds = bounds;
+		}
+		else
+		{
+			for(const Rect& rect : layer.damage.getRects ())
+				pendingDamage.unite (Rect (rect.left + item.x, rect.top + item.y, rect.getWidth (), rect.getHeight ()));
+		}
+		layer.damage.clear ();
+	}
+
+	pendingDamage.intersect (area);
+	if(pendingDamage.isEmpty ())
+		return true;
+
+	// each buffer is painted where it differs from the current frame, idle ones are reused
+	for(HostBuffer* hostBuffer : buffers)
+		hostBuffer->stale.unite (pendingDamage);
+
+	HostBuffer* target = acquireBuffer ();
+	if(target == nullptr)
+		return false;
+
+	for(const Rect& rect : target->stale.getRects ())
+		paint (*target, items, rect);
+	target->stale.clear ();
+	target->busy = true;
+
+	buffer = target->buffer;
+	damage = pendingDamage;
+	pendingDamage.clear ();
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+SurfaceCompositor::HostBuffer* SurfaceCompositor::acquireBuffer ()
+{
+	HostBuffer* result = nullptr;
+	int idleBuffers = 0;
+	for(auto it = buffers.begin (); it != buffers.end ();)
+	{
+		HostBuffer* hostBuffer = *it;
+		bool idle = !hostBuffer->busy;
+		bool usable = idle && hostBuffer->width == width && hostBuffer->height == height;
+		if(usable && result == nullptr)
+			result = hostBuffer;
+		else if(idle && (!usable || ++idleBuffers >= kMaxBuffers))
+		{
+			destroyBuffer (hostBuffer);
+			it = buffers.erase (it);
+			continue;
+		}
+		++it;
+	}
+	if(result)
+		return result;
+
+	result = createBuffer (width, height);
+	if(result == nullptr)
+		return nullptr;
+
+	result->stale.unite (Rect (0, 0, width, height));
+	buffers.push_back (result);
+	return result;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceCompositor::paint (HostBuffer& target, const std::vector<Item>& items, const Rect& rect) const
+{
+	int32_t stride = target.width * 4;
+	for(size_t i = 0; i < items.size (); i++)
+	{
+		const SurfaceLayer& layer = *items[i].layer;
+		if(layer.bounds.isEmpty ())
+			continue;
+
+		int32_t left = std::max (rect.left, layer.bounds.left);
+		int32_t top = std::max (rect.top, layer.bounds.top);
+		int32_t right = std::min (rect.right, layer.bounds.right);
+		int32_t bottom = std::min (rect.bottom, layer.bounds.bottom);
+		if(left >= right || top >= bottom)
+			continue;
+
+		uint8_t* destination = target.data + size_t(top) * stride + size_t(left) * 4;
+		const uint8_t* source = layer.pixels.data () + size_t(top - layer.bounds.top) * layer.getStride () + size_t(left - layer.bounds.left) * 4;
+
+		// the root layer covers the whole buffer, so the previous content doesn't matter
+		if(i == 0)
+			PixelKernels::copyPixels (destination, stride, source, layer.getStride (), right - left, bottom - top, false);
+		else
+			PixelKernels::blendPixels (destination, stride, source, layer.getStride (), right - left, bottom - top);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceCompositor::destroyBuffers ()
+{
+	for(HostBuffer* hostBuffer : buffers)
+		destroyBuffer (hostBuffer);
+	buffers.clear ();
+	pendingDamage.clear ();
+	width = 0;
+	height = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+SurfaceCompositor::HostBuffer* SurfaceCompositor::createBuffer (int32_t width, int32_t height)
+{
+	HostBuffer* hostBuffer = new HostBuffer;
+	hostBuffer->buffer = SharedMemoryPool::createHostBuffer (width, height, WL_SHM_FORMAT_ARGB8888, hostBuffer->data, hostBuffer->size);
+	if(hostBuffer->buffer == nullptr)
+	{
+		delete hostBuffer;
+		return nullptr;
+	}
+
+	hostBuffer->width = width;
+	hostBuffer->height = height;
+
+	wl_buffer_add_listener (hostBuffer->buffer, &bufferListener, hostBuffer);
+	return hostBuffer;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceCompositor::destroyBuffer (HostBuffer* hostBuffer)
+{
+	wl_buffer_destroy (hostBuffer->buffer);
+	::munmap (hostBuffer->data, hostBuffer->size);
+	delete hostBuffer;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceCompositor::onRelease (void* data, wl_buffer* buffer)
+{
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
+
+	HostBuffer* hostBuffer = static_cast<HostBuffer*> (data);
+	hostBuffer->busy = false;
+}
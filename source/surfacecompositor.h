@@ -0,0 +1,156 @@
+//************************************************************************************************
+//
+// Wayland Server Delegate
+//
+// Copyright (c) 2023 CCL Software Licensing GmbH. All Rights Reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// - Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// - Neither the name of the wayland-server-delegate project nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS",
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Filename    : surfacecompositor.h
+// Description : Subsurface Tree Compositor
+//
+//************************************************************************************************
+
+#ifndef _surfacecompositor_h
+#define _surfacecompositor_h
+
+#include "region.h"
+
+#include <wayland-client.h>
+
+#include <vector>
+
+namespace WaylandServerDelegate {
+
+struct SharedMemoryContent;
+
+//************************************************************************************************
+// SurfaceLayer
+//************************************************************************************************
+
+/** Copy of the content of a surface in a flattened subsurface tree, premultiplied ARGB8888. */
+struct SurfaceLayer
+{
+	std::vector<uint8_t> pixels;
+	int32_t width = 0;
+	int32_t height = 0;
+	bool valid = true; // the pixels match the content applied by the session compositor, which is none initially
+	bool mapped = false;
+	Region damage; // changed since the last composition, in layer coordinates
+	Rect bounds; // area covered in the last composition, in root buffer coordinates
+	std::vector<uint8_t> sourceCopy; // rows read from pools which aren't sealed
+
+	int32_t getStride () const { return width * 4; }
+
+	/** Copy the damaged area of \a content (in buffer coordinates), all of it if the size changed.
+	 * Returns false and invalidates the layer if the content is not a mapped (A|X)RGB8888 shm buffer.
+	 */
+	bool update (const SharedMemoryContent& content, const Region& damage);
+
+	/** Create an upstream buffer with a copy of the pixels, nullptr if the layer is empty. */
+	wl_buffer* createBuffer () const;
+};
+
+//************************************************************************************************
+// SurfaceCompositor
+//************************************************************************************************
+
+/** Composites the layers of a subsurface tree into host-owned shm buffers, which replace the tree upstream.
+ * Only the area damaged since a buffer was last painted is composited again.
+ */
+class SurfaceCompositor
+{
+public:
+	SurfaceCompositor ();
+	~SurfaceCompositor ();
+
+	static const int kMaxBuffers = 3; ///< idle buffers beyond this count are destroyed
+
+	enum State
+	{
+		kCollecting,	///< surfaces are forwarded individually until all layers are valid
+		kActive,		///< the tree is shown as a single buffer attached to the root surface
+		kFallback		///< the tree contains content which can't be flattened, surfaces are forwarded individually
+	};
+
+	State getState () const { return state; }
+	void setState (State state);
+
+	/** Layer of a surface at \a x, \a y in root buffer coordinates, in stacking order starting with the root.
+	 * Layers of surfaces with an unmapped ancestor are not \a visible.
+	 */
+	struct Item
+	{
+		SurfaceLayer* layer;
+		int32_t x;
+		int32_t y;
+		bool visible;
+	};
+
+	/** Add \a rect (in root buffer coordinates) to the area to composite, e.g. because a layer has been removed. */
+	void addDamage (const Rect& rect);
+
+	/** Composite \a items into a host buffer. The root layer (the first item) determines the buffer size, other layers must lie within it.
+	 * \a buffer is set to nullptr if nothing changed, \a damage receives the area changed since the last buffer.
+	 * Returns false if the layers can't be flattened.
+	 */
+	bool compose (const std::vector<Item>& items, wl_buffer*& buffer, Region& damage);
+
+	/** Destroy all buffers, e.g. after switching back to individual surfaces. */
+	void destroyBuffers ();
+
+	// listener
+	static void onRelease (void* data, wl_buffer* buffer);
+
+private:
+	struct HostBuffer
+	{
+		wl_buffer* buffer = nullptr;
+		uint8_t* data = nullptr;
+		size_t size = 0;
+		int32_t width = 0;
+		int32_t height = 0;
+		bool busy = false;
+		Region stale; // area not painted since it changed
+	};
+
+	State state;
+	std::vector<HostBuffer*> buffers;
+	Region pendingDamage;
+	int32_t width;
+	int32_t height;
+
+	static const wl_buffer_listener bufferListener;
+
+	HostBuffer* acquireBuffer ();
+	void paint (HostBuffer& target, const std::vector<Item>& items, const Rect& rect) const;
+
+	static HostBuffer* createBuffer (int32_t width, int32_t height);
+	static void destroyBuffer (HostBuffer* buffer);
+};
+
+} // namespace WaylandServerDelegate
+
+#endif // _surfacecompositor_h
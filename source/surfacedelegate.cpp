@@ -37,10 +37,18 @@
 #include "bufferdelegate.h"
 #include "regiondelegate.h"
 #include "callbackdelegate.h"
+#include "xdgsurfacedelegate.h"
 #include "waylandserver.h"
+#include "pixelkernels.h"
 
 #include "wayland-server-delegate/iwaylandclientcontext.h"
 
+#include "viewporter-client-protocol.h"
+#include "single-pixel-buffer-v1-client-protocol.h"
+
+#include <algorithm>
+#include <cstring>
+
 using namespace WaylandServerDelegate;
 
 //************************************************************************************************
@@ -49,7 +57,29 @@ using namespace WaylandServerDelegate;
 
 SurfaceDelegate::SurfaceDelegate (wl_surface* surface)
 : WaylandResource (&::wl_surface_interface, static_cast<wl_surface_interface*> (this)),
-  surface (surface)
+  surface (surface),
+  pendingBuffer (nullptr),
+  committedBuffer (nullptr),
+  bufferAttached (false),
+  attachX (0),
+  attachY (0),
+  viewport (nullptr),
+  solidBuffer (nullptr),
+  layerBuffer (nullptr),
+  retiredBuffer (nullptr),
+  solidColor (0),
+  solidWidth (0),
+  solidHeight (0),
+  commitPending (false),
+  committed (false),
+  attachedUpstream (false),
+  subSurfaceRole (nullptr),
+  xdgSurfaceRole (nullptr),
+  clientOpaqueRegion (false),
+  infiniteInputRegion (true),
+  compositor (nullptr),
+  cachedBuffer (nullptr),
+  cachedAttach (false)
 {
 	destroy = onDestroy;
 	attach = onAttach;
@@ -82,12 +112,105 @@ SurfaceDelegate::SurfaceDelegate (wl_surface* surface)
 
 SurfaceDelegate::~SurfaceDelegate ()
 {
+	// a destroyed subsurface is unmapped immediately, also in a flattened tree
+	SurfaceDelegate* root = getRoot ();
+	if(root != this && root->isFlattened ())
+		damageLayers (root->compositor);
+
+	if(subSurfaceRole)
+		subSurfaceRole->surfaceDestroyed (this);
+	for(SubSurfaceDelegate* child : children)
+		child->surfaceDestroyed (this);
+	if(xdgSurfaceRole)
+		xdgSurfaceRole->setSurface (nullptr);
+	dropConvertedBuffers ();
+	setBuffer (pendingBuffer, nullptr);
+	setBuffer (committedBuffer, nullptr);
+	setBuffer (cachedBuffer, nullptr);
+	WaylandServer::instance ().getFrameScheduler ().surfaceDestroyed (this);
+
+	if(root != this)
+		root->recomposite ();
+	delete compositor;
+
+	if(solidBuffer)
+		wl_buffer_destroy (solidBuffer);
+	if(layerBuffer)
+		wl_buffer_destroy (layerBuffer);
+	if(retiredBuffer)
+		wl_buffer_destroy (retiredBuffer);
+	if(viewport)
+		wp_viewport_destroy (viewport);
 	if(surface)
 		wl_surface_destroy (surface);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
+void SurfaceDelegate::addChild (SubSurfaceDelegate* child)
+{
+	// new subsurfaces are placed on top of the stack
+	children.push_back (child);
+	if(child->getSurface ())
+		child->getSurface ()->joinTree ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::removeChild (SubSurfaceDelegate* child)
+{
+	auto it = std::find (children.begin (), children.end (), child);
+	if(it == children.end ())
+		return;
+
+	children.erase (it);
+
+	SurfaceDelegate* root = getRoot ();
+	if(child->getSurface () && root->isFlattened ())
+		child->getSurface ()->leaveTree (root);
+	root->recomposite ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::restackChild (SubSurfaceDelegate* child, SurfaceDelegate* sibling, bool above)
+{
+	SubSurfaceDelegate* siblingRole = nullptr;
+	if(sibling != this)
+	{
+		for(SubSurfaceDelegate* candidate : children)
+			if(candidate->getSurface () == sibling)
+				siblingRole = candidate;
+		if(siblingRole == nullptr || siblingRole == child)
+			return;
+	}
+
+	auto it = std::find (children.begin (), children.end (), child);
+	if(it == children.end ())
+		return;
+	children.erase (it);
+
+	// children are stacked bottom to top, the parent is below all of them unless one is placed below it
+	if(siblingRole)
+	{
+		auto position = std::find (children.begin (), children.end (), siblingRole);
+		children.insert (above ? position + 1 : position, child);
+		child->setBelowParent (siblingRole->isBelowParent ());
+	}
+	else
+	{
+		children.insert (children.begin (), child);
+		child->setBelowParent (!above);
+	}
+
+	// the new stacking order is composited when the tree is shown next
+	SurfaceDelegate* root = getRoot ();
+	if(root->compositor && child->getSurface ())
+		child->getSurface ()->damageLayers (root->compositor);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
 void SurfaceDelegate::onDestroy (wl_client* client, wl_resource* resource)
 {
 	wl_resource_destroy (resource);
@@ -97,32 +220,445 @@ void SurfaceDelegate::onDestroy (wl_client* client, wl_resource* resource)
 
 void SurfaceDelegate::onAttach (wl_client* client, wl_resource* resource, wl_resource* buffer, int32_t x, int32_t y)
 {
+	// the attach is forwarded on commit, when it is known whether the buffer is needed upstream
 	SurfaceDelegate* This = cast<SurfaceDelegate> (resource);
-	wl_buffer* bufferHandle = castProxy<wl_buffer> (buffer);
-	if(This->surface && bufferHandle)
+	This->setBuffer (This->pendingBuffer, cast<BufferDelegate> (buffer));
+	This->bufferAttached = true;
+	This->attachX = x;
+	This->attachY = y;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::setBuffer (BufferDelegate*& member, BufferDelegate* buffer)
+{
+	BufferDelegate* oldBuffer = member;
+	member = buffer;
+	if(buffer)
+		buffer->addSurface (this);
+	if(oldBuffer && oldBuffer != pendingBuffer && oldBuffer != committedBuffer && oldBuffer != cachedBuffer &&
+	   std::find (convertedBuffers.begin (), convertedBuffers.end (), oldBuffer) == convertedBuffers.end ())
+		oldBuffer->removeSurface (this);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::bufferDestroyed (BufferDelegate* buffer)
+{
+	// in a flattened tree, the attach is committed as a null buffer, its content is undefined anyway
+	if(pendingBuffer == buffer && bufferAttached && surface && !getRoot ()->isFlattened ())
+	{
+		// forward the attach while the upstream buffer still exists
+		sendAttach ();
+		bufferAttached = false;
+		commitPending = true;
+		contentAnalyzer.reset ();
+		layer.valid = false;
+	}
+	if(pendingBuffer == buffer)
+		pendingBuffer = nullptr;
+	if(committedBuffer == buffer)
 	{
-		#if WL_SURFACE_OFFSET_SINCE_VERSION
-		if(wl_surface_get_version (This->surface) >= WL_SURFACE_OFFSET_SINCE_VERSION)
+		committedBuffer = nullptr;
+		contentAnalyzer.reset ();
+	}
+	if(cachedBuffer == buffer)
+		cachedBuffer = nullptr;
+
+	auto it = std::find (convertedBuffers.begin (), convertedBuffers.end (), buffer);
+	if(it != convertedBuffers.end ())
+		convertedBuffers.erase (it);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::sendAttach ()
+{
+	if(solidBuffer)
+		endSolidColor ();
+	if(pendingBuffer && (pendingBuffer->needsConversion () || !convertedBuffers.empty ()))
+		updateConversions ();
+
+	attachUpstream (pendingBuffer ? pendingBuffer->getBuffer () : nullptr);
+
+	if(pendingBuffer)
+		pendingBuffer->setBusy (true);
+	setBuffer (committedBuffer, pendingBuffer);
+	setBuffer (pendingBuffer, nullptr);
+
+	if(WaylandServer::instance ().getContentObserver ())
+		notifyContentObserver ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::attachUpstream (wl_buffer* buffer)
+{
+	retireBuffer (layerBuffer);
+	attachedUpstream = buffer != nullptr;
+
+	#if WL_SURFACE_OFFSET_SINCE_VERSION
+	if(wl_surface_get_version (surface) >= WL_SURFACE_OFFSET_SINCE_VERSION)
+	{
+		wl_surface_attach (surface, buffer, 0, 0);
+		if(wl_resource_get_version (getResourceHandle ()) < WL_SURFACE_OFFSET_SINCE_VERSION && (attachX != 0 || attachY != 0))
+			wl_surface_offset (surface, attachX, attachY);
+	}
+	else
+	#endif
+	{
+		wl_surface_attach (surface, buffer, attachX, attachY);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool SurfaceDelegate::replaceSolidBuffer ()
+{
+	#ifdef WP_SINGLE_PIXEL_BUFFER_MANAGER_V1_CREATE_U32_RGBA_BUFFER_SINCE_VERSION
+	int optimizations = WaylandServer::instance ().getContentOptimizations ();
+	if((optimizations & IWaylandServer::kReplaceSolidBuffers) == 0 || pendingBuffer == nullptr || pendingBuffer == committedBuffer)
+		return false;
+
+	IWaylandClientContext* context = WaylandServer::instance ().getContext ();
+	wp_single_pixel_buffer_manager_v1* singlePixelBufferManager = context ? context->getSinglePixelBufferManager () : nullptr;
+	wp_viewporter* viewporter = context ? context->getViewporter () : nullptr;
+	if(singlePixelBufferManager == nullptr || viewporter == nullptr)
+		return false;
+
+	const SharedMemoryContent& content = pendingBuffer->getContent ();
+	const uint8_t* pixels = content.hasPixels () ? content.readRows (pixelCopy, 0, 1) : nullptr;
+	if(pixels == nullptr)
+		return false;
+
+	// the viewport destination replaces the surface size derived from buffer size, scale and transform
+	int32_t scale = currentState.scale;
+	if(scale < 1 || content.width % scale != 0 || content.height % scale != 0)
+		return false;
+	int32_t width = content.width / scale;
+	int32_t height = content.height / scale;
+	if(currentState.transform & WL_OUTPUT_TRANSFORM_90)
+		std::swap (width, height);
+
+	// if the surface already shows the same color, only the damaged area needs to be checked
+	uint32_t color = 0;
+	::memcpy (&color, pixels, sizeof(color));
+	Region area (Rect (0, 0, content.width, content.height));
+	if(solidBuffer && color == solidColor && width == solidWidth && height == solidHeight)
+	{
+		Region damage;
+		getBufferDamage (damage, content.width, content.height);
+		area.intersect (damage);
+	}
+
+	// pools which aren't sealed are copied in bands, most buffers differ from the color within the first rows
+	for(const Rect& rect : area.getRects ())
+	{
+		for(int32_t top = rect.top; top < rect.bottom; top += ContentAnalyzer::kTileSize)
 		{
-			wl_surface_attach (This->surface, bufferHandle, 0, 0);
-			if(wl_resource_get_version (This->getResourceHandle ()) < WL_SURFACE_OFFSET_SINCE_VERSION)
-				wl_surface_offset (This->surface, x, y);
+			int32_t bottom = std::min<int32_t> (rect.bottom, top + ContentAnalyzer::kTileSize);
+			pixels = content.readRows (pixelCopy, top, bottom);
+			if(pixels == nullptr || !PixelKernels::isUniform (pixels + size_t(rect.left) * 4, content.stride, rect.getWidth (), bottom - top, color))
+				return false;
 		}
-		else
-		#endif
+	}
+
+	if(viewport == nullptr)
+		viewport = wp_viewporter_get_viewport (viewporter, surface);
+
+	// a single pixel has no valid buffer scale other than 1
+	if(solidBuffer == nullptr)
+	{
+		if(currentState.scale != 1)
+			wl_surface_set_buffer_scale (surface, 1);
+		if(currentState.transform != WL_OUTPUT_TRANSFORM_NORMAL)
+			wl_surface_set_buffer_transform (surface, WL_OUTPUT_TRANSFORM_NORMAL);
+	}
+
+	if(solidBuffer == nullptr || color != solidColor)
+	{
+		// 8 bit channels are expanded to 32 bit, premultiplied alpha is kept
+		uint8_t channels[4];
+		::memcpy (channels, &color, sizeof(channels));
+		uint32_t alpha = content.format == WL_SHM_FORMAT_XRGB8888 ? 0xff : channels[3];
+		wl_buffer* buffer = wp_single_pixel_buffer_manager_v1_create_u32_rgba_buffer (singlePixelBufferManager,
+			channels[2] * 0x01010101U, channels[1] * 0x01010101U, channels[0] * 0x01010101U, alpha * 0x01010101U);
+
+		attachUpstream (buffer);
+		wl_surface_damage_buffer (surface, 0, 0, 1, 1);
+		retireBuffer (solidBuffer);
+		solidBuffer = buffer;
+		solidColor = color;
+	}
+	else if(attachX != 0 || attachY != 0)
+		attachUpstream (solidBuffer);
+
+	if(width != solidWidth || height != solidHeight)
+	{
+		wp_viewport_set_destination (viewport, width, height);
+		solidWidth = width;
+		solidHeight = height;
+	}
+
+	pendingDamage.clear ();
+	pendingBufferDamage.clear ();
+	if(!pendingBuffer->isBusy ())
+		pendingBuffer->release ();
+	setBuffer (pendingBuffer, nullptr);
+	setBuffer (committedBuffer, nullptr);
+	return true;
+	#else
+	return false;
+	#endif
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::endSolidColor ()
+{
+	wp_viewport_set_destination (viewport, -1, -1);
+	if(currentState.scale != 1)
+		wl_surface_set_buffer_scale (surface, currentState.scale);
+	if(currentState.transform != WL_OUTPUT_TRANSFORM_NORMAL)
+		wl_surface_set_buffer_transform (surface, currentState.transform);
+
+	retireBuffer (solidBuffer);
+	solidWidth = 0;
+	solidHeight = 0;
+
+	pendingDamage.unite (Rect (0, 0, INT32_MAX, INT32_MAX));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::retireBuffer (wl_buffer*& buffer)
+{
+	// the session compositor may still read a replaced buffer until the next commit
+	if(buffer == nullptr)
+		return;
+
+	if(retiredBuffer)
+		wl_buffer_destroy (retiredBuffer);
+	retiredBuffer = buffer;
+	buffer = nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool SurfaceDelegate::elideFrame ()
+{
+	int optimizations = WaylandServer::instance ().getContentOptimizations ();
+	if((optimizations & IWaylandServer::kElideIdenticalFrames) == 0 || pendingBuffer == nullptr)
+	{
+		contentAnalyzer.reset ();
+		return false;
+	}
+
+	// the session compositor still uses the committed buffer, it must not be released to the client,
+	// an attach offset moves the surface even if the content is identical
+	if(pendingBuffer == committedBuffer || attachX != 0 || attachY != 0)
+	{
+		contentAnalyzer.reset ();
+		return false;
+	}
+
+	const SharedMemoryContent& content = pendingBuffer->getContent ();
+	Region damage;
+	getBufferDamage (damage, content.width, content.height);
+	if(!contentAnalyzer.compareFrame (content, damage))
+		return false;
+
+	// a buffer still held upstream from an earlier attach is released to the client by onRelease
+	if(!pendingBuffer->isBusy ())
+		pendingBuffer->release ();
+	setBuffer (pendingBuffer, nullptr);
+	pendingDamage.clear ();
+	pendingBufferDamage.clear ();
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::tightenDamage ()
+{
+	int optimizations = WaylandServer::instance ().getContentOptimizations ();
+	if((optimizations & IWaylandServer::kTightenDamage) == 0 || wl_surface_get_version (surface) < WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION)
+		return;
+
+	// the committed buffer still represents the upstream surface content until it is released
+	if(pendingBuffer == nullptr || committedBuffer == nullptr || pendingBuffer == committedBuffer || !committedBuffer->isBusy ())
+		return;
+	if(attachX != 0 || attachY != 0)
+		return;
+
+	const SharedMemoryContent& content = pendingBuffer->getContent ();
+	if(!content.hasPixels ())
+		return;
+
+	Region damage;
+	getBufferDamage (damage, content.width, content.height);
+	contentAnalyzer.tightenDamage (damage, content, committedBuffer->getContent ());
+	pendingDamage.clear ();
+	pendingBufferDamage = damage;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::inferOpaqueRegion ()
+{
+	int optimizations = WaylandServer::instance ().getContentOptimizations ();
+	if((optimizations & IWaylandServer::kInferOpaqueRegion) == 0 || clientOpaqueRegion)
+		return;
+
+	// a null buffer unmaps the surface, the opaque region is left as it is
+	if(pendingBuffer == nullptr)
+	{
+		contentAnalyzer.resetOpacity ();
+		return;
+	}
+
+	// only untransformed buffers are mapped to surface coordinates,
+	// if the opacity is unknown, the client's (empty) opaque region applies
+	Region region;
+	const SharedMemoryContent& content = pendingBuffer->getContent ();
+	Region damage;
+	getBufferDamage (damage, content.width, content.height);
+	if(currentState.transform == WL_OUTPUT_TRANSFORM_NORMAL && contentAnalyzer.analyzeOpacity (content, damage))
+		contentAnalyzer.getOpaqueRegion (region, currentState.scale);
+	else
+		contentAnalyzer.resetOpacity ();
+
+	sendOpaqueRegion (region);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::getBufferDamage (Region& damage, int32_t bufferWidth, int32_t bufferHeight) const
+{
+	damage = pendingBufferDamage;
+	if(pendingDamage.isEmpty ())
+		return;
+
+	if(currentState.transform != WL_OUTPUT_TRANSFORM_NORMAL)
+	{
+		damage.unite (Rect (0, 0, bufferWidth, bufferHeight));
+		return;
+	}
+
+	// surface damage is clamped to the buffer first, whole surface damage (INT32_MAX) would overflow when scaled
+	int32_t scale = std::max<int32_t> (currentState.scale, 1);
+	Rect limit (0, 0, INT32_MAX / scale, INT32_MAX / scale);
+	if(bufferWidth > 0 && bufferHeight > 0)
+		limit = Rect (0, 0, (bufferWidth + scale - 1) / scale, (bufferHeight + scale - 1) / scale);
+
+	Region surfaceDamage (pendingDamage);
+	surfaceDamage.intersect (limit);
+	for(const Rect& rect : surfaceDamage.getRects ())
+		damage.unite (Rect (rect.left * scale, rect.top * scale, rect.getWidth () * scale, rect.getHeight () * scale));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::updateConversions ()
+{
+	// a host copy holds the content of its client buffer when it was last attached,
+	// the damage of all frames committed with other buffers since then is converted with the next attach
+	const SharedMemoryContent& content = pendingBuffer->getContent ();
+	Region damage;
+	getBufferDamage (damage, content.width, content.height);
+	for(BufferDelegate* buffer : convertedBuffers)
+		if(buffer != pendingBuffer)
+			buffer->addConversionDamage (damage);
+
+	if(!pendingBuffer->needsConversion ())
+		return;
+
+	if(std::find (convertedBuffers.begin (), convertedBuffers.end (), pendingBuffer) == convertedBuffers.end ())
+	{
+		// changes made while the buffer was attached to other surfaces are unknown
+		pendingBuffer->invalidateConversion ();
+		if(int(convertedBuffers.size ()) >= kMaxConvertedBuffers)
 		{
-			wl_surface_attach (This->surface, bufferHandle, x, y);
+			BufferDelegate* oldest = convertedBuffers.front ();
+			convertedBuffers.erase (convertedBuffers.begin ());
+			oldest->invalidateConversion ();
+			if(oldest != committedBuffer && oldest != cachedBuffer)
+				oldest->removeSurface (this);
 		}
+		convertedBuffers.push_back (pendingBuffer);
+	}
+	pendingBuffer->convert (damage);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::dropConvertedBuffers ()
+{
+	std::vector<BufferDelegate*> buffers;
+	buffers.swap (convertedBuffers);
+	for(BufferDelegate* buffer : buffers)
+	{
+		buffer->invalidateConversion ();
+		if(buffer != pendingBuffer && buffer != committedBuffer && buffer != cachedBuffer)
+			buffer->removeSurface (this);
 	}
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
+void SurfaceDelegate::notifyContentObserver ()
+{
+	// only shm buffers can be viewed by the host
+	if(committedBuffer && committedBuffer->getContent ().mapping == nullptr)
+		return;
+
+	WaylandServer& server = WaylandServer::instance ();
+	WaylandServer::ClientConnection* connection = server.findClientConnection (clientHandle);
+	if(connection == nullptr)
+		return;
+
+	if(committedBuffer == nullptr)
+	{
+		server.getContentObserver ()->contentUnmapped (connection->clientDisplay, surface);
+		return;
+	}
+
+	// the damage is still pending, it is sent upstream after the attach
+	const SharedMemoryContent& content = committedBuffer->getContent ();
+	Region damage;
+	getBufferDamage (damage, content.width, content.height);
+	damage.intersect (Rect (0, 0, content.width, content.height));
+	if(damage.isEmpty ())
+		return;
+
+	Rect bounds = damage.getExtents ();
+	server.getContentObserver ()->contentChanged (connection->clientDisplay, surface, bounds.left, bounds.top, bounds.getWidth (), bounds.getHeight ());
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
 void SurfaceDelegate::onDamage (wl_client* client, wl_resource* resource, int32_t x, int32_t y, int32_t width, int32_t height)
 {
 	SurfaceDelegate* This = cast<SurfaceDelegate> (resource);
-	if(This->surface)
-		wl_surface_damage (This->surface, x, y, width, height);
+	This->pendingDamage.unite (Rect (x, y, width, height));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool SurfaceDelegate::isHidden (bool* dropPointerMotion) const
+{
+	const SurfaceDelegate* root = this;
+	while(root->subSurfaceRole && root->subSurfaceRole->getParent ())
+		root = root->subSurfaceRole->getParent ();
+
+	if(root->subSurfaceRole)
+	{
+		WaylandServer& server = WaylandServer::instance ();
+		return server.hasHiddenSurfaces () && server.isSurfaceHidden (root->subSurfaceRole->getParentSurface (), dropPointerMotion);
+	}
+	if(root->xdgSurfaceRole)
+		return root->xdgSurfaceRole->isSuspended ();
+	return false;
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -137,12 +673,29 @@ void SurfaceDelegate::requestFrame (wl_client* client, wl_resource* resource, ui
 	}
 
 	SurfaceDelegate* This = cast<SurfaceDelegate> (resource);
-	if(This->surface)
+	if(This->surface == nullptr)
+		return;
+
+	// with a common frame clock, the callback is completed by the frame scheduler without a session compositor object,
+	// callbacks of hidden surfaces are held by the frame scheduler with any clock
+	FrameScheduler& frameScheduler = WaylandServer::instance ().getFrameScheduler ();
+	if(frameScheduler.getClock () != IWaylandServer::kFrameClockPerSurface || This->isHidden ())
 	{
-		wl_callback* callbackHandle = wl_surface_frame (This->surface);
-		WaylandResource* implementation = new CallbackDelegate (callbackHandle);
+		CallbackDelegate* implementation = new CallbackDelegate (nullptr);
 		connection->addResource (implementation, callback);
+		frameScheduler.addCallback (This, implementation);
+		return;
 	}
+
+	// surfaces of a flattened tree are shown by the root surface
+	SurfaceDelegate* root = This->getRoot ();
+	if(!root->isFlattened ())
+		root = This;
+
+	root->commitPending = true;
+	wl_callback* callbackHandle = wl_surface_frame (root->surface);
+	WaylandResource* implementation = new CallbackDelegate (callbackHandle);
+	connection->addResource (implementation, callback);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -150,9 +703,28 @@ void SurfaceDelegate::requestFrame (wl_client* client, wl_resource* resource, ui
 void SurfaceDelegate::setOpaqueRegion (wl_client* client, wl_resource* resource, wl_resource* region)
 {
 	SurfaceDelegate* This = cast<SurfaceDelegate> (resource);
-	wl_region* regionHandle = castProxy<wl_region> (region);
-	if(This->surface && regionHandle)
-		wl_surface_set_opaque_region (This->surface, regionHandle);
+	RegionDelegate* regionDelegate = cast<RegionDelegate> (region);
+	if(This->surface == nullptr)
+		return;
+
+	// a null region resets the opaque region to empty, which is also the initial state
+	This->clientOpaqueRegion = regionDelegate != nullptr;
+	This->sendOpaqueRegion (regionDelegate ? regionDelegate->getRegion () : Region ());
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::sendOpaqueRegion (const Region& region)
+{
+	if(region == opaqueRegion)
+		return;
+
+	opaqueRegion = region;
+	commitPending = true;
+
+	wl_region* upstreamRegion = opaqueRegion.isEmpty () ? nullptr : RegionDelegate::createUpstreamRegion (opaqueRegion);
+	wl_surface_set_opaque_region (surface, upstreamRegion);
+	RegionDelegate::destroyUpstreamRegion (upstreamRegion);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -160,9 +732,41 @@ void SurfaceDelegate::setOpaqueRegion (wl_client* client, wl_resource* resource,
 void SurfaceDelegate::setInputRegion (wl_client* client, wl_resource* resource, wl_resource* region)
 {
 	SurfaceDelegate* This = cast<SurfaceDelegate> (resource);
-	wl_region* regionHandle = castProxy<wl_region> (region);
-	if(This->surface)
-		wl_surface_set_input_region (This->surface, regionHandle);
+	RegionDelegate* regionDelegate = cast<RegionDelegate> (region);
+	if(This->surface == nullptr)
+		return;
+
+	// a null region resets the input region to infinite, which is also the initial state
+	if(regionDelegate == nullptr)
+	{
+		if(This->infiniteInputRegion)
+			return;
+
+		This->infiniteInputRegion = true;
+		This->inputRegion.clear ();
+		This->commitPending = true;
+		if(!This->isFlattened ())
+			wl_surface_set_input_region (This->surface, nullptr);
+		return;
+	}
+
+	if(!This->infiniteInputRegion && regionDelegate->getRegion () == This->inputRegion)
+		return;
+
+	This->infiniteInputRegion = false;
+	This->inputRegion = regionDelegate->getRegion ();
+	This->commitPending = true;
+
+	// the root of a flattened tree receives all input, see PointerDelegate
+	if(This->isFlattened ())
+		return;
+
+	wl_region* upstreamRegion = RegionDelegate::createUpstreamRegion (This->inputRegion);
+	if(upstreamRegion == nullptr)
+		return;
+
+	wl_surface_set_input_region (This->surface, upstreamRegion);
+	RegionDelegate::destroyUpstreamRegion (upstreamRegion);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -170,8 +774,129 @@ void SurfaceDelegate::setInputRegion (wl_client* client, wl_resource* resource,
 void SurfaceDelegate::onCommit (wl_client* client, wl_resource* resource)
 {
 	SurfaceDelegate* This = cast<SurfaceDelegate> (resource);
-	if(This->surface)
-		wl_surface_commit (This->surface);
+	if(This->surface == nullptr)
+		return;
+
+	// state which can't be flattened switches the tree back to individual surfaces
+	SurfaceDelegate* root = This->getRoot ();
+	if(root->isFlattened ())
+	{
+		if(This->commitFlattened (root))
+			return;
+		root->stopFlattening ();
+	}
+	bool collecting = root->compositor && root->compositor->getState () == SurfaceCompositor::kCollecting;
+
+	bool changed = This->sendPendingState ();
+	if(This->bufferAttached)
+	{
+		This->bufferAttached = false;
+		if(collecting)
+			This->updateLayer ();
+		if(!This->elideFrame ())
+		{
+			// buffer scale and transform changes invalidate the comparison with the previous buffer
+			This->inferOpaqueRegion ();
+			if(!This->replaceSolidBuffer ())
+			{
+				if(!changed)
+					This->tightenDamage ();
+				This->sendAttach ();
+			}
+			This->contentAnalyzer.frameForwarded ();
+			changed = true;
+		}
+	}
+	if(This->sendDamage ())
+		changed = true;
+	WaylandServer::instance ().getFrameScheduler ().surfaceCommitted (This);
+
+	// the first commit is always forwarded, it maps xdg surfaces
+	if(!changed && !This->commitPending && This->committed)
+		return;
+
+	This->commitUpstream ();
+
+	// the state of the whole tree has been applied upstream with the commit of the root
+	if(collecting && This == root && !This->children.empty ())
+		This->startFlattening ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::commitUpstream ()
+{
+	commitPending = false;
+	committed = true;
+
+	wl_surface_commit (surface);
+	WaylandServer::instance ().getFlushScheduler ().commitForwarded ();
+
+	if(retiredBuffer)
+	{
+		wl_buffer_destroy (retiredBuffer);
+		retiredBuffer = nullptr;
+	}
+
+	if(xdgSurfaceRole)
+		xdgSurfaceRole->surfaceCommitted ();
+
+	// synchronized subsurface state is applied on the next commit of the parent
+	if(subSurfaceRole && subSurfaceRole->getParent ())
+		subSurfaceRole->getParent ()->markPending ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool SurfaceDelegate::sendPendingState ()
+{
+	// a single-pixel buffer is shown with scale 1 and without transform, see endSolidColor
+	bool changed = false;
+	if(pendingState.scale != currentState.scale)
+	{
+		if(solidBuffer == nullptr)
+			wl_surface_set_buffer_scale (surface, pendingState.scale);
+		changed = true;
+	}
+	if(pendingState.transform != currentState.transform)
+	{
+		if(solidBuffer == nullptr)
+			wl_surface_set_buffer_transform (surface, pendingState.transform);
+		changed = true;
+	}
+	#ifdef WL_SURFACE_OFFSET_SINCE_VERSION
+	if(pendingState.offsetX != 0 || pendingState.offsetY != 0)
+	{
+		wl_surface_offset (surface, pendingState.offsetX, pendingState.offsetY);
+		changed = true;
+	}
+	#endif
+
+	pendingState.offsetX = 0;
+	pendingState.offsetY = 0;
+	currentState = pendingState;
+	return changed;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool SurfaceDelegate::sendDamage ()
+{
+	bool changed = !pendingDamage.isEmpty () || !pendingBufferDamage.isEmpty ();
+
+	if(pendingDamage.countRects () > kMaxDamageRects)
+		pendingDamage = Region (pendingDamage.getExtents ());
+	for(const Rect& rect : pendingDamage.getRects ())
+		wl_surface_damage (surface, rect.left, rect.top, rect.getWidth (), rect.getHeight ());
+	pendingDamage.clear ();
+
+	if(pendingBufferDamage.countRects () > kMaxDamageRects)
+		pendingBufferDamage = Region (pendingBufferDamage.getExtents ());
+	for(const Rect& rect : pendingBufferDamage.getRects ())
+		wl_surface_damage_buffer (surface, rect.left, rect.top, rect.getWidth (), rect.getHeight ());
+	pendingBufferDamage.clear ();
+
+	return changed;
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -179,8 +904,7 @@ void SurfaceDelegate::onCommit (wl_client* client, wl_resource* resource)
 void SurfaceDelegate::setBufferTransform (wl_client* client, wl_resource* resource, int32_t transform)
 {
 	SurfaceDelegate* This = cast<SurfaceDelegate> (resource);
-	if(This->surface)
-		wl_surface_set_buffer_transform (This->surface, transform);
+	This->pendingState.transform = transform;
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -188,8 +912,7 @@ void SurfaceDelegate::setBufferTransform (wl_client* client, wl_resource* resour
 void SurfaceDelegate::setBufferScale (wl_client* client, wl_resource* resource, int32_t scale)
 {
 	SurfaceDelegate* This = cast<SurfaceDelegate> (resource);
-	if(This->surface)
-		wl_surface_set_buffer_scale (This->surface, scale);
+	This->pendingState.scale = scale;
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -197,19 +920,417 @@ void SurfaceDelegate::setBufferScale (wl_client* client, wl_resource* resource,
 void SurfaceDelegate::onDamageBuffer (wl_client* client, wl_resource* resource, int32_t x, int32_t y, int32_t width, int32_t height)
 {
 	SurfaceDelegate* This = cast<SurfaceDelegate> (resource);
-	if(This->surface)
-		wl_surface_damage_buffer (This->surface, x, y, width, height);
+	This->pendingBufferDamage.unite (Rect (x, y, width, height));
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
 void SurfaceDelegate::setOffset (wl_client* client, wl_resource* resource, int32_t x, int32_t y)
 {
-	#ifdef WL_SURFACE_OFFSET_SINCE_VERSION
 	SurfaceDelegate* This = cast<SurfaceDelegate> (resource);
-	if(This->surface)
-		wl_surface_offset (This->surface, x, y);
-	#endif
+	This->pendingState.offsetX = x;
+	This->pendingState.offsetY = y;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+SurfaceDelegate* SurfaceDelegate::getRoot ()
+{
+	SurfaceDelegate* root = this;
+	while(root->subSurfaceRole && root->subSurfaceRole->getParent ())
+		root = root->subSurfaceRole->getParent ();
+	return root;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool SurfaceDelegate::isSynchronized () const
+{
+	// a subsurface is effectively synchronized if any of its ancestors below the root is
+	for(const SurfaceDelegate* current = this; current->subSurfaceRole && current->subSurfaceRole->getParent (); current = current->subSurfaceRole->getParent ())
+		if(current->subSurfaceRole->isSynchronized ())
+			return true;
+	return false;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::joinTree ()
+{
+	// a tree which becomes part of another one is flattened with it or not at all
+	if(compositor)
+	{
+		stopFlattening ();
+		delete compositor;
+		compositor = nullptr;
+	}
+
+	SurfaceDelegate* root = getRoot ();
+	if(root->compositor)
+		invalidateLayers ();
+	else if(WaylandServer::instance ().getContentOptimizations () & IWaylandServer::kFlattenSubsurfaces)
+	{
+		root->compositor = new SurfaceCompositor;
+		root->invalidateLayers ();
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::leaveTree (SurfaceDelegate* root)
+{
+	// the subtree is shown individually again, with the content applied while it was flattened
+	damageLayers (root->compositor);
+	restoreUpstream ();
+	restoreCachedState ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::invalidateLayers ()
+{
+	// content attached upstream before the tree was created is unknown until the next attach
+	layer.valid = !attachedUpstream;
+	for(SubSurfaceDelegate* child : children)
+		if(child->getSurface ())
+			child->getSurface ()->invalidateLayers ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::updateLayer ()
+{
+	if(pendingBuffer == nullptr)
+	{
+		layer.valid = true;
+		layer.mapped = false;
+	}
+	else if(currentState.transform != WL_OUTPUT_TRANSFORM_NORMAL || attachX != 0 || attachY != 0)
+		layer.valid = false;
+	else
+	{
+		const SharedMemoryContent& content = pendingBuffer->getContent ();
+		Region damage;
+		getBufferDamage (damage, content.width, content.height);
+		layer.update (content, damage);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool SurfaceDelegate::collectLayers (std::vector<SurfaceCompositor::Item>& items, int32_t x, int32_t y, int32_t scale, bool visible)
+{
+	// buffer coordinates of all surfaces must map to those of the root
+	if(layer.mapped && (currentState.scale != scale || currentState.transform != WL_OUTPUT_TRANSFORM_NORMAL))
+		return false;
+
+	items.push_back ({ &layer, x, y, visible });
+	for(SubSurfaceDelegate* child : children)
+	{
+		SurfaceDelegate* surfaceDelegate = child->getSurface ();
+		if(surfaceDelegate == nullptr)
+			continue;
+		if(child->isBelowParent ())
+			return false;
+		if(!surfaceDelegate->collectLayers (items, x + child->getX () * scale, y + child->getY () * scale, scale, visible && layer.mapped))
+			return false;
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::damageLayers (SurfaceCompositor* rootCompositor)
+{
+	rootCompositor->addDamage (layer.bounds);
+	layer.bounds = Rect ();
+	for(SubSurfaceDelegate* child : children)
+		if(child->getSurface ())
+			child->getSurface ()->damageLayers (rootCompositor);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::startFlattening ()
+{
+	std::vector<SurfaceCompositor::Item> items;
+	wl_buffer* buffer = nullptr;
+	Region damage;
+	if(!collectLayers (items, 0, 0, currentState.scale, true) || !compositor->compose (items, buffer, damage))
+	{
+		compositor->destroyBuffers ();
+		return;
+	}
+
+	compositor->setState (SurfaceCompositor::kActive);
+	for(SubSurfaceDelegate* child : children)
+		if(child->getSurface ())
+			child->getSurface ()->detachUpstream ();
+
+	// the composition replaces the root content, an inferred opaque region doesn't apply to it
+	if(solidBuffer)
+		endSolidColor ();
+	dropConvertedBuffers ();
+	setBuffer (committedBuffer, nullptr);
+	contentAnalyzer.reset ();
+	if(!clientOpaqueRegion)
+		sendOpaqueRegion (Region ());
+	if(!infiniteInputRegion)
+		wl_surface_set_input_region (surface, nullptr);
+
+	wl_surface_attach (surface, buffer, 0, 0);
+	attachedUpstream = true;
+	sendBufferDamage (damage);
+	commitUpstream ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::stopFlattening ()
+{
+	bool active = isFlattened ();
+	compositor->setState (SurfaceCompositor::kFallback);
+	if(active)
+	{
+		if(!infiniteInputRegion)
+		{
+			wl_region* upstreamRegion = RegionDelegate::createUpstreamRegion (inputRegion);
+			if(upstreamRegion)
+				wl_surface_set_input_region (surface, upstreamRegion);
+			RegionDelegate::destroyUpstreamRegion (upstreamRegion);
+		}
+		restoreUpstream ();
+		restoreCachedState ();
+	}
+	compositor->destroyBuffers ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::recomposite ()
+{
+	if(isFlattened () && !sendComposition ())
+		stopFlattening ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool SurfaceDelegate::sendComposition ()
+{
+	std::vector<SurfaceCompositor::Item> items;
+	wl_buffer* buffer = nullptr;
+	Region damage;
+	if(!collectLayers (items, 0, 0, currentState.scale, true) || !compositor->compose (items, buffer, damage))
+		return false;
+
+	// without changes, only pending role or frame state needs a commit
+	if(buffer)
+	{
+		wl_surface_attach (surface, buffer, 0, 0);
+		attachedUpstream = true;
+		sendBufferDamage (damage);
+	}
+	else if(!commitPending)
+		return true;
+
+	commitUpstream ();
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::sendBufferDamage (Region& damage)
+{
+	// older session compositors only get the whole surface damaged
+	if(wl_surface_get_version (surface) < WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION)
+	{
+		wl_surface_damage (surface, 0, 0, INT32_MAX, INT32_MAX);
+		return;
+	}
+
+	if(damage.countRects () > kMaxDamageRects)
+		damage = Region (damage.getExtents ());
+	for(const Rect& rect : damage.getRects ())
+		wl_surface_damage_buffer (surface, rect.left, rect.top, rect.getWidth (), rect.getHeight ());
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool SurfaceDelegate::commitFlattened (SurfaceDelegate* root)
+{
+	// the layer must map to root buffer coordinates without transformation
+	int32_t scale = root == this ? currentState.scale : root->currentState.scale;
+	if(pendingState.scale != scale || pendingState.transform != WL_OUTPUT_TRANSFORM_NORMAL || pendingState.offsetX != 0 || pendingState.offsetY != 0)
+		return false;
+	if(bufferAttached && (attachX != 0 || attachY != 0))
+		return false;
+	if(bufferAttached && pendingBuffer && !pendingBuffer->getContent ().hasPixels ())
+		return false;
+
+	// the upstream surface keeps the state for switching back to individual surfaces
+	sendPendingState ();
+
+	// like synchronized subsurface state, the commit is cached until the layer is updated
+	if(bufferAttached)
+	{
+		int32_t width = pendingBuffer ? pendingBuffer->getContent ().width : 0;
+		int32_t height = pendingBuffer ? pendingBuffer->getContent ().height : 0;
+		Region damage;
+		getBufferDamage (damage, width, height);
+		cachedDamage.unite (damage);
+
+		if(cachedBuffer && cachedBuffer != pendingBuffer && !cachedBuffer->isBusy ())
+			cachedBuffer->release ();
+		setBuffer (cachedBuffer, pendingBuffer);
+		setBuffer (pendingBuffer, nullptr);
+		cachedAttach = true;
+		bufferAttached = false;
+	}
+	pendingDamage.clear ();
+	pendingBufferDamage.clear ();
+
+	WaylandServer::instance ().getFrameScheduler ().surfaceCommitted (this);
+
+	if(this != root && isSynchronized ())
+		return true;
+
+	applyFlattenedState ();
+	return root->sendComposition ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::applyFlattenedState ()
+{
+	// the client buffer can be reused as soon as it has been copied
+	if(cachedAttach)
+	{
+		if(cachedBuffer)
+		{
+			layer.update (cachedBuffer->getContent (), cachedDamage);
+			if(!cachedBuffer->isBusy ())
+				cachedBuffer->release ();
+			setBuffer (cachedBuffer, nullptr);
+		}
+		else
+			layer.mapped = false;
+
+		cachedAttach = false;
+		cachedDamage.clear ();
+	}
+
+	// cached state of synchronized descendants is applied with their parent
+	for(SubSurfaceDelegate* child : children)
+		if(child->getSurface ())
+			child->getSurface ()->applyFlattenedState ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::detachUpstream ()
+{
+	for(SubSurfaceDelegate* child : children)
+		if(child->getSurface ())
+			child->getSurface ()->detachUpstream ();
+
+	if(solidBuffer)
+		endSolidColor ();
+	retireBuffer (layerBuffer);
+	dropConvertedBuffers ();
+	wl_surface_attach (surface, nullptr, 0, 0);
+	attachedUpstream = false;
+	setBuffer (committedBuffer, nullptr);
+	contentAnalyzer.reset ();
+	commitUpstream ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::restoreUpstream ()
+{
+	// descendants are committed first, their state is applied upstream with the commit of the root
+	for(SubSurfaceDelegate* child : children)
+		if(child->getSurface ())
+			child->getSurface ()->restoreUpstream ();
+
+	retireBuffer (layerBuffer);
+	if(layer.mapped)
+		layerBuffer = layer.createBuffer ();
+	wl_surface_attach (surface, layerBuffer, 0, 0);
+	attachedUpstream = layerBuffer != nullptr;
+	if(layerBuffer)
+		wl_surface_damage (surface, 0, 0, INT32_MAX, INT32_MAX);
+	commitUpstream ();
+
+	layer = SurfaceLayer ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SurfaceDelegate::restoreCachedState ()
+{
+	// state committed to synchronized subsurfaces is applied upstream with the next commit of the parent
+	for(SubSurfaceDelegate* child : children)
+		if(child->getSurface ())
+			child->getSurface ()->restoreCachedState ();
+
+	if(!cachedAttach)
+		return;
+
+	retireBuffer (layerBuffer);
+	wl_surface_attach (surface, cachedBuffer ? cachedBuffer->getBuffer () : nullptr, 0, 0);
+	attachedUpstream = cachedBuffer != nullptr;
+	if(cachedBuffer)
+		cachedBuffer->setBusy (true);
+	setBuffer (committedBuffer, cachedBuffer);
+	setBuffer (cachedBuffer, nullptr);
+	cachedAttach = false;
+
+	sendBufferDamage (cachedDamage);
+	cachedDamage.clear ();
+	commitUpstream ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+SurfaceDelegate* SurfaceDelegate::pickSurface (int32_t x, int32_t y, int32_t& offsetX, int32_t& offsetY)
+{
+	// the topmost child is checked first, each subtree is above its parent
+	for(auto it = children.rbegin (); it != children.rend (); ++it)
+	{
+		SubSurfaceDelegate* child = *it;
+		if(child->getSurface () == nullptr)
+			continue;
+
+		SurfaceDelegate* result = child->getSurface ()->pickSurface (x - child->getX (), y - child->getY (), offsetX, offsetY);
+		if(result)
+		{
+			offsetX += child->getX ();
+			offsetY += child->getY ();
+			return result;
+		}
+	}
+
+	if(layer.bounds.isEmpty ())
+		return nullptr;
+
+	int32_t scale = currentState.scale;
+	if(x < 0 || y < 0 || x >= layer.width / scale || y >= layer.height / scale)
+		return nullptr;
+
+	if(!infiniteInputRegion)
+	{
+		bool inside = false;
+		for(const Rect& rect : inputRegion.getRects ())
+			if(x >= rect.left && x < rect.right && y >= rect.top && y < rect.bottom)
+				inside = true;
+		if(!inside)
+			return nullptr;
+	}
+
+	offsetX = 0;
+	offsetY = 0;
+	return this;
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -218,6 +1339,7 @@ void SurfaceDelegate::onEnter (void* data, wl_surface* surface, wl_output* outpu
 {
 	SurfaceDelegate* This = static_cast<SurfaceDelegate*> (data);
 	WaylandServer& server = WaylandServer::instance ();
+	WaylandServer::ScopedLock scopedLock (server.getLock ());
 	WaylandResource* resource = server.findClientResource (This->clientHandle, reinterpret_cast<wl_proxy*> (output));
 	if(resource)
 		wl_surface_send_enter (This->getResourceHandle (), resource->getResourceHandle ());
@@ -229,6 +1351,7 @@ void SurfaceDelegate::onLeave (void* data, wl_surface* surface, wl_output* outpu
 {
 	SurfaceDelegate* This = static_cast<SurfaceDelegate*> (data);
 	WaylandServer& server = WaylandServer::instance ();
+	WaylandServer::ScopedLock scopedLock (server.getLock ());
 	WaylandResource* resource = server.findClientResource (This->clientHandle, reinterpret_cast<wl_proxy*> (output));
 	if(resource)
 		wl_surface_send_leave (This->getResourceHandle (), resource->getResourceHandle ());
@@ -240,6 +1363,7 @@ void SurfaceDelegate::onPreferredBufferScale (void* data, wl_surface* surface, i
 {
 	#ifdef WL_SURFACE_PREFERRED_BUFFER_SCALE_SINCE_VERSION
 	SurfaceDelegate* This = static_cast<SurfaceDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	if(wl_resource_get_version (This->getResourceHandle ()) >= WL_SURFACE_PREFERRED_BUFFER_SCALE_SINCE_VERSION)
 		wl_surface_send_preferred_buffer_scale (This->getResourceHandle (), factor);
 	#endif
@@ -251,6 +1375,7 @@ void SurfaceDelegate::onPreferredBufferTransform (void* data, wl_surface* surfac
 {
 	#ifdef WL_SURFACE_PREFERRED_BUFFER_TRANSFORM_SINCE_VERSION
 	SurfaceDelegate* This = static_cast<SurfaceDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	if(wl_resource_get_version (This->getResourceHandle ()) >= WL_SURFACE_PREFERRED_BUFFER_TRANSFORM_SINCE_VERSION)
 		wl_surface_send_preferred_buffer_transform (This->getResourceHandle (), transform);
 	#endif
@@ -260,9 +1385,17 @@ void SurfaceDelegate::onPreferredBufferTransform (void* data, wl_surface* surfac
 // SubSurfaceDelegate
 //************************************************************************************************
 
-SubSurfaceDelegate::SubSurfaceDelegate (wl_subsurface* subSurface)
+SubSurfaceDelegate::SubSurfaceDelegate (wl_subsurface* subSurface, SurfaceDelegate* surface, SurfaceDelegate* parent, wl_surface* parentSurface)
 : WaylandResource (&::wl_subsurface_interface, static_cast<wl_subsurface_interface*> (this)),
-  subSurface (subSurface)
+  subSurface (subSurface),
+  surface (surface),
+  parent (parent),
+  parentSurface (parentSurface),
+  x (0),
+  y (0),
+  synchronized (true),
+  held (false),
+  belowParent (false)
 {
 	destroy = onDestroy;
 	set_position = setPosition;
@@ -272,18 +1405,86 @@ SubSurfaceDelegate::SubSurfaceDelegate (wl_subsurface* subSurface)
 	set_desync = setDesync;
 
 	setProxy (reinterpret_cast<wl_proxy*> (subSurface));
+
+	if(surface)
+		surface->setSubSurface (this);
+	if(parent)
+		parent->addChild (this);
+
+	// subsurfaces start in synchronized mode, so there is nothing to send yet
+	held = WaylandServer::instance ().isTransactionOpen (parentSurface);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SubSurfaceDelegate::holdCommits (bool state)
+{
+	if(held == state)
+		return;
+
+	held = state;
+	if(subSurface == nullptr || synchronized)
+		return;
+
+	if(held)
+		wl_subsurface_set_sync (subSurface);
+	else
+		wl_subsurface_set_desync (subSurface);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SubSurfaceDelegate::moveTo (int32_t newX, int32_t newY)
+{
+	if(subSurface == nullptr || (newX == x && newY == y))
+		return;
+
+	x = newX;
+	y = newY;
+	wl_subsurface_set_position (subSurface, x, y);
+	if(parent)
+		parent->markPending ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SubSurfaceDelegate::setSynchronized (bool state)
+{
+	synchronized = state;
+	if(subSurface == nullptr || held)
+		return;
+
+	if(synchronized)
+		wl_subsurface_set_sync (subSurface);
+	else
+		wl_subsurface_set_desync (subSurface);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
 SubSurfaceDelegate::~SubSurfaceDelegate ()
 {
+	if(surface)
+		surface->setSubSurface (nullptr);
+	if(parent)
+		parent->removeChild (this);
+
 	if(subSurface)
 		wl_subsurface_destroy (subSurface);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
+void SubSurfaceDelegate::surfaceDestroyed (SurfaceDelegate* surfaceDelegate)
+{
+	if(surface == surfaceDelegate)
+		surface = nullptr;
+	if(parent == surfaceDelegate)
+		parent = nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
 void SubSurfaceDelegate::onDestroy (wl_client* client, wl_resource* resource)
 {
 	wl_resource_destroy (resource);
@@ -294,8 +1495,14 @@ void SubSurfaceDelegate::onDestroy (wl_client* client, wl_resource* resource)
 void SubSurfaceDelegate::setPosition (wl_client* client, wl_resource* resource, int32_t x, int32_t y)
 {
 	SubSurfaceDelegate* This = cast<SubSurfaceDelegate> (resource);
-	if(This->subSurface)
-		wl_subsurface_set_position (This->subSurface, x, y);
+	if(This->subSurface == nullptr || (x == This->x && y == This->y))
+		return;
+
+	This->x = x;
+	This->y = y;
+	wl_subsurface_set_position (This->subSurface, x, y);
+	if(This->parent)
+		This->parent->markPending ();
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -305,7 +1512,14 @@ void SubSurfaceDelegate::placeAbove (wl_client* client, wl_resource* resource, w
 	SubSurfaceDelegate* This = cast<SubSurfaceDelegate> (resource);
 	wl_surface* siblingSurface = castProxy<wl_surface> (sibling);
 	if(This->subSurface && siblingSurface)
+	{
 		wl_subsurface_place_above (This->subSurface, siblingSurface);
+		if(This->parent)
+		{
+			This->parent->restackChild (This, cast<SurfaceDelegate> (sibling), true);
+			This->parent->markPending ();
+		}
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -315,7 +1529,14 @@ void SubSurfaceDelegate::placeBelow (wl_client* client, wl_resource* resource, w
 	SubSurfaceDelegate* This = cast<SubSurfaceDelegate> (resource);
 	wl_surface* siblingSurface = castProxy<wl_surface> (sibling);
 	if(This->subSurface && siblingSurface)
+	{
 		wl_subsurface_place_below (This->subSurface, siblingSurface);
+		if(This->parent)
+		{
+			This->parent->restackChild (This, cast<SurfaceDelegate> (sibling), false);
+			This->parent->markPending ();
+		}
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -323,7 +1544,8 @@ void SubSurfaceDelegate::placeBelow (wl_client* client, wl_resource* resource, w
 void SubSurfaceDelegate::setSync (wl_client* client, wl_resource* resource)
 {
 	SubSurfaceDelegate* This = cast<SubSurfaceDelegate> (resource);
-	if(This->subSurface)
+	This->synchronized = true;
+	if(This->subSurface && !This->held)
 		wl_subsurface_set_sync (This->subSurface);
 }
 
@@ -332,6 +1554,7 @@ void SubSurfaceDelegate::setSync (wl_client* client, wl_resource* resource)
 void SubSurfaceDelegate::setDesync (wl_client* client, wl_resource* resource)
 {
 	SubSurfaceDelegate* This = cast<SubSurfaceDelegate> (resource);
-	if(This->subSurface)
+	This->synchronized = false;
+	if(This->subSurface && !This->held)
 		wl_subsurface_set_desync (This->subSurface);
 }
@@ -36,12 +36,24 @@
 #ifndef _surfacedelegate_h
 #define _surfacedelegate_h
 
+#include "region.h"
+#include "contentanalyzer.h"
+#include "surfacecompositor.h"
+
 #include "wayland-server-delegate/waylandresource.h"
 
 #include "xdg-shell-client-protocol.h"
 
+#include <vector>
+
+struct wp_viewport;
+
 namespace WaylandServerDelegate {
 
+class BufferDelegate;
+class SubSurfaceDelegate;
+class XdgSurfaceDelegate;
+
 //************************************************************************************************
 // SurfaceDelegate
 //************************************************************************************************
@@ -54,6 +66,40 @@ public:
 	SurfaceDelegate (wl_surface* surface);
 	~SurfaceDelegate ();
 
+	static const int kMaxDamageRects = 32; ///< more damage rectangles are sent as their bounding box
+	static const int kMaxConvertedBuffers = 4; ///< host copies of converted buffers which are updated with damage only
+
+	/** Force the next commit to be forwarded, used for double-buffered state of role objects. */
+	void markPending () { commitPending = true; }
+
+	void setSubSurface (SubSurfaceDelegate* subSurface) { subSurfaceRole = subSurface; }
+	void setXdgSurface (XdgSurfaceDelegate* xdgSurface) { xdgSurfaceRole = xdgSurface; }
+	void addChild (SubSurfaceDelegate* child);
+	void removeChild (SubSurfaceDelegate* child);
+	void bufferDestroyed (BufferDelegate* buffer);
+
+	/** Get the last client buffer forwarded to the session compositor, nullptr if its content has been replaced. */
+	BufferDelegate* getCommittedBuffer () const { return committedBuffer; }
+
+	/** Check if the surface is embedded into a surface hidden by the application or belongs to a suspended toplevel.
+	 * \a dropPointerMotion is set if pointer motion over the surface shouldn't be forwarded.
+	 */
+	bool isHidden (bool* dropPointerMotion = nullptr) const;
+
+	/** Get the topmost surface of the subsurface tree containing this surface. */
+	SurfaceDelegate* getRoot ();
+
+	/** Check if the subsurface tree of this root surface is shown as a single buffer, see IWaylandServer::kFlattenSubsurfaces. */
+	bool isFlattened () const { return compositor && compositor->getState () == SurfaceCompositor::kActive; }
+
+	/** Find the surface of the flattened tree which receives input at \a x, \a y (in surface coordinates of this root).
+	 * \a offsetX and \a offsetY receive its position relative to the root.
+	 */
+	SurfaceDelegate* pickSurface (int32_t x, int32_t y, int32_t& offsetX, int32_t& offsetY);
+
+	/** Move \a child directly above or below \a sibling, which is another child or this surface. */
+	void restackChild (SubSurfaceDelegate* child, SurfaceDelegate* sibling, bool above);
+
 	// interface
 	static void onDestroy (wl_client* client, wl_resource* resource);
 	static void onAttach (wl_client* client, wl_resource* resource, wl_resource* buffer, int32_t x, int32_t y);
@@ -74,20 +120,115 @@ public:
 	static void onPreferredBufferTransform (void* data, wl_surface* surface, uint32_t transform);
 
 private:
+	struct State
+	{
+		int32_t scale = 1;
+		int32_t transform = WL_OUTPUT_TRANSFORM_NORMAL;
+		int32_t offsetX = 0;
+		int32_t offsetY = 0;
+	};
+
 	wl_surface* surface;
+	BufferDelegate* pendingBuffer;
+	BufferDelegate* committedBuffer; // last buffer attached upstream
+	bool bufferAttached;
+	int32_t attachX;
+	int32_t attachY;
+	wp_viewport* viewport;
+	wl_buffer* solidBuffer; // single-pixel buffer attached upstream in place of a solid color client buffer
+	wl_buffer* layerBuffer; // copy of the layer attached upstream when the tree stopped being flattened
+	wl_buffer* retiredBuffer; // host buffer replaced by the last attach, destroyed after the next upstream commit
+	uint32_t solidColor;
+	int32_t solidWidth;
+	int32_t solidHeight;
+	std::vector<uint8_t> pixelCopy; // rows read by replaceSolidBuffer from pools which aren't sealed
+	State pendingState;
+	State currentState; // last state sent upstream, offsets are relative and reset by each commit
+	bool commitPending;
+	bool committed;
+	bool attachedUpstream; // a client buffer or a replacement is attached to the upstream surface
+	SubSurfaceDelegate* subSurfaceRole;
+	XdgSurfaceDelegate* xdgSurfaceRole;
+	std::vector<SubSurfaceDelegate*> children;
+	Region pendingDamage;
+	Region pendingBufferDamage;
+	Region opaqueRegion; // last opaque region sent upstream
+	bool clientOpaqueRegion;
+	Region inputRegion;
+	bool infiniteInputRegion;
+	ContentAnalyzer contentAnalyzer;
+	SurfaceCompositor* compositor; // set for the root of a tree created while kFlattenSubsurfaces was enabled
+	SurfaceLayer layer;
+	BufferDelegate* cachedBuffer; // committed to a flattened tree but not applied yet, like the state of a synchronized subsurface
+	Region cachedDamage;
+	bool cachedAttach;
+	std::vector<BufferDelegate*> convertedBuffers; // attached with a converted format, oldest first
+
+	void setBuffer (BufferDelegate*& member, BufferDelegate* buffer);
+	bool sendPendingState ();
+	void sendAttach ();
+	void attachUpstream (wl_buffer* buffer);
+	bool replaceSolidBuffer ();
+	void endSolidColor ();
+	bool sendDamage ();
+	bool elideFrame ();
+	void tightenDamage ();
+	void inferOpaqueRegion ();
+	void sendOpaqueRegion (const Region& region);
+	void getBufferDamage (Region& damage, int32_t bufferWidth, int32_t bufferHeight) const;
+	void updateConversions ();
+	void dropConvertedBuffers ();
+	void notifyContentObserver ();
+	void retireBuffer (wl_buffer*& buffer);
+	void commitUpstream ();
+
+	bool isSynchronized () const;
+	void joinTree ();
+	void leaveTree (SurfaceDelegate* root);
+	void invalidateLayers ();
+	void updateLayer ();
+	bool collectLayers (std::vector<SurfaceCompositor::Item>& items, int32_t x, int32_t y, int32_t scale, bool visible);
+	void damageLayers (SurfaceCompositor* compositor);
+	void startFlattening ();
+	void stopFlattening ();
+	void recomposite ();
+	bool sendComposition ();
+	void sendBufferDamage (Region& damage);
+	bool commitFlattened (SurfaceDelegate* root);
+	void applyFlattenedState ();
+	void detachUpstream ();
+	void restoreUpstream ();
+	void restoreCachedState ();
 };
 
 //************************************************************************************************
-// SurfaceDelegate
+// SubSurfaceDelegate
 //************************************************************************************************
 
 class SubSurfaceDelegate: public WaylandResource,
 						  public wl_subsurface_interface
 {
 public:
-	SubSurfaceDelegate (wl_subsurface* subSurface);
+	SubSurfaceDelegate (wl_subsurface* subSurface, SurfaceDelegate* surface, SurfaceDelegate* parent, wl_surface* parentSurface);
 	~SubSurfaceDelegate ();
 
+	SurfaceDelegate* getSurface () const { return surface; }
+	SurfaceDelegate* getParent () const { return parent; }
+	wl_surface* getParentSurface () const { return parentSurface; }
+	int32_t getX () const { return x; }
+	int32_t getY () const { return y; }
+	bool isSynchronized () const { return synchronized; }
+	bool isBelowParent () const { return belowParent; }
+	void setBelowParent (bool state) { belowParent = state; }
+	void surfaceDestroyed (SurfaceDelegate* surfaceDelegate);
+
+	/** While commits are held, the subsurface is synchronized upstream regardless of the mode requested by the client. */
+	void holdCommits (bool state);
+
+	/** Used for subsurfaces owned by the delegate, see XdgToplevelDelegate::redirect. */
+	void moveTo (int32_t x, int32_t y);
+	void setSynchronized (bool state);
+
 	// interface
 	static void onDestroy (wl_client* client, wl_resource* resource);
 	static void setPosition (wl_client* client, wl_resource* resource, int32_t x, int32_t y);
@@ -98,6 +239,14 @@ public:
 
 private:
 	wl_subsurface* subSurface;
+	SurfaceDelegate* surface;
+	SurfaceDelegate* parent;
+	wl_surface* parentSurface;
+	int32_t x;
+	int32_t y;
+	bool synchronized; // mode requested by the client
+	bool held;
+	bool belowParent; // placed below the parent surface, which a flattened tree doesn't support
 };
 
 } // namespace WaylandServerDelegate
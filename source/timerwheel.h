@@ -0,0 +1,174 @@
+//************************************************************************************************
+//
+// Wayland Server Delegate
+//
+// Copyright (c) 2023 CCL Software Licensing GmbH. All Rights Reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// - Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// - Neither the name of the wayland-server-delegate project nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS",
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Filename    : timerwheel.h
+// Description : Timer Wheel
+//
+//************************************************************************************************
+
+#ifndef _timerwheel_h
+#define _timerwheel_h
+
+#include <stdint.h>
+#include <vector>
+
+namespace WaylandServerDelegate {
+
+//************************************************************************************************
+// TimerWheel
+//************************************************************************************************
+
+/** Items due at millisecond timestamps, kept in slots of \a kResolution milliseconds indexed by due time.
+ * Adding is constant time. Items due more than kSlots * kResolution milliseconds ahead share slots with earlier ones.
+ */
+template<typename T, int kSlots = 256, uint32_t kResolution = 4>
+class TimerWheel
+{
+public:
+	TimerWheel ()
+	: count (0),
+	  position (0)
+	{}
+
+	bool isEmpty () const { return count == 0; }
+	int countItems () const { return count; }
+
+	/** Add \a item, due at \a due. \a now is the current time. */
+	void add (const T& item, uint32_t due, uint32_t now)
+	{
+		if(count == 0)
+			position = now;
+
+		slots[(due / kResolution) % kSlots].push_back ({ item, due });
+		count++;
+	}
+
+	/** Remove the first entry of \a item, returns false if it wasn't found. */
+	bool remove (const T& item)
+	{
+		for(int i = 0; count > 0 && i < kSlots; i++)
+		{
+			for(auto it = slots[i].begin (); it != slots[i].end (); ++it)
+			{
+				if(it->item == item)
+				{
+					slots[i].erase (it);
+					count--;
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	/** Get the earliest due time, the wheel must not be empty. Items must not be due before the processed time. */
+	uint32_t getNextDue () const
+	{
+		// the slots are visited in order of their due times, starting at the current position,
+		// entries of later turns of the wheel are skipped
+		uint32_t slotTime = position - position % kResolution;
+		for(int i = 0; i < kSlots; i++, slotTime += kResolution)
+		{
+			const std::vector<Entry>& slot = slots[(slotTime / kResolution) % kSlots];
+			bool found = false;
+			uint32_t due = 0;
+			for(const Entry& entry : slot)
+			{
+				if(entry.due - slotTime < kResolution && (!found || int32_t(entry.due - due) < 0))
+				{
+					due = entry.due;
+					found = true;
+				}
+			}
+			if(found)
+				return due;
+		}
+
+		// all items are due after a full turn
+		uint32_t due = position;
+		bool found = false;
+		for(const std::vector<Entry>& slot : slots)
+		{
+			for(const Entry& entry : slot)
+			{
+				if(!found || int32_t(entry.due - due) < 0)
+				{
+					due = entry.due;
+					found = true;
+				}
+			}
+		}
+		return due;
+	}
+
+	/** Remove the items due at \a now and append them to \a dueItems, slot by slot. */
+	void advance (uint32_t now, std::vector<T>& dueItems)
+	{
+		uint32_t slotTime = position - position % kResolution;
+		for(int i = 0; i < kSlots && int32_t(now - slotTime) >= 0; i++, slotTime += kResolution)
+		{
+			std::vector<Entry>& slot = slots[(slotTime / kResolution) % kSlots];
+			for(auto it = slot.begin (); it != slot.end ();)
+			{
+				if(int32_t(now - it->due) >= 0)
+				{
+					dueItems.push_back (it->item);
+					it = slot.erase (it);
+					count--;
+				}
+				else
+					++it;
+			}
+		}
+		position = now;
+	}
+
+	void clear ()
+	{
+		for(std::vector<Entry>& slot : slots)
+			slot.clear ();
+		count = 0;
+	}
+
+private:
+	struct Entry
+	{
+		T item;
+		uint32_t due;
+	};
+
+	std::vector<Entry> slots[kSlots];
+	int count;
+	uint32_t position; // time up to which the wheel has been processed
+};
+
+} // namespace WaylandServerDelegate
+
+#endif // _timerwheel_h
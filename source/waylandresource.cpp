@@ -63,18 +63,10 @@ WaylandResource::~WaylandResource ()
 
 void WaylandResource::wrapProxy ()
 {
-	if(proxyWrapper)
-		wl_proxy_wrapper_destroy (proxyWrapper);
-	proxyWrapper = nullptr;
+	WaylandServer& server = WaylandServer::instance ();
 
-	wl_event_queue* queue = WaylandServer::instance ().getQueue ();
-	if(queue == nullptr)
-		return;
-
-	if(originalProxy)
-		proxyWrapper = static_cast<wl_proxy*> (wl_proxy_create_wrapper (originalProxy));
-	if(proxyWrapper)
-		wl_proxy_set_queue (proxyWrapper, queue);
+	server.releaseProxyWrapper (proxyWrapper);
+	proxyWrapper = server.acquireProxyWrapper (originalProxy, server.getQueue ());
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -100,8 +92,7 @@ void WaylandResource::onDestroy (wl_resource* resource)
 	WaylandResource* This = static_cast<WaylandResource*> (wl_resource_get_user_data (resource));
 	if(This)
 	{
-		if(This->proxyWrapper)
-			wl_proxy_wrapper_destroy (This->proxyWrapper);
+		WaylandServer::instance ().releaseProxyWrapper (This->proxyWrapper);
 		This->proxyWrapper = nullptr;
 
 		wl_resource_set_user_data (resource, nullptr);
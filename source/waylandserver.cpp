@@ -35,7 +35,14 @@
 
 #include "waylandserver.h"
 #include "registrydelegate.h"
-
+#include "dmabufferdelegate.h"
+#include "surfacedelegate.h"
+#include "xdgsurfacedelegate.h"
+#include "bufferdelegate.h"
+#include "sharedmemorypooldelegate.h"
+#include "pixelkernels.h"
+
+#include <algorithm>
 #include <iostream>
 
 #include <errno.h>
@@ -64,7 +71,11 @@ WaylandServer::WaylandServer ()
   contextDisplay (nullptr),
   display (nullptr),
   queue (nullptr),
-  serverEventLoop (nullptr)
+  serverEventLoop (nullptr),
+  activeClients (0),
+  contentOptimizations (0),
+  contentObserver (nullptr),
+  initialized (false)
 {}
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -84,6 +95,8 @@ WaylandServer& WaylandServer::instance ()
 
 int WaylandServer::startup (IWaylandClientContext* clientContext, wl_event_queue* eventQueue)
 {
+	ScopedLock scopedLock (serverLock);
+
 	if(initialized)
 	{
 		std::cerr << "Wayland server is already running." << std::endl;
@@ -105,6 +118,9 @@ int WaylandServer::startup (IWaylandClientContext* clientContext, wl_event_queue
 
 	queue = eventQueue;
 
+	contextDisplay = context->getDisplay ();
+	flushScheduler.setDisplay (contextDisplay);
+
 	RegistryDelegate::instance ().startup ();
 
 	initialized = true;
@@ -116,9 +132,13 @@ int WaylandServer::startup (IWaylandClientContext* clientContext, wl_event_queue
 
 void WaylandServer::shutdown ()
 {
+	ScopedLock scopedLock (serverLock);
+
 	if(!initialized)
 		return;
 
+	frameScheduler.shutdown ();
+
 	if(display)
 	{
 		wl_display_destroy_clients (display);
@@ -128,7 +148,23 @@ void WaylandServer::shutdown ()
 	display = nullptr;
 	queue = nullptr;
 
+	for(ProxyWrapper& entry : proxyWrappers)
+		wl_proxy_wrapper_destroy (entry.wrapper);
+	proxyWrappers.clear ();
+
+	DmaBufferParamsDelegate::destroyCachedBuffers ();
+	sharedMemoryPools.clear ();
+	openTransactions.clear ();
+	hiddenSurfaces.clear ();
+	contentObserver = nullptr;
+
+	flushScheduler.dispatchDone ();
+	flushScheduler.setDisplay (nullptr);
+	contextDisplay = nullptr;
+
+	ConnectionLock connectionScope (connectionLock);
 	connections.clear ();
+	activeClients = 0;
 	
 	initialized = false;
 }
@@ -137,13 +173,19 @@ void WaylandServer::shutdown ()
 
 void WaylandServer::dispatch ()
 {
+	ScopedLock scopedLock (serverLock);
+
 	wl_event_loop_dispatch (serverEventLoop, 0);
+	frameScheduler.dispatchDone ();
+	flushScheduler.dispatchDone ();
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
 void WaylandServer::flush ()
 {
+	ScopedLock scopedLock (serverLock);
+
 	if(display)
 		wl_display_flush_clients (display);
 }
@@ -152,10 +194,12 @@ void WaylandServer::flush ()
 
 WaylandServer::ClientConnection* WaylandServer::findClientConnection (wl_client* client)
 {
-	for(ClientConnection& connection : connections)
+	ConnectionLock connectionScope (connectionLock);
+
+	for(const std::unique_ptr<ClientConnection>& connection : connections)
 	{
-		if(connection.clientHandle == client)
-			return &connection;
+		if(connection->clientHandle == client)
+			return connection.get ();
 	}
 	return nullptr;
 }
@@ -164,10 +208,12 @@ WaylandServer::ClientConnection* WaylandServer::findClientConnection (wl_client*
 
 WaylandServer::ClientConnection* WaylandServer::findClientConnection (wl_display* display)
 {
-	for(ClientConnection& connection : connections)
+	ConnectionLock connectionScope (connectionLock);
+
+	for(const std::unique_ptr<ClientConnection>& connection : connections)
 	{
-		if(connection.clientDisplay == display)
-			return &connection;
+		if(connection->clientDisplay == display)
+			return connection.get ();
 	}
 	return nullptr;
 }
@@ -198,7 +244,7 @@ WaylandResource* WaylandServer::findClientResource (wl_client* client, wl_proxy*
 
 wl_display* WaylandServer::openClientConnection ()
 {
-	if(display == nullptr)
+	if(!initialized)
 		return nullptr;
 
 	ClientConnection connection;
@@ -207,23 +253,31 @@ wl_display* WaylandServer::openClientConnection ()
 
 	::fcntl (connection.fds[0], F_SETFD, FD_CLOEXEC);
 
-	connection.clientHandle = wl_client_create (display, connection.fds[0]);
-	if(connection.clientHandle == nullptr)
+	// The client end only uses libwayland-client, which is thread-safe, so it can be set up without holding the server lock.
+	connection.clientDisplay = wl_display_connect_to_fd (connection.fds[1]);
+	if(connection.clientDisplay == nullptr)
 	{
 		::close (connection.fds[0]);
 		::close (connection.fds[1]);
 		return nullptr;
 	}
 
-	connection.clientDisplay = wl_display_connect_to_fd (connection.fds[1]);
-	if(connection.clientDisplay == nullptr)
+	ScopedLock scopedLock (serverLock);
+
+	if(display)
+		connection.clientHandle = wl_client_create (display, connection.fds[0]);
+	if(connection.clientHandle == nullptr)
 	{
+		wl_display_disconnect (connection.clientDisplay);
 		::close (connection.fds[0]);
-		::close (connection.fds[1]);
 		return nullptr;
 	}
 
-	connections.push_back (connection);
+	{
+		ConnectionLock connectionScope (connectionLock);
+		connections.push_back (std::make_unique<ClientConnection> (connection));
+	}
+	activeClients++;
 
 	flush ();
 
@@ -238,25 +292,36 @@ bool WaylandServer::closeClientConnection (wl_display* display)
 	if(display == nullptr)
 		return false;
 
-	for(auto connection = connections.begin (); connection != connections.end (); connection++)
+	ScopedLock scopedLock (serverLock);
+
+	// the connection stays listed while its resources are destroyed, they remove themselves from it
+	ClientConnection* connection = findClientConnection (display);
+	if(connection == nullptr)
+		return false;
+
+	wl_client_destroy (connection->clientHandle);
+	frameScheduler.clientDestroyed (connection->clientHandle);
+	::close (connection->fds[0]);
+	::close (connection->fds[1]);
+
+	ConnectionLock connectionScope (connectionLock);
+	for(auto it = connections.begin (); it != connections.end (); it++)
 	{
-		if(connection->clientDisplay == display)
+		if(it->get () == connection)
 		{
-			wl_client_destroy (connection->clientHandle);
-			::close (connection->fds[0]);
-			::close (connection->fds[1]);
-			connections.erase (connection);
-			return true;
+			connections.erase (it);
+			break;
 		}
 	}
-	return false;
+	activeClients--;
+	return true;
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
 int WaylandServer::countActiveClients () const
 {
-	return int(connections.size ());
+	return activeClients;
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -270,35 +335,415 @@ wl_proxy* WaylandServer::createProxy (wl_display* display, wl_proxy* object, Way
 		return nullptr;
 	}
 
-	ClientConnection* connection = findClientConnection (display);
-	if(connection == nullptr)
+	wl_proxy* result = wl_proxy_create (reinterpret_cast<wl_proxy*> (display), implementation->getWaylandInterface ());
+	uint32_t id = wl_proxy_get_id (result);
+	uint32_t version = wl_proxy_get_version (object);
+
+	// the proxy only reserves the id on the client end, the resource is created with it directly
+	wl_resource* resource = createResource (display, object, implementation, version, id);
+	if(resource == nullptr)
+	{
+		// libwayland-server only accepts the id after reading the client's earlier requests creating objects,
+		// these are read by a regular dispatch, which takes the lock on its own
+		wl_display_flush (display);
+		dispatch ();
+		resource = createResource (display, object, implementation, version, id);
+	}
+	if(resource == nullptr)
 	{
 		std::cerr << "Failed to create a proxy object: invalid display." << std::endl;
+		wl_proxy_destroy (result);
 		delete implementation;
 		return nullptr;
 	}
 
-	wl_proxy* result = wl_proxy_create (reinterpret_cast<wl_proxy*> (display), implementation->getWaylandInterface ());
-	uint32_t id = wl_proxy_get_id (result);
+	return result;
+}
 
-	wl_display_flush (display);
-	wl_event_loop_dispatch (serverEventLoop, 0);
-	
-	connection->addResource (implementation, wl_proxy_get_version (object), id);
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+wl_resource* WaylandServer::createResource (wl_display* display, wl_proxy* object, WaylandResource* implementation, uint32_t version, uint32_t id)
+{
+	ScopedLock scopedLock (serverLock);
+
+	ClientConnection* connection = findClientConnection (display);
+	if(connection == nullptr)
+		return nullptr;
+
+	wl_resource* resource = wl_resource_create (connection->clientHandle, implementation->getWaylandInterface (), version, id);
+	if(resource == nullptr)
+		return nullptr;
+
+	connection->attachResource (implementation, resource);
 
 	implementation->setProxy (object);
 	implementation->wrapProxy ();
 
-	return result;
+	return resource;
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
 void WaylandServer::destroyProxy (wl_proxy* proxy)
 {
+	// client-side only, no need to lock the server
 	wl_proxy_destroy (proxy);
 }
 
+wl_proxy* WaylandServer::acquireProxyWrapper (wl_proxy* proxy, wl_event_queue* queue)
+{
+	if(proxy == nullptr || queue == nullptr)
+		return nullptr;
+
+	ScopedLock scopedLock (serverLock);
+
+	for(ProxyWrapper& entry : proxyWrappers)
+	{
+		if(entry.proxy == proxy && entry.queue == queue)
+		{
+			entry.useCount++;
+			return entry.wrapper;
+		}
+	}
+
+	wl_proxy* wrapper = static_cast<wl_proxy*> (wl_proxy_create_wrapper (proxy));
+	if(wrapper == nullptr)
+		return nullptr;
+	wl_proxy_set_queue (wrapper, queue);
+
+	proxyWrappers.push_back ({ proxy, queue, wrapper, 1 });
+	return wrapper;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void WaylandServer::releaseProxyWrapper (wl_proxy* wrapper)
+{
+	if(wrapper == nullptr)
+		return;
+
+	ScopedLock scopedLock (serverLock);
+
+	for(auto it = proxyWrappers.begin (); it != proxyWrappers.end (); ++it)
+	{
+		if(it->wrapper == wrapper)
+		{
+			if(--it->useCount <= 0)
+			{
+				wl_proxy_wrapper_destroy (it->wrapper);
+				proxyWrappers.erase (it);
+			}
+			return;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void WaylandServer::setFlushPolicy (FlushPolicy policy)
+{
+	flushScheduler.setPolicy (policy);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void WaylandServer::getFlushStatistics (FlushStatistics& statistics) const
+{
+	flushScheduler.getStatistics (statistics);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool WaylandServer::getBufferStatistics (wl_display* display, BufferStatistics& statistics)
+{
+	ScopedLock scopedLock (serverLock);
+
+	ClientConnection* connection = findClientConnection (display);
+	if(connection == nullptr)
+		return false;
+
+	statistics = connection->bufferStatistics;
+	if(connection->starved)
+		statistics.starvationTime += FrameScheduler::getTimestamp () - connection->starvedSince;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void WaylandServer::beginTransaction (wl_surface* parentSurface)
+{
+	ScopedLock scopedLock (serverLock);
+
+	if(parentSurface == nullptr || isTransactionOpen (parentSurface))
+		return;
+
+	openTransactions.push_back (parentSurface);
+	holdCommits (parentSurface, true);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void WaylandServer::commitTransaction (wl_surface* parentSurface)
+{
+	ScopedLock scopedLock (serverLock);
+
+	auto it = std::find (openTransactions.begin (), openTransactions.end (), parentSurface);
+	if(it == openTransactions.end ())
+		return;
+
+	openTransactions.erase (it);
+	holdCommits (parentSurface, false);
+
+	// called by the host outside of a dispatch, nothing else would flush the released subsurfaces
+	flushScheduler.dispatchDone ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void WaylandServer::setFrameClock (FrameClock clock, wl_surface* hostSurface)
+{
+	ScopedLock scopedLock (serverLock);
+
+	frameScheduler.setClock (clock, hostSurface);
+	flushScheduler.dispatchDone ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void WaylandServer::frameTick (uint32_t time)
+{
+	ScopedLock scopedLock (serverLock);
+
+	if(frameScheduler.getClock () != kFrameClockHost)
+		return;
+
+	frameScheduler.tick (time);
+	flushScheduler.dispatchDone ();
+	if(display)
+		wl_display_flush_clients (display);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void WaylandServer::setFrameRateLimit (wl_display* display, int framesPerSecond)
+{
+	ScopedLock scopedLock (serverLock);
+
+	ClientConnection* connection = findClientConnection (display);
+	if(connection)
+		frameScheduler.setFrameRateLimit (connection->clientHandle, framesPerSecond);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void WaylandServer::setFrameRatePolicy (IFrameRatePolicy* policy)
+{
+	ScopedLock scopedLock (serverLock);
+
+	frameScheduler.setFrameRatePolicy (policy);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void WaylandServer::setSurfacesHidden (wl_surface* parentSurface, bool hidden, bool dropPointerMotion)
+{
+	ScopedLock scopedLock (serverLock);
+
+	if(parentSurface == nullptr)
+		return;
+
+	auto it = hiddenSurfaces.begin ();
+	while(it != hiddenSurfaces.end () && it->parentSurface != parentSurface)
+		++it;
+
+	if(hidden)
+	{
+		if(it != hiddenSurfaces.end ())
+			it->dropPointerMotion = dropPointerMotion;
+		else
+			hiddenSurfaces.push_back ({ parentSurface, dropPointerMotion });
+		return;
+	}
+
+	if(it == hiddenSurfaces.end ())
+		return;
+
+	hiddenSurfaces.erase (it);
+	frameScheduler.releaseHeld ();
+	flushScheduler.dispatchDone ();
+	if(display)
+		wl_display_flush_clients (display);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void WaylandServer::setToplevelRedirection (wl_display* display, wl_surface* parentSurface, xdg_surface* popupParent)
+{
+	ScopedLock scopedLock (serverLock);
+
+	ClientConnection* connection = findClientConnection (display);
+	if(connection == nullptr)
+		return;
+
+	connection->toplevelRedirection.parentSurface = parentSurface;
+	connection->toplevelRedirection.popupParent = parentSurface ? popupParent : nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void WaylandServer::configureRedirectedToplevels (wl_display* display, int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	ScopedLock scopedLock (serverLock);
+
+	ClientConnection* connection = findClientConnection (display);
+	if(connection == nullptr)
+		return;
+
+	ToplevelRedirection& redirection = connection->toplevelRedirection;
+	redirection.x = x;
+	redirection.y = y;
+	redirection.width = width;
+	redirection.height = height;
+
+	for(WaylandResource* resource : connection->resources)
+	{
+		XdgToplevelDelegate* toplevel = dynamic_cast<XdgToplevelDelegate*> (resource);
+		if(toplevel && toplevel->isRedirected ())
+			toplevel->configureRedirection (x, y, width, height);
+	}
+	wl_client_flush (connection->clientHandle);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void WaylandServer::setContentObserver (IContentObserver* observer)
+{
+	ScopedLock scopedLock (serverLock);
+
+	contentObserver = observer;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool WaylandServer::acquireContentView (wl_display* display, wl_surface* surface, ContentView& view)
+{
+	ScopedLock scopedLock (serverLock);
+
+	view = ContentView ();
+
+	ClientConnection* connection = findClientConnection (display);
+	SurfaceDelegate* surfaceDelegate = connection ? dynamic_cast<SurfaceDelegate*> (connection->findResource (reinterpret_cast<wl_proxy*> (surface))) : nullptr;
+	BufferDelegate* buffer = surfaceDelegate ? surfaceDelegate->getCommittedBuffer () : nullptr;
+	if(buffer == nullptr)
+		return false;
+
+	const SharedMemoryContent& content = buffer->getContent ();
+	int32_t rowSize = content.width * PixelKernels::getBytesPerPixel (content.format);
+	if(content.mapping == nullptr || rowSize <= 0 || rowSize > content.stride)
+		return false;
+
+	ContentViewData* viewData = new ContentViewData;
+	const uint8_t* data = content.readRows (viewData->pixels, 0, content.height);
+	if(data == nullptr)
+	{
+		delete viewData;
+		return false;
+	}
+
+	// the client can't shrink a sealed file, so reads of its mapping after the lock is released can't fault
+	if(data != viewData->pixels.data ())
+		viewData->mapping = content.mapping;
+	view.width = content.width;
+	view.height = content.height;
+	view.format = content.format;
+	view.data = data;
+	view.stride = content.stride;
+	view.handle = viewData;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void WaylandServer::releaseContentView (ContentView& view)
+{
+	// a shared mapping is unmapped with its last reference, independent of the pool
+	delete static_cast<ContentViewData*> (view.handle);
+	view = ContentView ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool WaylandServer::scaleContentView (const ContentView& view, uint8_t* destination, int32_t stride, int32_t width, int32_t height)
+{
+	if(view.data == nullptr || (view.format != WL_SHM_FORMAT_ARGB8888 && view.format != WL_SHM_FORMAT_XRGB8888))
+		return false;
+	if(destination == nullptr || width <= 0 || height <= 0 || width > view.width || height > view.height || stride < width * 4)
+		return false;
+
+	PixelKernels::downscalePixels (destination, stride, width, height, view.data, view.stride, view.width, view.height, view.format == WL_SHM_FORMAT_XRGB8888);
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool WaylandServer::isTransactionOpen (wl_surface* parentSurface) const
+{
+	return std::find (openTransactions.begin (), openTransactions.end (), parentSurface) != openTransactions.end ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool WaylandServer::isSurfaceHidden (wl_surface* parentSurface, bool* dropPointerMotion) const
+{
+	for(const HiddenSurface& entry : hiddenSurfaces)
+	{
+		if(entry.parentSurface == parentSurface)
+		{
+			if(dropPointerMotion)
+				*dropPointerMotion = entry.dropPointerMotion;
+			return true;
+		}
+	}
+	return false;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool WaylandServer::isSharedMemoryFormatSupported (uint32_t format) const
+{
+	if(format == WL_SHM_FORMAT_ARGB8888 || format == WL_SHM_FORMAT_XRGB8888)
+		return true;
+
+	// without a list, the format is left to the session compositor
+	int count = context ? context->countSharedMemoryFormats () : 0;
+	if(count == 0)
+		return true;
+
+	for(int i = 0; i < count; i++)
+		if(context->getSharedMemoryFormat (i) == format)
+			return true;
+	return false;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void WaylandServer::holdCommits (wl_surface* parentSurface, bool state)
+{
+	for(const std::unique_ptr<ClientConnection>& connection : connections)
+	{
+		for(WaylandResource* resource : connection->resources)
+		{
+			// redirected toplevels own their subsurface, it isn't a client resource
+			SubSurfaceDelegate* subSurface = dynamic_cast<SubSurfaceDelegate*> (resource);
+			XdgToplevelDelegate* toplevel = dynamic_cast<XdgToplevelDelegate*> (resource);
+			if(toplevel)
+				subSurface = toplevel->getRedirection ();
+			if(subSurface && subSurface->getParentSurface () == parentSurface)
+				subSurface->holdCommits (state);
+		}
+	}
+}
+
 //************************************************************************************************
 // WaylandServer::ClientConnection
 //************************************************************************************************
@@ -306,7 +751,11 @@ void WaylandServer::destroyProxy (wl_proxy* proxy)
 WaylandServer::ClientConnection::ClientConnection ()
 : fds {0},
   clientHandle (nullptr),
-  clientDisplay (nullptr)
+  clientDisplay (nullptr),
+  bufferCount (0),
+  busyBufferCount (0),
+  starved (false),
+  starvedSince (0)
 {}
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -339,9 +788,19 @@ void WaylandServer::ClientConnection::addResource (WaylandResource* implementati
 		return;
 	}
 
+	attachResource (implementation, resource);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void WaylandServer::ClientConnection::attachResource (WaylandResource* implementation, wl_resource* resource)
+{
 	implementation->setResourceHandle (resource);
 	implementation->setClientHandle (clientHandle);
-	resources.push_back (implementation);
+	{
+		ConnectionLock connectionScope (WaylandServer::instance ().getConnectionLock ());
+		resources.push_back (implementation);
+	}
 	wl_resource_set_implementation (resource, implementation->getImplementation (), implementation, WaylandResource::onDestroy);
 	implementation->initialize ();
 }
@@ -350,15 +809,74 @@ void WaylandServer::ClientConnection::addResource (WaylandResource* implementati
 
 void WaylandServer::ClientConnection::removeResource (WaylandResource* implementation)
 {
-	for(auto resource = resources.begin (); resource != resources.end (); resource++)
 	{
-		if((*resource)->getResourceHandle () == implementation->getResourceHandle ())
-		{
-			resources.erase (resource);
-			delete implementation;
+		ConnectionLock connectionScope (WaylandServer::instance ().getConnectionLock ());
+
+		auto resource = resources.begin ();
+		while(resource != resources.end () && (*resource)->getResourceHandle () != implementation->getResourceHandle ())
+			resource++;
+		if(resource == resources.end ())
 			return;
-		}
+		resources.erase (resource);
+	}
+
+	// destructors may look up connections and resources themselves
+	delete implementation;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void WaylandServer::ClientConnection::bufferCreated ()
+{
+	bufferCount++;
+	updateStarvation ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void WaylandServer::ClientConnection::bufferDestroyed (bool busy)
+{
+	bufferCount--;
+	if(busy)
+		busyBufferCount--;
+	updateStarvation ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void WaylandServer::ClientConnection::bufferAttached ()
+{
+	busyBufferCount++;
+	updateStarvation ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void WaylandServer::ClientConnection::bufferReleased (uint32_t attachTime)
+{
+	busyBufferCount--;
+	bufferStatistics.releaseCount++;
+	bufferStatistics.releaseDelay += FrameScheduler::getTimestamp () - attachTime;
+	updateStarvation ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void WaylandServer::ClientConnection::updateStarvation ()
+{
+	bool state = bufferCount > 0 && busyBufferCount >= bufferCount;
+	if(state == starved)
+		return;
+
+	uint32_t now = FrameScheduler::getTimestamp ();
+	if(state)
+	{
+		starvedSince = now;
+		bufferStatistics.starvationCount++;
 	}
+	else
+		bufferStatistics.starvationTime += now - starvedSince;
+	starved = state;
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -367,6 +885,8 @@ WaylandResource* WaylandServer::ClientConnection::findResource (wl_resource* res
 {
 	if(resourceHandle == nullptr)
 		return nullptr;
+
+	ConnectionLock connectionScope (WaylandServer::instance ().getConnectionLock ());
 	for(WaylandResource* resource : resources)
 	{	
 		if(resource->getResourceHandle () == resourceHandle)
@@ -381,6 +901,8 @@ WaylandResource* WaylandServer::ClientConnection::findResource (wl_proxy* proxy)
 {
 	if(proxy == nullptr)
 		return nullptr;
+
+	ConnectionLock connectionScope (WaylandServer::instance ().getConnectionLock ());
 	for(WaylandResource* resource : resources)
 	{	
 		if(resource->getProxy () == proxy || resource->getOriginalProxy () == proxy)
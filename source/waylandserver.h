@@ -36,14 +36,22 @@
 #ifndef _waylandserver_h
 #define _waylandserver_h
 
+#include "flushscheduler.h"
+#include "framescheduler.h"
+
 #include "wayland-server-delegate/iwaylandserver.h"
 #include "wayland-server-delegate/waylandresource.h"
 
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 namespace WaylandServerDelegate {
 
 struct IWaylandClientContext;
+class SharedMemoryMapping;
+class SharedMemoryPool;
 
 //************************************************************************************************
 // WaylandServer
@@ -56,27 +64,59 @@ public:
 
 	static WaylandServer& instance ();
 
+	typedef std::lock_guard<std::recursive_mutex> ScopedLock;
+	typedef std::lock_guard<std::mutex> ConnectionLock;
+
+	struct ToplevelRedirection
+	{
+		wl_surface* parentSurface = nullptr;
+		xdg_surface* popupParent = nullptr;
+		int32_t x = 0;
+		int32_t y = 0;
+		int32_t width = 0;
+		int32_t height = 0;
+	};
+
 	struct ClientConnection
 	{
 		int fds[2];
 		wl_client* clientHandle;
 		wl_display* clientDisplay;
 		std::vector<WaylandResource*> resources;
+		BufferStatistics bufferStatistics;
+		int bufferCount;
+		int busyBufferCount; // buffers held by the session compositor
+		bool starved; // all buffers are busy
+		uint32_t starvedSince;
+		ToplevelRedirection toplevelRedirection;
 
 		ClientConnection ();
 		bool operator == (const ClientConnection& other);
 
 		void addResource (WaylandResource* implementation, uint32_t id);
 		void addResource (WaylandResource* implementation, uint32_t version, uint32_t id);
+		void attachResource (WaylandResource* implementation, wl_resource* resource);
 		void removeResource (WaylandResource* implementation);
 
 		WaylandResource* findResource (wl_resource* resourceHandle);
 		WaylandResource* findResource (wl_proxy* proxy);
+
+		void bufferCreated ();
+		void bufferDestroyed (bool busy);
+		void bufferAttached ();
+		void bufferReleased (uint32_t attachTime);
+		void updateStarvation ();
 	};
 
 	IWaylandClientContext* getContext () const { return context; }
 	wl_display* getDisplay () const { return display; }
 	wl_event_queue* getQueue () const { return queue; }
+	std::recursive_mutex& getLock () { return serverLock; }
+	std::mutex& getConnectionLock () { return connectionLock; }
+	FlushScheduler& getFlushScheduler () { return flushScheduler; }
+	FrameScheduler& getFrameScheduler () { return frameScheduler; }
+	int getContentOptimizations () const { return contentOptimizations; }
+	IContentObserver* getContentObserver () const { return contentObserver; }
 
 	wl_event_loop* getEventLoop () const { return serverEventLoop; }
 	void setEventLoop (wl_event_loop* eventLoop) { serverEventLoop = eventLoop; }
@@ -86,9 +126,15 @@ public:
 	WaylandResource* findClientResource (wl_client* client, wl_resource* resource);
 	WaylandResource* findClientResource (wl_client* client, wl_proxy* proxy);
 
+	wl_proxy* acquireProxyWrapper (wl_proxy* proxy, wl_event_queue* queue);
+	void releaseProxyWrapper (wl_proxy* wrapper);
+
 	int openClientConnectionFd ();
 	void closeClientConnectionFd (int fd);
-	const std::vector<ClientConnection>& getConnections () const { return connections; }
+	const std::vector<std::unique_ptr<ClientConnection>>& getConnections () const { return connections; }
+
+	/** Upstream shm pools of identified files, see SharedMemoryPool::acquire. */
+	std::vector<std::weak_ptr<SharedMemoryPool>>& getSharedMemoryPools () { return sharedMemoryPools; }
 
 	// IWaylandServer
 	int startup (IWaylandClientContext* context, wl_event_queue* queue = nullptr) override;
@@ -101,17 +147,75 @@ public:
 	int countActiveClients () const override;
 	wl_proxy* createProxy (wl_display* display, wl_proxy* object, WaylandResource* implementation) override;
 	void destroyProxy (wl_proxy* proxy) override;
+	void setFlushPolicy (FlushPolicy policy) override;
+	void getFlushStatistics (FlushStatistics& statistics) const override;
+	bool getBufferStatistics (wl_display* display, BufferStatistics& statistics) override;
+	void setContentOptimizations (int optimizations) override { contentOptimizations = optimizations; }
+	void beginTransaction (wl_surface* parentSurface) override;
+	void commitTransaction (wl_surface* parentSurface) override;
+	void setFrameClock (FrameClock clock, wl_surface* hostSurface = nullptr) override;
+	void frameTick (uint32_t time) override;
+	void setFrameRateLimit (wl_display* display, int framesPerSecond) override;
+	void setFrameRatePolicy (IFrameRatePolicy* policy) override;
+	void setSurfacesHidden (wl_surface* parentSurface, bool hidden, bool dropPointerMotion = false) override;
+	void setToplevelRedirection (wl_display* display, wl_surface* parentSurface, xdg_surface* popupParent = nullptr) override;
+	void configureRedirectedToplevels (wl_display* display, int32_t x, int32_t y, int32_t width, int32_t height) override;
+	void setContentObserver (IContentObserver* observer) override;
+	bool acquireContentView (wl_display* display, wl_surface* surface, ContentView& view) override;
+	void releaseContentView (ContentView& view) override;
+	bool scaleContentView (const ContentView& view, uint8_t* destination, int32_t stride, int32_t width, int32_t height) override;
+
+	bool isTransactionOpen (wl_surface* parentSurface) const;
+	bool isSurfaceHidden (wl_surface* parentSurface, bool* dropPointerMotion = nullptr) const;
+	bool hasHiddenSurfaces () const { return !hiddenSurfaces.empty (); }
+
+	/** Check if the session compositor accepts shm buffers in \a format, see IWaylandClientContext::countSharedMemoryFormats. */
+	bool isSharedMemoryFormatSupported (uint32_t format) const;
 
 private:
+	struct ProxyWrapper
+	{
+		wl_proxy* proxy;
+		wl_event_queue* queue;
+		wl_proxy* wrapper;
+		int useCount;
+	};
+
+	struct HiddenSurface
+	{
+		wl_surface* parentSurface;
+		bool dropPointerMotion;
+	};
+
+	struct ContentViewData // referenced by ContentView::handle
+	{
+		std::shared_ptr<SharedMemoryMapping> mapping; // sealed pools only
+		std::vector<uint8_t> pixels; // copy of unsealed pools
+	};
+
 	IWaylandClientContext* context;
 	wl_display* contextDisplay;
 	wl_display* display;
 	wl_event_queue* queue;
 	wl_event_loop* serverEventLoop;
-	std::vector<ClientConnection> connections;
-	bool initialized;
+	std::vector<std::unique_ptr<ClientConnection>> connections; // heap allocated, listeners keep pointers while the list grows
+	std::vector<ProxyWrapper> proxyWrappers; // wrappers shared by all resources using the same proxy and queue
+	std::vector<wl_surface*> openTransactions; // parent surfaces passed to beginTransaction
+	std::vector<HiddenSurface> hiddenSurfaces; // parent surfaces passed to setSurfacesHidden
+	std::vector<std::weak_ptr<SharedMemoryPool>> sharedMemoryPools;
+	FlushScheduler flushScheduler;
+	FrameScheduler frameScheduler;
+	std::atomic<int> activeClients;
+	std::atomic<int> contentOptimizations;
+	IContentObserver* contentObserver;
+	std::recursive_mutex serverLock; // serializes libwayland-server objects: dispatch, upstream listeners and server-side calls
+	std::mutex connectionLock; // guards the connection and resource lists, changes hold both locks, lookups either one
+	std::atomic<bool> initialized;
 
 	WaylandServer ();
+
+	wl_resource* createResource (wl_display* display, wl_proxy* object, WaylandResource* implementation, uint32_t version, uint32_t id);
+	void holdCommits (wl_surface* parentSurface, bool state);
 };
 
 } // namespace WaylandServerDelegate
@@ -46,12 +46,14 @@ using namespace WaylandServerDelegate;
 // XdgSurfaceDelegate
 //************************************************************************************************
 
-XdgSurfaceDelegate::XdgSurfaceDelegate (XdgWindowManagerDelegate* windowManager, xdg_surface* surface)
+XdgSurfaceDelegate::XdgSurfaceDelegate (XdgWindowManagerDelegate* windowManager, xdg_surface* surface, SurfaceDelegate* surfaceDelegate, wl_surface* waylandSurface)
 : WaylandResource (&::xdg_surface_interface, static_cast<xdg_surface_interface*> (this)),
   windowManager (windowManager),
   surface (surface),
+  waylandSurface (waylandSurface),
   popup (nullptr),
-  toplevel (nullptr)
+  toplevel (nullptr),
+  surfaceDelegate (surfaceDelegate)
 {
 	destroy = onDestroy;
 	get_toplevel = getToplevel;
@@ -65,18 +67,83 @@ XdgSurfaceDelegate::XdgSurfaceDelegate (XdgWindowManagerDelegate* windowManager,
 		xdg_surface_add_listener (surface, this, this);
 
 	setProxy (reinterpret_cast<wl_proxy*> (surface));
+
+	if(surfaceDelegate)
+		surfaceDelegate->setXdgSurface (this);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
 XdgSurfaceDelegate::~XdgSurfaceDelegate ()
 {
+	if(surfaceDelegate)
+		surfaceDelegate->setXdgSurface (nullptr);
+	if(toplevel)
+		toplevel->setXdgSurface (nullptr);
+
 	if(surface)
 		xdg_surface_destroy (surface);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
+void XdgSurfaceDelegate::markPending ()
+{
+	if(surfaceDelegate)
+		surfaceDelegate->markPending ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool XdgSurfaceDelegate::isSuspended () const
+{
+	return toplevel && toplevel->isSuspended ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool XdgSurfaceDelegate::isRedirected () const
+{
+	return toplevel && toplevel->isRedirected ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void XdgSurfaceDelegate::createSurface ()
+{
+	if(surface || waylandSurface == nullptr)
+		return;
+
+	surface = windowManager->createXdgSurface (waylandSurface);
+	if(surface == nullptr)
+		return;
+
+	xdg_surface_add_listener (surface, this, this);
+	setProxy (reinterpret_cast<wl_proxy*> (surface));
+
+	if(!windowGeometry.isEmpty ())
+		xdg_surface_set_window_geometry (surface, windowGeometry.left, windowGeometry.top, windowGeometry.getWidth (), windowGeometry.getHeight ());
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void XdgSurfaceDelegate::surfaceCommitted ()
+{
+	// the session compositor would configure the toplevel in response to its initial commit
+	if(toplevel && toplevel->isRedirected () && !toplevel->isConfigured ())
+		toplevel->sendRedirectedConfigure ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void XdgSurfaceDelegate::sendConfigure ()
+{
+	wl_display* display = WaylandServer::instance ().getDisplay ();
+	xdg_surface_send_configure (resourceHandle, wl_display_next_serial (display));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
 void XdgSurfaceDelegate::onDestroy (wl_client* client, wl_resource* resource)
 {
 	wl_resource_destroy (resource);
@@ -94,9 +161,27 @@ void XdgSurfaceDelegate::getToplevel (wl_client* client, wl_resource* resource,
 	}
 
 	XdgSurfaceDelegate* This = cast<XdgSurfaceDelegate> (resource);
+	const WaylandServer::ToplevelRedirection& redirection = connection->toplevelRedirection;
+	IWaylandClientContext* context = WaylandServer::instance ().getContext ();
+	wl_subcompositor* subCompositor = context ? context->getSubCompositor () : nullptr;
+	bool redirected = This->surface == nullptr && redirection.parentSurface && subCompositor;
+	if(!redirected)
+	{
+		This->createSurface (); // redirection has been turned off since the xdg surface was created
+		if(This->surface == nullptr)
+			return;
+	}
+
+	XdgToplevelDelegate* implementation = new XdgToplevelDelegate (This->surface, This);
+	This->toplevel = implementation;
+	connection->addResource (implementation, wl_resource_get_version (resource), id);
+	if(!redirected)
+		return;
 
-	WaylandResource* implementation = new XdgToplevelDelegate (This->surface);
-	connection->addResource (implementation, id);
+	// embedded plug-ins often insist on creating a toplevel, show it as part of the application window instead
+	wl_subsurface* subSurface = wl_subcompositor_get_subsurface (subCompositor, This->waylandSurface, redirection.parentSurface);
+	SubSurfaceDelegate* subSurfaceDelegate = new SubSurfaceDelegate (subSurface, This->surfaceDelegate, nullptr, redirection.parentSurface);
+	implementation->redirect (subSurfaceDelegate, redirection.x, redirection.y, redirection.width, redirection.height);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -111,11 +196,33 @@ void XdgSurfaceDelegate::getPopup (wl_client* client, wl_resource* resource, uin
 	}
 
 	XdgSurfaceDelegate* This = cast<XdgSurfaceDelegate> (resource);
+	This->createSurface ();
+	if(This->surface == nullptr)
+		return;
+
+	XdgSurfaceDelegate* parentDelegate = parent ? cast<XdgSurfaceDelegate> (parent) : nullptr;
+	XdgPositionerDelegate* positionerDelegate = cast<XdgPositionerDelegate> (positioner);
 	xdg_surface* parentSurface = castProxy<xdg_surface> (parent);
-	xdg_positioner* xdgPositioner = castProxy<xdg_positioner> (positioner);
+	xdg_positioner* xdgPositioner = positionerDelegate ? positionerDelegate->getPositioner () : nullptr;
+
+	// popups of redirected toplevels are attached to the application window, the anchor moves with the toplevel
+	bool redirected = parentDelegate && parentDelegate->isRedirected () && xdgPositioner;
+	Rect anchorRect;
+	if(redirected)
+	{
+		parentSurface = connection->toplevelRedirection.popupParent;
+		anchorRect = positionerDelegate->getAnchorRect ();
+		int32_t x = 0;
+		int32_t y = 0;
+		parentDelegate->toplevel->getRedirectedPosition (x, y);
+		xdg_positioner_set_anchor_rect (xdgPositioner, anchorRect.left + x, anchorRect.top + y, anchorRect.getWidth (), anchorRect.getHeight ());
+	}
 
 	WaylandResource* implementation = new XdgPopupDelegate (This->surface, parentSurface, xdgPositioner);
-	connection->addResource (implementation, id);
+	connection->addResource (implementation, wl_resource_get_version (resource), id);
+
+	if(redirected)
+		xdg_positioner_set_anchor_rect (xdgPositioner, anchorRect.left, anchorRect.top, anchorRect.getWidth (), anchorRect.getHeight ());
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -123,8 +230,19 @@ void XdgSurfaceDelegate::getPopup (wl_client* client, wl_resource* resource, uin
 void XdgSurfaceDelegate::setWindowGeometry (wl_client *client, wl_resource *resource, int32_t x, int32_t y, int32_t width, int32_t height)
 {
 	XdgSurfaceDelegate* This = cast<XdgSurfaceDelegate> (resource);
+	if(This->windowGeometry.left == x && This->windowGeometry.top == y
+		&& This->windowGeometry.getWidth () == width && This->windowGeometry.getHeight () == height)
+		return;
+
+	// without an xdg surface upstream, the geometry is sent when it is created or determines the position of the redirected toplevel
+	This->windowGeometry = Rect (x, y, width, height);
 	if(This->surface)
+	{
 		xdg_surface_set_window_geometry (This->surface, x, y, width, height);
+		This->markPending ();
+	}
+	else if(This->toplevel && This->toplevel->isRedirected ())
+		This->toplevel->updateRedirectedPosition ();
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -132,8 +250,13 @@ void XdgSurfaceDelegate::setWindowGeometry (wl_client *client, wl_resource *reso
 void XdgSurfaceDelegate::ackConfigure (wl_client* client, wl_resource* resource, uint32_t serial)
 {
 	XdgSurfaceDelegate* This = cast<XdgSurfaceDelegate> (resource);
+
+	// configure events of redirected toplevels are generated by the delegate, there is nothing to acknowledge upstream
 	if(This->surface)
+	{
 		xdg_surface_ack_configure (This->surface, serial);
+		This->markPending ();
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -141,6 +264,7 @@ void XdgSurfaceDelegate::ackConfigure (wl_client* client, wl_resource* resource,
 void XdgSurfaceDelegate::onConfigure (void* data, xdg_surface* xdg_surface, uint32_t serial)
 {
 	XdgSurfaceDelegate* This = static_cast<XdgSurfaceDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	xdg_surface_send_configure (This->resourceHandle, serial);
 	This->windowManager->sendPing ();
 }
@@ -208,6 +332,7 @@ void XdgPopupDelegate::onReposition (wl_client* client, wl_resource* resource, w
 void XdgPopupDelegate::onConfigure (void* data, xdg_popup* xdg_popup, int32_t x, int32_t y, int32_t width, int32_t height)
 {
 	XdgPopupDelegate* This = static_cast<XdgPopupDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	xdg_popup_send_configure (This->resourceHandle, x, y, width, height);
 }
 
@@ -216,6 +341,7 @@ void XdgPopupDelegate::onConfigure (void* data, xdg_popup* xdg_popup, int32_t x,
 void XdgPopupDelegate::onPopupDone (void* data, xdg_popup* xdg_popup)
 {
 	XdgPopupDelegate* This = static_cast<XdgPopupDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	xdg_popup_send_popup_done (This->resourceHandle);
 }
 
@@ -224,6 +350,7 @@ void XdgPopupDelegate::onPopupDone (void* data, xdg_popup* xdg_popup)
 void XdgPopupDelegate::onRepositioned (void* data, xdg_popup* xdg_popup, uint32_t token)
 {
 	XdgPopupDelegate* This = static_cast<XdgPopupDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	xdg_popup_send_repositioned (This->resourceHandle, token);
 }
 
@@ -231,9 +358,17 @@ void XdgPopupDelegate::onRepositioned (void* data, xdg_popup* xdg_popup, uint32_
 // XdgToplevelDelegate
 //************************************************************************************************
 
-XdgToplevelDelegate::XdgToplevelDelegate (xdg_surface* surface)
+XdgToplevelDelegate::XdgToplevelDelegate (xdg_surface* surface, XdgSurfaceDelegate* xdgSurface)
 : WaylandResource (&::xdg_toplevel_interface, static_cast<xdg_toplevel_interface*> (this)),
-  toplevel (nullptr)
+  toplevel (nullptr),
+  xdgSurface (xdgSurface),
+  suspended (false),
+  redirection (nullptr),
+  redirectX (0),
+  redirectY (0),
+  redirectWidth (0),
+  redirectHeight (0),
+  configured (false)
 {
 	destroy = onDestroy;
 	set_title = setTitle;
@@ -257,7 +392,8 @@ XdgToplevelDelegate::XdgToplevelDelegate (xdg_surface* surface)
 	wm_capabilities = onWindowManagerCapabilities;
 	#endif
 
-	toplevel = xdg_surface_get_toplevel (surface);
+	if(surface)
+		toplevel = xdg_surface_get_toplevel (surface);
 	if(toplevel != nullptr)
 		xdg_toplevel_add_listener (toplevel, this, this);
 
@@ -268,8 +404,89 @@ XdgToplevelDelegate::XdgToplevelDelegate (xdg_surface* surface)
 
 XdgToplevelDelegate::~XdgToplevelDelegate ()
 {
+	if(xdgSurface)
+		xdgSurface->setToplevel (nullptr);
+
+	// frame callbacks held for the suspended toplevel can't be completed while its resource is being destroyed
+	if(suspended)
+		WaylandServer::instance ().getFrameScheduler ().scheduleRelease ();
+
 	if(toplevel)
 		xdg_toplevel_destroy (toplevel);
+
+	delete redirection;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void XdgToplevelDelegate::redirect (SubSurfaceDelegate* subSurface, int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	delete redirection;
+	redirection = subSurface;
+	if(redirection == nullptr)
+		return;
+
+	// the client renders independently of the application surface
+	redirection->setSynchronized (false);
+	configureRedirection (x, y, width, height);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void XdgToplevelDelegate::getRedirectedPosition (int32_t& x, int32_t& y) const
+{
+	x = redirectX;
+	y = redirectY;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void XdgToplevelDelegate::configureRedirection (int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	if(redirection == nullptr)
+		return;
+
+	redirectX = x;
+	redirectY = y;
+	redirectWidth = width;
+	redirectHeight = height;
+	updateRedirectedPosition ();
+
+	// before the initial commit, the size is sent with the first configure event
+	if(configured)
+		sendRedirectedConfigure ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void XdgToplevelDelegate::sendRedirectedConfigure ()
+{
+	if(redirection == nullptr || xdgSurface == nullptr)
+		return;
+
+	wl_array states;
+	wl_array_init (&states);
+	uint32_t* state = static_cast<uint32_t*> (wl_array_add (&states, sizeof(uint32_t)));
+	if(state)
+		*state = XDG_TOPLEVEL_STATE_ACTIVATED;
+
+	xdg_toplevel_send_configure (resourceHandle, redirectWidth, redirectHeight, &states);
+	wl_array_release (&states);
+
+	xdgSurface->sendConfigure ();
+	configured = true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void XdgToplevelDelegate::updateRedirectedPosition ()
+{
+	if(redirection == nullptr || xdgSurface == nullptr)
+		return;
+
+	// place the window geometry, not the surface origin, at the requested position
+	const Rect& geometry = xdgSurface->getWindowGeometry ();
+	redirection->moveTo (redirectX - geometry.left, redirectY - geometry.top);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -333,7 +550,11 @@ void XdgToplevelDelegate::setMaxSize (wl_client* client, wl_resource* resource,
 {
 	XdgToplevelDelegate* This = cast<XdgToplevelDelegate> (resource);
 	if(This->toplevel)
+	{
 		xdg_toplevel_set_max_size (This->toplevel, width, height);
+		if(This->xdgSurface)
+			This->xdgSurface->markPending ();
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -342,7 +563,11 @@ void XdgToplevelDelegate::setMinSize (wl_client* client, wl_resource *resource,
 {
 	XdgToplevelDelegate* This = cast<XdgToplevelDelegate> (resource);
 	if(This->toplevel)
+	{
 		xdg_toplevel_set_min_size (This->toplevel, width, height);
+		if(This->xdgSurface)
+			This->xdgSurface->markPending ();
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -396,7 +621,23 @@ void XdgToplevelDelegate::setMinimized (wl_client* client, wl_resource *resource
 void XdgToplevelDelegate::onConfigure (void* data, xdg_toplevel* xdg_toplevel, int32_t width, int32_t height, wl_array* states)
 {
 	XdgToplevelDelegate* This = static_cast<XdgToplevelDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	xdg_toplevel_send_configure (This->resourceHandle, width, height, states);
+
+	bool suspended = false;
+	#ifdef XDG_TOPLEVEL_STATE_SUSPENDED_SINCE_VERSION
+	const uint32_t* state = static_cast<const uint32_t*> (states->data);
+	for(size_t i = 0; i < states->size / sizeof(uint32_t); i++)
+		if(state[i] == XDG_TOPLEVEL_STATE_SUSPENDED)
+			suspended = true;
+	#endif
+
+	if(suspended == This->suspended)
+		return;
+
+	This->suspended = suspended;
+	if(!suspended)
+		WaylandServer::instance ().getFrameScheduler ().releaseHeld ();
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -404,6 +645,7 @@ void XdgToplevelDelegate::onConfigure (void* data, xdg_toplevel* xdg_toplevel, i
 void XdgToplevelDelegate::onClose (void* data, xdg_toplevel* xdg_toplevel)
 {
 	XdgToplevelDelegate* This = static_cast<XdgToplevelDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	xdg_toplevel_send_close (This->resourceHandle);	
 }
 
@@ -412,6 +654,7 @@ void XdgToplevelDelegate::onClose (void* data, xdg_toplevel* xdg_toplevel)
 void XdgToplevelDelegate::onConfigureBounds (void* data, xdg_toplevel* xdg_toplevel, int32_t width, int32_t height)
 {
 	XdgToplevelDelegate* This = static_cast<XdgToplevelDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	xdg_toplevel_send_configure_bounds (This->resourceHandle, width, height);
 }
 
@@ -421,6 +664,7 @@ void XdgToplevelDelegate::onWindowManagerCapabilities (void* data, xdg_toplevel*
 {
 	#ifdef XDG_TOPLEVEL_WM_CAPABILITIES_SINCE_VERSION
 	XdgToplevelDelegate* This = static_cast<XdgToplevelDelegate*> (data);
+	WaylandServer::ScopedLock scopedLock (WaylandServer::instance ().getLock ());
 	if(wl_resource_get_version (This->getResourceHandle ()) >= XDG_TOPLEVEL_WM_CAPABILITIES_SINCE_VERSION)
 		xdg_toplevel_send_wm_capabilities (This->resourceHandle, capabilities);
 	#endif
@@ -482,6 +726,7 @@ void XdgPositionerDelegate::setSize (wl_client* client, wl_resource* resource, i
 void XdgPositionerDelegate::setAnchorRect (wl_client* client, wl_resource* resource, int32_t x, int32_t y, int32_t width, int32_t height)
 {
 	XdgPositionerDelegate* This = cast<XdgPositionerDelegate> (resource);
+	This->anchorRect = Rect (x, y, width, height);
 	if(This->positioner)
 		xdg_positioner_set_anchor_rect (This->positioner, x, y, width, height);
 }
@@ -36,6 +36,8 @@
 #ifndef _xdgsurfacedelegate_h
 #define _xdgsurfacedelegate_h
 
+#include "region.h"
+
 #include "wayland-server-delegate/waylandresource.h"
 
 #include "xdg-shell-server-protocol.h"
@@ -43,6 +45,8 @@
 
 namespace WaylandServerDelegate {
 
+class SurfaceDelegate;
+class SubSurfaceDelegate;
 class XdgPopupDelegate;
 class XdgToplevelDelegate;
 class XdgWindowManagerDelegate;
@@ -56,9 +60,23 @@ class XdgSurfaceDelegate: public WaylandResource,
 						  public xdg_surface_listener
 {
 public:
-	XdgSurfaceDelegate (XdgWindowManagerDelegate* windowManager, xdg_surface* surface);
+	/** \a surface is nullptr while the toplevels of the client are redirected, it is created on demand for popups. */
+	XdgSurfaceDelegate (XdgWindowManagerDelegate* windowManager, xdg_surface* surface, SurfaceDelegate* surfaceDelegate, wl_surface* waylandSurface);
 	~XdgSurfaceDelegate ();
 
+	void setSurface (SurfaceDelegate* surfaceDelegate) { this->surfaceDelegate = surfaceDelegate; }
+	void setToplevel (XdgToplevelDelegate* toplevelDelegate) { toplevel = toplevelDelegate; }
+	void markPending ();
+	bool isSuspended () const;
+	bool isRedirected () const;
+	const Rect& getWindowGeometry () const { return windowGeometry; }
+
+	/** Called after each commit of the wl_surface, sends the initial configure event of redirected toplevels. */
+	void surfaceCommitted ();
+
+	/** Send a configure event generated by the delegate. */
+	void sendConfigure ();
+
 	// interface
 	static void onDestroy (wl_client* client, wl_resource* resource);
 	static void getToplevel (wl_client* client, wl_resource* resource, uint32_t id);
@@ -71,9 +89,14 @@ public:
 
 private:
 	xdg_surface* surface;
+	wl_surface* waylandSurface;
 	XdgPopupDelegate* popup;
 	XdgToplevelDelegate* toplevel;
 	XdgWindowManagerDelegate* windowManager;
+	SurfaceDelegate* surfaceDelegate;
+	Rect windowGeometry;
+
+	void createSurface ();
 };
 
 //************************************************************************************************
@@ -111,9 +134,24 @@ class XdgToplevelDelegate: public WaylandResource,
 						   public xdg_toplevel_listener
 {
 public:
-	XdgToplevelDelegate (xdg_surface* surface);
+	XdgToplevelDelegate (xdg_surface* surface, XdgSurfaceDelegate* xdgSurface);
 	~XdgToplevelDelegate ();
 
+	void setXdgSurface (XdgSurfaceDelegate* xdgSurfaceDelegate) { xdgSurface = xdgSurfaceDelegate; }
+	bool isSuspended () const { return suspended; }
+
+	/** Back the toplevel by \a subSurface, a subsurface of an application surface, instead of a session compositor window.
+	 * The toplevel takes ownership of \a subSurface. Configure events are generated by the delegate.
+	 */
+	void redirect (SubSurfaceDelegate* subSurface, int32_t x, int32_t y, int32_t width, int32_t height);
+	bool isRedirected () const { return redirection != nullptr; }
+	void getRedirectedPosition (int32_t& x, int32_t& y) const;
+	SubSurfaceDelegate* getRedirection () const { return redirection; }
+	void configureRedirection (int32_t x, int32_t y, int32_t width, int32_t height);
+	void sendRedirectedConfigure ();
+	void updateRedirectedPosition ();
+	bool isConfigured () const { return configured; }
+
 	// interface
 	static void onDestroy (wl_client* client, wl_resource* resource);
 	static void setTitle (wl_client* client, wl_resource* resource, const char* title);
@@ -137,6 +175,14 @@ public:
 
 private:
 	xdg_toplevel* toplevel;
+	XdgSurfaceDelegate* xdgSurface;
+	bool suspended; // the session compositor doesn't show the toplevel, e.g. because it is minimized or occluded
+	SubSurfaceDelegate* redirection;
+	int32_t redirectX; // position of the window geometry relative to the parent surface
+	int32_t redirectY;
+	int32_t redirectWidth;
+	int32_t redirectHeight;
+	bool configured;
 };
 
 //************************************************************************************************
@@ -161,8 +207,12 @@ public:
 	static void setParentSize (wl_client* client, wl_resource* resource, int32_t parentWidth, int32_t parentHeight);
 	static void setParentConfigure (wl_client* client, wl_resource* resource, uint32_t serial);
 
+	xdg_positioner* getPositioner () const { return positioner; }
+	const Rect& getAnchorRect () const { return anchorRect; }
+
 private:
 	xdg_positioner* positioner;
+	Rect anchorRect;
 };
 
 } // namespace WaylandServerDelegate
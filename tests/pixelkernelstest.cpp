@@ -0,0 +1,424 @@
+//************************************************************************************************
+//
+// Wayland Server Delegate
+//
+// Copyright (c) 2023 CCL Software Licensing GmbH. All Rights Reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// - Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// - Neither the name of the wayland-server-delegate project nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS",
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Filename    : pixelkernelstest.cpp
+// Description : Pixel Kernel Tests
+//
+//************************************************************************************************
+
+#include "testing.h"
+
+// the kernel variants are static, so the implementation is compiled into the test
+#include "pixelkernels.cpp"
+
+#include <vector>
+
+using namespace Testing;
+
+static Random generator;
+
+// buffers are offset by a few bytes, so that vector loads are unaligned
+static const int kMaxOffset = 15;
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool hasAVX2 ()
+{
+	return getSimdLevel () == kAVX2;
+}
+
+//************************************************************************************************
+// Hash
+//************************************************************************************************
+
+static void checkHash (const char* name, HashFunction function)
+{
+	std::vector<uint8_t> buffer (16 * 320 + kMaxOffset);
+	for(int iteration = 0; iteration < 2000; iteration++)
+	{
+		generator.fill (buffer.data (), buffer.size ());
+		const uint8_t* data = buffer.data () + generator.range (0, kMaxOffset);
+		int32_t rowBytes = iteration < 300 ? iteration : generator.range (0, 300);
+		int32_t stride = rowBytes + generator.range (0, 20);
+		int32_t rows = generator.range (1, 16);
+
+		if(!CHECK (function (data, stride, rowBytes, rows) == hashPixelsScalar (data, stride, rowBytes, rows)))
+		{
+			std::cerr << name << ": rowBytes " << rowBytes << ", rows " << rows << std::endl;
+			return;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void testHash ()
+{
+	#if PIXELKERNELS_X86
+	checkHash ("SSE2", hashPixelsSSE2);
+	if(hasAVX2 ())
+		checkHash ("AVX2", hashPixelsAVX2);
+	#elif PIXELKERNELS_NEON
+	checkHash ("NEON", hashPixelsNEON);
+	#endif
+
+	// swapped rows must change the hash
+	std::vector<uint8_t> buffer (2 * 64);
+	generator.fill (buffer.data (), buffer.size ());
+	uint64_t hash = PixelKernels::hashPixels (buffer.data (), 64, 64, 2);
+	std::vector<uint8_t> swapped (buffer.begin () + 64, buffer.end ());
+	swapped.insert (swapped.end (), buffer.begin (), buffer.begin () + 64);
+	CHECK (PixelKernels::hashPixels (swapped.data (), 64, 64, 2) != hash);
+}
+
+//************************************************************************************************
+// Row Comparison
+//************************************************************************************************
+
+static void checkRowsEqual (const char* name, CompareFunction function)
+{
+	std::vector<uint8_t> a (400 + kMaxOffset);
+	std::vector<uint8_t> b (400 + kMaxOffset);
+	for(int iteration = 0; iteration < 4000; iteration++)
+	{
+		int32_t count = iteration < 400 ? iteration : generator.range (0, 400);
+		uint8_t* first = a.data () + generator.range (0, kMaxOffset);
+		uint8_t* second = b.data () + generator.range (0, kMaxOffset);
+		generator.fill (first, size_t(count));
+		::memcpy (second, first, size_t(count));
+
+		// change a single byte in half of the cases
+		if(count > 0 && generator.next () % 2)
+			second[generator.range (0, count - 1)] ^= uint8_t(generator.range (1, 255));
+
+		if(!CHECK (function (first, second, count) == rowsEqualScalar (first, second, count)))
+		{
+			std::cerr << name << ": count " << count << std::endl;
+			return;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void testRowComparison ()
+{
+	#if PIXELKERNELS_X86
+	checkRowsEqual ("SSE2", rowsEqualSSE2);
+	if(hasAVX2 ())
+		checkRowsEqual ("AVX2", rowsEqualAVX2);
+	#elif PIXELKERNELS_NEON
+	checkRowsEqual ("NEON", rowsEqualNEON);
+	#endif
+
+	const int32_t kRowBytes = 100;
+	const int32_t kRows = 10;
+	std::vector<uint8_t> data (kRowBytes * kRows);
+	generator.fill (data.data (), data.size ());
+	std::vector<uint8_t> previous (data);
+	int32_t firstRow = -1;
+	int32_t lastRow = -1;
+	CHECK (!PixelKernels::findChangedRows (data.data (), kRowBytes, previous.data (), kRowBytes, kRowBytes, kRows, firstRow, lastRow));
+
+	data[3 * kRowBytes + 99]++;
+	data[7 * kRowBytes]++;
+	CHECK (PixelKernels::findChangedRows (data.data (), kRowBytes, previous.data (), kRowBytes, kRowBytes, kRows, firstRow, lastRow));
+	CHECK (firstRow == 3 && lastRow == 7);
+}
+
+//************************************************************************************************
+// Alpha
+//************************************************************************************************
+
+static void checkRowIsOpaque (const char* name, AlphaFunction function)
+{
+	std::vector<uint8_t> buffer (4 * 100 + kMaxOffset);
+	for(int iteration = 0; iteration < 4000; iteration++)
+	{
+		int32_t width = iteration < 100 ? iteration : generator.range (0, 100);
+		uint8_t* row = buffer.data () + generator.range (0, kMaxOffset);
+		generator.fill (row, size_t(width) * 4);
+		for(int32_t x = 0; x < width; x++)
+			row[x * 4 + 3] = 0xff;
+
+		// make a single pixel translucent in half of the cases
+		if(width > 0 && generator.next () % 2)
+			row[generator.range (0, width - 1) * 4 + 3] = uint8_t(generator.range (0, 254));
+
+		if(!CHECK (function (row, width) == rowIsOpaqueScalar (row, width)))
+		{
+			std::cerr << name << ": width " << width << std::endl;
+			return;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void testAlpha ()
+{
+	#if PIXELKERNELS_X86
+	checkRowIsOpaque ("SSE2", rowIsOpaqueSSE2);
+	if(hasAVX2 ())
+		checkRowIsOpaque ("AVX2", rowIsOpaqueAVX2);
+	#elif PIXELKERNELS_NEON
+	checkRowIsOpaque ("NEON", rowIsOpaqueNEON);
+	#endif
+}
+
+//************************************************************************************************
+// Uniform Color
+//************************************************************************************************
+
+static void checkRowIsUniform (const char* name, UniformFunction function)
+{
+	std::vector<uint8_t> buffer (4 * 100 + kMaxOffset);
+	for(int iteration = 0; iteration < 4000; iteration++)
+	{
+		int32_t width = iteration < 100 ? iteration : generator.range (0, 100);
+		uint8_t* row = buffer.data () + generator.range (0, kMaxOffset);
+		uint32_t pixel = generator.next ();
+		for(int32_t x = 0; x < width; x++)
+			::memcpy (row + x * 4, &pixel, 4);
+
+		// change a single byte in half of the cases
+		if(width > 0 && generator.next () % 2)
+			row[generator.range (0, width * 4 - 1)] ^= uint8_t(generator.range (1, 255));
+
+		if(!CHECK (function (row, width, pixel) == rowIsUniformScalar (row, width, pixel)))
+		{
+			std::cerr << name << ": width " << width << std::endl;
+			return;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void testUniformColor ()
+{
+	#if PIXELKERNELS_X86
+	checkRowIsUniform ("SSE2", rowIsUniformSSE2);
+	if(hasAVX2 ())
+		checkRowIsUniform ("AVX2", rowIsUniformAVX2);
+	#elif PIXELKERNELS_NEON
+	checkRowIsUniform ("NEON", rowIsUniformNEON);
+	#endif
+}
+
+//************************************************************************************************
+// Copying and Blending
+//************************************************************************************************
+
+static void checkRowFunction (const char* name, RowFunction function, RowFunction scalarFunction)
+{
+	// the destinations are larger than the row, bytes past its end must stay untouched
+	const int32_t kGuard = 32;
+	std::vector<uint8_t> source (4 * 100 + kMaxOffset);
+	std::vector<uint8_t> destination (4 * 100 + kMaxOffset + kGuard);
+	std::vector<uint8_t> expected (destination.size ());
+	for(int iteration = 0; iteration < 4000; iteration++)
+	{
+		int32_t width = iteration < 100 ? iteration : generator.range (0, 100);
+		generator.fill (source.data (), source.size ());
+		generator.fill (destination.data (), destination.size ());
+		expected = destination;
+
+		// opaque and transparent pixels take shortcuts
+		uint8_t* sourceRow = source.data () + generator.range (0, kMaxOffset);
+		for(int32_t x = 0; x < width; x++)
+		{
+			uint32_t kind = generator.next () % 4;
+			if(kind == 0)
+				sourceRow[x * 4 + 3] = 0xff;
+			else if(kind == 1)
+				::memset (sourceRow + x * 4, 0, 4);
+		}
+
+		int32_t offset = generator.range (0, kMaxOffset);
+		function (destination.data () + offset, sourceRow, width);
+		scalarFunction (expected.data () + offset, sourceRow, width);
+
+		if(!CHECK (destination == expected))
+		{
+			std::cerr << name << ": width " << width << std::endl;
+			return;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void testCopyingAndBlending ()
+{
+	#if PIXELKERNELS_X86
+	checkRowFunction ("SSE2 copy", copyOpaqueRowSSE2, copyOpaqueRowScalar);
+	checkRowFunction ("SSE2 blend", blendRowSSE2, blendRowScalar);
+	if(hasAVX2 ())
+	{
+		checkRowFunction ("AVX2 copy", copyOpaqueRowAVX2, copyOpaqueRowScalar);
+		checkRowFunction ("AVX2 blend", blendRowAVX2, blendRowScalar);
+	}
+	#elif PIXELKERNELS_NEON
+	checkRowFunction ("NEON copy", copyOpaqueRowNEON, copyOpaqueRowScalar);
+	checkRowFunction ("NEON blend", blendRowNEON, blendRowScalar);
+	#endif
+}
+
+//************************************************************************************************
+// Format Conversion
+//************************************************************************************************
+
+static const uint32_t kConvertedFormats[] =
+{
+	WL_SHM_FORMAT_ARGB8888, WL_SHM_FORMAT_XRGB8888, WL_SHM_FORMAT_ABGR8888, WL_SHM_FORMAT_XBGR8888,
+	WL_SHM_FORMAT_RGBA8888, WL_SHM_FORMAT_RGBX8888, WL_SHM_FORMAT_BGRA8888, WL_SHM_FORMAT_BGRX8888,
+	WL_SHM_FORMAT_ARGB2101010, WL_SHM_FORMAT_XRGB2101010, WL_SHM_FORMAT_ABGR2101010, WL_SHM_FORMAT_XBGR2101010,
+	WL_SHM_FORMAT_RGB888, WL_SHM_FORMAT_BGR888, WL_SHM_FORMAT_RGB565, WL_SHM_FORMAT_BGR565,
+	WL_SHM_FORMAT_ARGB4444, WL_SHM_FORMAT_XRGB4444, WL_SHM_FORMAT_ARGB1555, WL_SHM_FORMAT_XRGB1555
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void checkConvertRow (const char* name, ConvertFunction function)
+{
+	const int32_t kGuard = 32;
+	std::vector<uint8_t> source (4 * 100 + kMaxOffset);
+	std::vector<uint8_t> destination (4 * 100 + kMaxOffset + kGuard);
+	std::vector<uint8_t> expected (destination.size ());
+	for(uint32_t format : kConvertedFormats)
+	{
+		CHECK (PixelKernels::getBytesPerPixel (format) > 0);
+
+		for(int iteration = 0; iteration < 1000; iteration++)
+		{
+			int32_t width = iteration < 100 ? iteration : generator.range (0, 100);
+			generator.fill (source.data (), source.size ());
+			generator.fill (destination.data (), destination.size ());
+			expected = destination;
+
+			const uint8_t* sourceRow = source.data () + generator.range (0, kMaxOffset);
+			int32_t offset = generator.range (0, kMaxOffset);
+			function (destination.data () + offset, sourceRow, width, format);
+			convertRowScalar (expected.data () + offset, sourceRow, width, format);
+
+			if(!CHECK (destination == expected))
+			{
+				std::cerr << name << ": format " << std::hex << format << std::dec << ", width " << width << std::endl;
+				return;
+			}
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void testFormatConversion ()
+{
+	#if PIXELKERNELS_X86
+	checkConvertRow ("SSE2", convertRowSSE2);
+	if(hasAVX2 ())
+		checkConvertRow ("AVX2", convertRowAVX2);
+	#elif PIXELKERNELS_NEON
+	checkConvertRow ("NEON", convertRowNEON);
+	#endif
+
+	// magenta RGB565, formats without alpha become opaque
+	const uint8_t source[2] = { 0x1f, 0xf8 };
+	uint8_t pixel[4] = {};
+	PixelKernels::convertPixels (pixel, 4, source, 2, 1, 1, WL_SHM_FORMAT_RGB565);
+	CHECK (pixel[0] == 0xff && pixel[1] == 0 && pixel[2] == 0xff && pixel[3] == 0xff);
+	CHECK (!PixelKernels::hasAlpha (WL_SHM_FORMAT_RGB565));
+	CHECK (PixelKernels::hasAlpha (WL_SHM_FORMAT_ARGB4444));
+}
+
+//************************************************************************************************
+// Downscaling
+//************************************************************************************************
+
+static void checkAccumulateRow (const char* name, AccumulateFunction function)
+{
+	std::vector<uint8_t> buffer (400 + kMaxOffset);
+	std::vector<uint32_t> sums (400);
+	std::vector<uint32_t> expected (sums.size ());
+	for(int iteration = 0; iteration < 4000; iteration++)
+	{
+		int32_t count = iteration < 400 ? iteration : generator.range (0, 400);
+		const uint8_t* row = buffer.data () + generator.range (0, kMaxOffset);
+		generator.fill (buffer.data (), buffer.size ());
+		for(uint32_t& sum : sums)
+			sum = generator.next () % 100000;
+		expected = sums;
+
+		function (sums.data (), row, count);
+		accumulateRowScalar (expected.data (), row, count);
+
+		if(!CHECK (sums == expected))
+		{
+			std::cerr << name << ": count " << count << std::endl;
+			return;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void testDownscaling ()
+{
+	#if PIXELKERNELS_X86
+	checkAccumulateRow ("SSE2", accumulateRowSSE2);
+	if(hasAVX2 ())
+		checkAccumulateRow ("AVX2", accumulateRowAVX2);
+	#elif PIXELKERNELS_NEON
+	checkAccumulateRow ("NEON", accumulateRowNEON);
+	#endif
+
+	// 2 x 2 pixels are averaged to one, with rounding
+	const uint8_t source[16] = { 0, 10, 20, 30,  1, 10, 20, 30,  2, 10, 20, 30,  2, 10, 21, 30 };
+	uint8_t pixel[4] = {};
+	PixelKernels::downscalePixels (pixel, 4, 1, 1, source, 8, 2, 2, false);
+	CHECK (pixel[0] == 1 && pixel[1] == 10 && pixel[2] == 20 && pixel[3] == 30);
+	PixelKernels::downscalePixels (pixel, 4, 1, 1, source, 8, 2, 2, true);
+	CHECK (pixel[3] == 0xff);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main ()
+{
+	testHash ();
+	testRowComparison ();
+	testAlpha ();
+	testUniformColor ();
+	testCopyingAndBlending ();
+	testFormatConversion ();
+	testDownscaling ();
+	return finish ("pixelkernelstest");
+}
@@ -0,0 +1,277 @@
+//************************************************************************************************
+//
+// Wayland Server Delegate
+//
+// Copyright (c) 2023 CCL Software Licensing GmbH. All Rights Reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// - Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// - Neither the name of the wayland-server-delegate project nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS",
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Filename    : regiontest.cpp
+// Description : Region Tests
+//
+//************************************************************************************************
+
+#include "testing.h"
+
+#include "region.h"
+
+#include <limits>
+
+using namespace WaylandServerDelegate;
+using namespace Testing;
+
+//************************************************************************************************
+// Bitmap
+// Reference implementation, one flag per pixel of a small area.
+//************************************************************************************************
+
+static const int kBitmapSize = 24;
+
+struct Bitmap
+{
+	bool pixels[kBitmapSize][kBitmapSize] = {};
+
+	void apply (const Rect& rect, bool value, bool intersect = false)
+	{
+		for(int y = 0; y < kBitmapSize; y++)
+			for(int x = 0; x < kBitmapSize; x++)
+			{
+				bool inside = x >= rect.left && x < rect.right && y >= rect.top && y < rect.bottom;
+				if(intersect)
+					pixels[y][x] = pixels[y][x] && inside;
+				else if(inside)
+					pixels[y][x] = value;
+			}
+	}
+
+	/** Build a region from the runs of each row. */
+	Region toRegion () const
+	{
+		Region region;
+		for(int y = 0; y < kBitmapSize; y++)
+			for(int x = 0; x < kBitmapSize;)
+			{
+				if(!pixels[y][x])
+				{
+					x++;
+					continue;
+				}
+				int start = x;
+				while(x < kBitmapSize && pixels[y][x])
+					x++;
+				region.unite (Rect (start, y, x - start, 1));
+			}
+		return region;
+	}
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool isCovered (const Region& region, int x, int y)
+{
+	for(const Rect& rect : region.getRects ())
+		if(x >= rect.left && x < rect.right && y >= rect.top && y < rect.bottom)
+			return true;
+	return false;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void checkInvariants (const Region& region)
+{
+	const std::vector<Rect>& rects = region.getRects ();
+	Rect extents;
+	for(size_t i = 0; i < rects.size (); i++)
+	{
+		const Rect& rect = rects[i];
+		CHECK (!rect.isEmpty ());
+		if(i == 0)
+			extents = rect;
+		extents.left = std::min (extents.left, rect.left);
+		extents.top = std::min (extents.top, rect.top);
+		extents.right = std::max (extents.right, rect.right);
+		extents.bottom = std::max (extents.bottom, rect.bottom);
+
+		if(i == 0)
+			continue;
+
+		// rectangles of a band share top and bottom and neither overlap nor touch, bands don't overlap
+		const Rect& previous = rects[i - 1];
+		if(rect.top == previous.top)
+		{
+			CHECK (rect.bottom == previous.bottom);
+			CHECK (rect.left > previous.right);
+		}
+		else
+			CHECK (rect.top >= previous.bottom);
+	}
+	CHECK (region.getExtents () == extents);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void checkEqual (const Region& region, const Bitmap& bitmap)
+{
+	checkInvariants (region);
+
+	bool equal = true;
+	for(int y = -2; y < kBitmapSize + 2; y++)
+		for(int x = -2; x < kBitmapSize + 2; x++)
+		{
+			bool expected = x >= 0 && y >= 0 && x < kBitmapSize && y < kBitmapSize && bitmap.pixels[y][x];
+			equal = equal && isCovered (region, x, y) == expected;
+		}
+	CHECK (equal);
+
+	// the representation is canonical, so equal areas have equal rectangles
+	CHECK (region == bitmap.toRegion ());
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void testRect ()
+{
+	Rect rect (10, 20, 30, 40);
+	CHECK (rect.left == 10 && rect.top == 20 && rect.right == 40 && rect.bottom == 60);
+
+	// negative sizes are empty, huge sizes are clamped
+	CHECK (Rect (5, 5, -1, 10).isEmpty ());
+	Rect everything (-10, 0, std::numeric_limits<int32_t>::max (), std::numeric_limits<int32_t>::max ());
+	CHECK (everything.right == std::numeric_limits<int32_t>::max () - 10);
+	CHECK (everything.bottom == std::numeric_limits<int32_t>::max ());
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void testOperations ()
+{
+	// adjacent bands with equal spans are coalesced
+	Region region (Rect (0, 0, 10, 10));
+	region.unite (Rect (0, 10, 10, 10));
+	CHECK (region.countRects () == 1);
+	CHECK (region.getExtents () == Rect (0, 0, 10, 20));
+
+	// a hole splits a rectangle into three bands
+	region.subtract (Rect (4, 4, 2, 2));
+	CHECK (region.countRects () == 4);
+	checkInvariants (region);
+
+	region.unite (Rect (4, 4, 2, 2));
+	CHECK (region == Region (Rect (0, 0, 10, 20)));
+
+	region.intersect (Rect (5, 5, 100, 100));
+	CHECK (region == Region (Rect (5, 5, 5, 15)));
+
+	region.intersect (Rect (50, 50, 10, 10));
+	CHECK (region.isEmpty ());
+	CHECK (region.getExtents ().isEmpty ());
+
+	// empty rectangles change nothing, except for an intersection
+	region = Region (Rect (0, 0, 10, 10));
+	region.unite (Rect (20, 20, 0, 5));
+	region.subtract (Rect (0, 0, 0, 0));
+	CHECK (region == Region (Rect (0, 0, 10, 10)));
+	region.intersect (Rect ());
+	CHECK (region.isEmpty ());
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void testRandomOperations ()
+{
+	Random random;
+	for(int iteration = 0; iteration < 2000; iteration++)
+	{
+		Region region;
+		Bitmap bitmap;
+		for(int step = 0; step < 12; step++)
+		{
+			int32_t x = random.range (-2, kBitmapSize);
+			int32_t y = random.range (-2, kBitmapSize);
+			Rect rect (x, y, random.range (0, 12), random.range (0, 12));
+
+			// clip to the bitmap, the reference can't represent more
+			Rect clipped (std::max (rect.left, 0), std::max (rect.top, 0), 0, 0);
+			clipped.right = std::min<int32_t> (rect.right, kBitmapSize);
+			clipped.bottom = std::min<int32_t> (rect.bottom, kBitmapSize);
+
+			int operation = int(random.next () % 5);
+			if(operation == 4)
+			{
+				// combine with another region
+				Region other;
+				Bitmap otherBitmap;
+				for(int i = 0; i < 3; i++)
+				{
+					Rect part (random.range (0, kBitmapSize - 1), random.range (0, kBitmapSize - 1), random.range (1, 8), random.range (1, 8));
+					part.right = std::min<int32_t> (part.right, kBitmapSize);
+					part.bottom = std::min<int32_t> (part.bottom, kBitmapSize);
+					other.unite (part);
+					otherBitmap.apply (part, true);
+				}
+				int mode = int(random.next () % 3);
+				if(mode == 0)
+					region.unite (other);
+				else if(mode == 1)
+					region.subtract (other);
+				else
+					region.intersect (other);
+				for(int py = 0; py < kBitmapSize; py++)
+					for(int px = 0; px < kBitmapSize; px++)
+					{
+						bool inOther = otherBitmap.pixels[py][px];
+						bool& pixel = bitmap.pixels[py][px];
+						pixel = mode == 0 ? pixel || inOther : mode == 1 ? pixel && !inOther : pixel && inOther;
+					}
+			}
+			else if(operation == 3)
+			{
+				region.intersect (clipped);
+				bitmap.apply (clipped, false, true);
+			}
+			else if(operation == 2)
+			{
+				region.subtract (clipped);
+				bitmap.apply (clipped, false);
+			}
+			else
+			{
+				region.unite (clipped);
+				bitmap.apply (clipped, true);
+			}
+			checkEqual (region, bitmap);
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main ()
+{
+	testRect ();
+	testOperations ();
+	testRandomOperations ();
+	return finish ("regiontest");
+}
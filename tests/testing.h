@@ -0,0 +1,117 @@
+//************************************************************************************************
+//
+// Wayland Server Delegate
+//
+// Copyright (c) 2023 CCL Software Licensing GmbH. All Rights Reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// - Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// - Neither the name of the wayland-server-delegate project nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS",
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Filename    : testing.h
+// Description : Test Helpers
+//
+//************************************************************************************************
+
+#ifndef _testing_h
+#define _testing_h
+
+#include <stdint.h>
+#include <iostream>
+
+namespace WaylandServerDelegate {
+namespace Testing {
+
+//************************************************************************************************
+// Testing
+//************************************************************************************************
+
+inline int& getFailureCount ()
+{
+	static int failures = 0;
+	return failures;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+inline bool check (bool condition, const char* expression, const char* file, int line)
+{
+	if(!condition)
+	{
+		std::cerr << file << ":" << line << ": check failed: " << expression << std::endl;
+		getFailureCount ()++;
+	}
+	return condition;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** Exit code of a test executable. */
+inline int finish (const char* name)
+{
+	if(getFailureCount () == 0)
+		return 0;
+
+	std::cerr << name << ": " << getFailureCount () << " checks failed" << std::endl;
+	return 1;
+}
+
+//************************************************************************************************
+// Random
+//************************************************************************************************
+
+/** Deterministic pseudo random numbers (xorshift), so that failures are reproducible. */
+class Random
+{
+public:
+	Random (uint64_t seed = 0x2545f4914f6cdd1dULL)
+	: state (seed)
+	{}
+
+	uint32_t next ()
+	{
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		return uint32_t(state >> 32);
+	}
+
+	/** Random number in [minimum, maximum]. */
+	int32_t range (int32_t minimum, int32_t maximum) { return minimum + int32_t(next () % uint32_t(maximum - minimum + 1)); }
+
+	void fill (uint8_t* data, size_t size)
+	{
+		for(size_t i = 0; i < size; i++)
+			data[i] = uint8_t(next ());
+	}
+
+private:
+	uint64_t state;
+};
+
+} // namespace Testing
+} // namespace WaylandServerDelegate
+
+#define CHECK(condition) WaylandServerDelegate::Testing::check (condition, #condition, __FILE__, __LINE__)
+
+#endif // _testing_h
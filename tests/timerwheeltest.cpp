@@ -0,0 +1,216 @@
+//************************************************************************************************
+//
+// Wayland Server Delegate
+//
+// Copyright (c) 2023 CCL Software Licensing GmbH. All Rights Reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// - Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// - Neither the name of the wayland-server-delegate project nor the names of its
+//   contributors may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS",
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Filename    : timerwheeltest.cpp
+// Description : Timer Wheel Tests
+//
+//************************************************************************************************
+
+#include "testing.h"
+
+#include "timerwheel.h"
+
+using namespace WaylandServerDelegate;
+using namespace Testing;
+
+// a small wheel, so that the random test wraps around often
+static const int kSlots = 16;
+static const uint32_t kResolution = 4;
+static const uint32_t kHorizon = kSlots * kResolution;
+
+typedef TimerWheel<int, kSlots, kResolution> Wheel;
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void testBasics ()
+{
+	Wheel wheel;
+	std::vector<int> dueItems;
+	CHECK (wheel.isEmpty ());
+
+	wheel.add (1, 110, 100);
+	wheel.add (2, 105, 100);
+	wheel.add (3, 130, 100);
+	CHECK (wheel.countItems () == 3);
+	CHECK (wheel.getNextDue () == 105);
+
+	// nothing is due early
+	wheel.advance (104, dueItems);
+	CHECK (dueItems.empty ());
+
+	wheel.advance (112, dueItems);
+	CHECK (dueItems.size () == 2 && dueItems[0] == 2 && dueItems[1] == 1);
+	CHECK (wheel.getNextDue () == 130);
+
+	CHECK (wheel.remove (3));
+	CHECK (!wheel.remove (3));
+	CHECK (wheel.isEmpty ());
+
+	wheel.add (4, 200, 150);
+	wheel.clear ();
+	CHECK (wheel.isEmpty ());
+	dueItems.clear ();
+	wheel.advance (300, dueItems);
+	CHECK (dueItems.empty ());
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void testTimestampWrap ()
+{
+	Wheel wheel;
+	std::vector<int> dueItems;
+	uint32_t now = 0xffffffff - 10;
+
+	wheel.add (1, now + 5, now);
+	wheel.add (2, now + 20, now); // past zero
+	CHECK (wheel.getNextDue () == now + 5);
+
+	wheel.advance (now + 6, dueItems);
+	CHECK (dueItems.size () == 1 && dueItems[0] == 1);
+	CHECK (wheel.getNextDue () == now + 20);
+
+	wheel.advance (now + 19, dueItems);
+	CHECK (dueItems.size () == 1);
+	wheel.advance (now + 20, dueItems);
+	CHECK (dueItems.size () == 2 && dueItems[1] == 2);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void testFarItems ()
+{
+	// items due beyond the horizon share slots with earlier ones, but are not returned early
+	Wheel wheel;
+	std::vector<int> dueItems;
+	wheel.add (1, 1000 + kHorizon + 2, 1000);
+	wheel.add (2, 1002, 1000);
+	wheel.add (3, 1010, 1000);
+	CHECK (wheel.getNextDue () == 1002);
+	CHECK (wheel.remove (2));
+	CHECK (wheel.getNextDue () == 1010);
+	wheel.add (2, 1002, 1000);
+	wheel.advance (1001, dueItems);
+	CHECK (dueItems.empty ());
+	wheel.advance (1010, dueItems);
+	CHECK (dueItems.size () == 2 && dueItems[0] == 2 && dueItems[1] == 3);
+	CHECK (wheel.getNextDue () == 1000 + kHorizon + 2);
+
+	dueItems.clear ();
+	for(uint32_t now = 1010; now < 1000 + kHorizon + 2; now += kResolution)
+		wheel.advance (now, dueItems);
+	CHECK (dueItems.empty ());
+
+	wheel.advance (1000 + kHorizon + 2, dueItems);
+	CHECK (dueItems.size () == 1 && dueItems[0] == 1);
+	CHECK (wheel.isEmpty ());
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void testRandomOrder ()
+{
+	struct Pending
+	{
+		int item;
+		uint32_t due;
+	};
+
+	Random random;
+	Wheel wheel;
+	std::vector<Pending> pending;
+	std::vector<int> dueItems;
+	uint32_t now = 0xffffffff - 5000; // wraps during the test
+	int nextItem = 0;
+
+	for(int step = 0; step < 20000; step++)
+	{
+		// items due within the horizon
+		for(int i = random.range (0, 3); i > 0; i--)
+		{
+			Pending entry = { nextItem++, now + uint32_t(random.range (0, kHorizon - 1)) };
+			wheel.add (entry.item, entry.due, now);
+			pending.push_back (entry);
+		}
+
+		// cancel one now and then
+		if(!pending.empty () && random.range (0, 9) == 0)
+		{
+			size_t index = size_t(random.range (0, int32_t(pending.size ()) - 1));
+			CHECK (wheel.remove (pending[index].item));
+			pending.erase (pending.begin () + index);
+		}
+
+		CHECK (wheel.countItems () == int(pending.size ()));
+		if(!pending.empty ())
+		{
+			uint32_t earliest = pending.front ().due;
+			for(const Pending& entry : pending)
+				if(int32_t(entry.due - earliest) < 0)
+					earliest = entry.due;
+			CHECK (wheel.getNextDue () == earliest);
+		}
+
+		uint32_t previous = now;
+		now += uint32_t(random.range (0, 10));
+		dueItems.clear ();
+		wheel.advance (now, dueItems);
+
+		// exactly the items due by now are returned, slot by slot
+		uint32_t previousSlot = 0;
+		for(int item : dueItems)
+		{
+			auto entry = pending.begin ();
+			while(entry != pending.end () && entry->item != item)
+				++entry;
+			if(!CHECK (entry != pending.end ()))
+				return;
+
+			CHECK (int32_t(now - entry->due) >= 0);
+			uint32_t slot = (entry->due - (previous - previous % kResolution)) / kResolution;
+			CHECK (slot >= previousSlot);
+			previousSlot = slot;
+			pending.erase (entry);
+		}
+		for(const Pending& entry : pending)
+			CHECK (int32_t(now - entry.due) < 0);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main ()
+{
+	testBasics ();
+	testTimestampWrap ();
+	testFarItems ();
+	testRandomOrder ();
+	return finish ("timerwheeltest");
+}
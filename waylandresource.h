@@ -86,6 +86,14 @@ public:
 	void wrapProxy ();
 	void assignQueue ();
 
+	template<class T>
+	T* getWrappedProxy ()
+	{
+		if(proxyWrapper == nullptr)
+			wrapProxy ();
+		return reinterpret_cast<T*> (proxyWrapper);
+	}
+
 protected:
 	const wl_interface* waylandInterface;
 	void* implementation;